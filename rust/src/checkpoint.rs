@@ -0,0 +1,202 @@
+//! Checkpoints for client-side assembly.
+//!
+//! Layering packages means checking them out into a copy of the base tree,
+//! running their scriptlets and writing the rpmdb, which can take a while.
+//! Everything after that (postprocessing, the initramfs, the commit) modifies
+//! the tree further, so if we get interrupted there, e.g. by losing power
+//! while generating the initramfs, the tree can't be reused as is.
+//!
+//! So once assembly is done, if the initramfs is going to be regenerated, the
+//! tree is hardlinked into a checkpoint next to the tmprootfs, along with a
+//! description of the inputs it was assembled from.  A later assembly from
+//! the same inputs starts from a copy of it instead.  Hardlinking is fine here
+//! for the same reason it is for the checkout in the first place: nothing
+//! modifies files of the tmprootfs in place.
+
+// SPDX-License-Identifier: Apache-2.0 OR MIT
+
+use crate::cxxrsutil::*;
+use crate::ffi::AssemblyCheckpoint;
+use anyhow::Result;
+use openat_ext::OpenatDirExt;
+use serde_derive::{Deserialize, Serialize};
+use std::os::unix::io::AsRawFd;
+
+/// Within the checkpoint directory.
+const CHECKPOINT_ROOTFS: &str = "rootfs";
+const CHECKPOINT_STATE: &str = "state.json";
+
+/// How far assembly had gotten; there's just the one phase we can resume from
+/// for now.
+#[derive(Serialize, Deserialize, Debug, PartialEq)]
+#[serde(rename_all = "kebab-case")]
+enum Phase {
+    /// Packages checked out, scripts run and rpmdb written.
+    Assembled,
+}
+
+#[derive(Serialize, Deserialize, Debug, PartialEq)]
+#[serde(rename_all = "kebab-case")]
+struct CheckpointState {
+    /// Opaque checksum of the inputs to assembly.
+    inputs: String,
+    phase: Phase,
+    kernel_changed: bool,
+}
+
+fn load_state(repo_dfd: &openat::Dir, checkpoint: &str) -> Result<Option<CheckpointState>> {
+    let path = format!("{}/{}", checkpoint, CHECKPOINT_STATE);
+    let f = match repo_dfd.open_file_optional(&path)? {
+        Some(f) => f,
+        None => return Ok(None),
+    };
+    // If we can't parse it, it's from some other version; just ignore it.
+    Ok(serde_json::from_reader(std::io::BufReader::new(f)).ok())
+}
+
+/// Save the assembled tree at `rootfs` as a checkpoint at `checkpoint`, both
+/// relative to the repo.  Any previous checkpoint is replaced.
+pub(crate) fn assembly_checkpoint_save(
+    repo_dfd: i32,
+    rootfs: &str,
+    checkpoint: &str,
+    inputs: &str,
+    kernel_changed: bool,
+) -> CxxResult<()> {
+    let repo_dfd = crate::ffiutil::ffi_view_openat_dir(repo_dfd);
+    let tmp = format!("{}.tmp", checkpoint);
+    repo_dfd.remove_all(&tmp)?;
+    repo_dfd.remove_all(checkpoint)?;
+
+    let tmp_rootfs = format!("{}/{}", tmp, CHECKPOINT_ROOTFS);
+    let root_stat = *repo_dfd.metadata(rootfs)?.stat();
+    repo_dfd.create_dir(&tmp, 0o700)?;
+    repo_dfd.create_dir(&tmp_rootfs, root_stat.st_mode & !libc::S_IFMT)?;
+    crate::composepost::copy_dir_metadata(&repo_dfd, rootfs, &tmp_rootfs)?;
+    crate::composepost::hardlink_hierarchy(&repo_dfd, rootfs, &tmp_rootfs, true, None)?;
+
+    let state = CheckpointState {
+        inputs: inputs.to_string(),
+        phase: Phase::Assembled,
+        kernel_changed,
+    };
+    let state_path = format!("{}/{}", tmp, CHECKPOINT_STATE);
+    repo_dfd.write_file_with(&state_path, 0o644, |w| -> Result<()> {
+        Ok(serde_json::to_writer(w, &state)?)
+    })?;
+    // Whatever the scripts wrote may still only be in the page cache; make sure
+    // it's all on disk before we claim the checkpoint is valid.
+    if unsafe { libc::syncfs(repo_dfd.as_raw_fd()) } < 0 {
+        return Err(anyhow::Error::new(std::io::Error::last_os_error())
+            .context("syncfs")
+            .into());
+    }
+    repo_dfd.local_rename(&tmp, checkpoint)?;
+    Ok(())
+}
+
+/// Look for a checkpoint at `checkpoint` for the given inputs.  Checkpoints for
+/// other inputs are stale and get removed.
+pub(crate) fn assembly_checkpoint_find(
+    repo_dfd: i32,
+    checkpoint: &str,
+    inputs: &str,
+) -> CxxResult<AssemblyCheckpoint> {
+    let repo_dfd = crate::ffiutil::ffi_view_openat_dir(repo_dfd);
+    match load_state(&repo_dfd, checkpoint)? {
+        Some(state) if state.inputs == inputs && state.phase == Phase::Assembled => {
+            Ok(AssemblyCheckpoint {
+                found: true,
+                kernel_changed: state.kernel_changed,
+            })
+        }
+        _ => {
+            repo_dfd.remove_all(checkpoint)?;
+            Ok(AssemblyCheckpoint {
+                found: false,
+                kernel_changed: false,
+            })
+        }
+    }
+}
+
+/// Recreate the tree at `rootfs` from the checkpoint at `checkpoint`; `rootfs`
+/// must not exist.  The checkpoint itself is kept until it's cleared, in case
+/// we get interrupted again.
+pub(crate) fn assembly_checkpoint_restore(
+    repo_dfd: i32,
+    checkpoint: &str,
+    rootfs: &str,
+) -> CxxResult<()> {
+    let repo_dfd = crate::ffiutil::ffi_view_openat_dir(repo_dfd);
+    let src = format!("{}/{}", checkpoint, CHECKPOINT_ROOTFS);
+    let src_stat = *repo_dfd.metadata(&src)?.stat();
+    repo_dfd.create_dir(rootfs, src_stat.st_mode & !libc::S_IFMT)?;
+    crate::composepost::copy_dir_metadata(&repo_dfd, &src, rootfs)?;
+    crate::composepost::hardlink_hierarchy(&repo_dfd, &src, rootfs, true, None)?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_checkpoint() -> Result<()> {
+        let td = tempfile::tempdir()?;
+        let d = openat::Dir::open(td.path())?;
+        let dfd = d.as_raw_fd();
+        d.ensure_dir_all("commit/usr/bin", 0o755)?;
+        d.write_file_contents("commit/usr/bin/foo", 0o755, "foo")?;
+        d.symlink("commit/bin", "usr/bin")?;
+        // Not all filesystems support user xattrs, e.g. older tmpfs
+        let xattr_name = std::ffi::CString::new("user.rpmostree-test")?;
+        let usrbin = std::ffi::CString::new(td.path().join("commit/usr/bin").to_str().unwrap())?;
+        let have_xattrs = unsafe {
+            libc::setxattr(
+                usrbin.as_ptr(),
+                xattr_name.as_ptr(),
+                b"label".as_ptr() as *const libc::c_void,
+                5,
+                0,
+            )
+        } == 0;
+
+        assert!(!assembly_checkpoint_find(dfd, "checkpoint", "a")?.found);
+        assembly_checkpoint_save(dfd, "commit", "checkpoint", "a", true)?;
+        assert!(!d.exists("checkpoint.tmp")?);
+        let found = assembly_checkpoint_find(dfd, "checkpoint", "a")?;
+        assert!(found.found);
+        assert!(found.kernel_changed);
+
+        std::fs::remove_dir_all(td.path().join("commit"))?;
+        assembly_checkpoint_restore(dfd, "checkpoint", "commit")?;
+        assert_eq!(d.read_to_string("commit/usr/bin/foo")?, "foo");
+        assert_eq!(
+            d.read_link("commit/bin")?,
+            std::path::PathBuf::from("usr/bin")
+        );
+        if have_xattrs {
+            let mut buf = [0u8; 16];
+            let len = unsafe {
+                libc::getxattr(
+                    usrbin.as_ptr(),
+                    xattr_name.as_ptr(),
+                    buf.as_mut_ptr() as *mut libc::c_void,
+                    buf.len(),
+                )
+            };
+            assert_eq!(&buf[..len as usize], b"label");
+        }
+        // it's the same file
+        assert_eq!(
+            d.metadata("commit/usr/bin/foo")?.stat().st_ino,
+            d.metadata("checkpoint/rootfs/usr/bin/foo")?.stat().st_ino
+        );
+
+        // different inputs; the checkpoint is stale
+        assert!(!assembly_checkpoint_find(dfd, "checkpoint", "b")?.found);
+        assert!(!d.exists("checkpoint")?);
+        Ok(())
+    }
+}
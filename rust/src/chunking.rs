@@ -0,0 +1,452 @@
+//! Package-aware assignment of files to container image layers.
+//!
+//! The goal is that an update to a single package changes as few layers
+//! as possible.  To get there, every package maps to a layer independently
+//! of its version and of the other packages: large, frequently updated
+//! packages get a layer of their own, and all others are spread over a
+//! fixed number of shared layers by a hash of their name.  Each path of
+//! the commit is in exactly one layer: everything not owned by exactly one
+//! package (generated files, the rpmdb, paths shared between packages) goes
+//! in a final layer.
+
+// SPDX-License-Identifier: Apache-2.0 OR MIT
+
+use crate::cxxrsutil::*;
+use crate::ffi::PackageMeta;
+use anyhow::{anyhow, Result};
+use gio::prelude::*;
+use serde_derive::{Deserialize, Serialize};
+use std::collections::{BTreeMap, BTreeSet, HashMap};
+
+/// Default total number of layers, including the final one.
+pub(crate) const DEFAULT_MAX_LAYERS: u32 = 64;
+
+/// Changelog entries this close to the newest one count towards how
+/// often a package is updated.  Relative to the package itself rather than
+/// the current time so the result is reproducible.
+const FREQUENCY_WINDOW_SECS: u64 = 2 * 365 * 24 * 60 * 60;
+
+/// Name of the layer holding everything not owned by exactly one package.
+const UNPACKAGED_LAYER: &str = "unpackaged";
+
+/// An installed package, the unit of layer assignment.  Installed
+/// instances sharing a `name.arch` (e.g. kernels) are a single component.
+#[derive(Debug)]
+pub(crate) struct Component {
+    /// `name.arch`
+    pub(crate) name: String,
+    /// Total size of the files in `paths`.
+    pub(crate) size: u64,
+    /// Number of recent changelog entries.
+    pub(crate) frequency: u32,
+    /// Paths in the commit owned by this package only.
+    pub(crate) paths: Vec<String>,
+}
+
+/// The paths of a commit not owned by exactly one package.
+#[derive(Debug, Default)]
+pub(crate) struct Unpackaged {
+    /// Total size of the files in `paths`.
+    pub(crate) size: u64,
+    pub(crate) paths: Vec<String>,
+}
+
+/// A planned image layer.
+#[derive(Debug, Default, Serialize, Deserialize)]
+pub(crate) struct Layer {
+    pub(crate) name: String,
+    pub(crate) size: u64,
+    pub(crate) packages: Vec<String>,
+    pub(crate) paths: Vec<String>,
+}
+
+/// The full layer assignment for a commit.
+#[derive(Debug, Default, Serialize, Deserialize)]
+pub(crate) struct LayerPlan {
+    pub(crate) layers: Vec<Layer>,
+}
+
+impl LayerPlan {
+    /// Packages that had a layer of their own.
+    pub(crate) fn dedicated_packages(&self) -> BTreeSet<String> {
+        self.layers
+            .iter()
+            .filter_map(|l| l.name.strip_prefix("pkg-"))
+            .map(|s| s.to_string())
+            .collect()
+    }
+}
+
+/// FNV-1a; we need a hash which is stable across builds and Rust versions.
+fn stable_hash(s: &str) -> u64 {
+    s.bytes().fold(0xcbf29ce484222325, |h, b| {
+        (h ^ b as u64).wrapping_mul(0x100000001b3)
+    })
+}
+
+/// Split `max_layers` into dedicated and shared layers; one is always
+/// reserved for unpackaged content.  With a single layer there are neither,
+/// and packages go to the unpackaged layer too.
+fn layer_counts(max_layers: u32) -> (usize, usize) {
+    let available = max_layers.saturating_sub(1) as usize;
+    if available == 0 {
+        return (0, 0);
+    }
+    let n_shared = (available / 4).max(1);
+    (available - n_shared, n_shared)
+}
+
+/// Assign components to layers.  Packages in `previous_dedicated` which are
+/// still installed keep their own layer, so that small changes in size or
+/// update frequency don't shuffle layers between builds.
+pub(crate) fn assign_layers(
+    components: Vec<Component>,
+    unpackaged: Unpackaged,
+    max_layers: u32,
+    previous_dedicated: &BTreeSet<String>,
+) -> LayerPlan {
+    let (n_dedicated, n_shared) = layer_counts(max_layers);
+
+    let mut by_score: Vec<&Component> = components.iter().collect();
+    by_score.sort_by(|a, b| {
+        let sa = a.size.saturating_mul(1 + a.frequency as u64);
+        let sb = b.size.saturating_mul(1 + b.frequency as u64);
+        sb.cmp(&sa).then_with(|| a.name.cmp(&b.name))
+    });
+    let mut dedicated: BTreeSet<&str> = by_score
+        .iter()
+        .filter(|c| previous_dedicated.contains(&c.name))
+        .take(n_dedicated)
+        .map(|c| c.name.as_str())
+        .collect();
+    for c in by_score {
+        if dedicated.len() >= n_dedicated {
+            break;
+        }
+        dedicated.insert(c.name.as_str());
+    }
+    let dedicated: BTreeSet<String> = dedicated.into_iter().map(|s| s.to_string()).collect();
+
+    let mut dedicated_layers = BTreeMap::new();
+    let mut shared_layers: Vec<Layer> = (0..n_shared)
+        .map(|i| Layer {
+            name: format!("shared-{}", i),
+            ..Default::default()
+        })
+        .collect();
+    let mut unpackaged_layer = Layer {
+        name: UNPACKAGED_LAYER.to_string(),
+        size: unpackaged.size,
+        paths: unpackaged.paths,
+        ..Default::default()
+    };
+    for c in components {
+        let layer = if dedicated.contains(&c.name) {
+            dedicated_layers
+                .entry(c.name.clone())
+                .or_insert_with(|| Layer {
+                    name: format!("pkg-{}", c.name),
+                    ..Default::default()
+                })
+        } else if n_shared > 0 {
+            let i = (stable_hash(&c.name) % n_shared as u64) as usize;
+            &mut shared_layers[i]
+        } else {
+            &mut unpackaged_layer
+        };
+        layer.size += c.size;
+        layer.packages.push(c.name);
+        layer.paths.extend(c.paths);
+    }
+
+    let mut layers: Vec<Layer> = dedicated_layers.into_iter().map(|(_, l)| l).collect();
+    layers.extend(shared_layers);
+    layers.push(unpackaged_layer);
+    for layer in layers.iter_mut() {
+        layer.packages.sort();
+        layer.paths.sort();
+    }
+    LayerPlan { layers }
+}
+
+/// Count the changelog entries within `FREQUENCY_WINDOW_SECS` of the newest.
+fn update_frequency(changelogs: &[u64]) -> u32 {
+    let newest = match changelogs.iter().max() {
+        Some(t) => *t,
+        None => return 0,
+    };
+    let cutoff = newest.saturating_sub(FREQUENCY_WINDOW_SECS);
+    changelogs.iter().filter(|t| **t >= cutoff).count() as u32
+}
+
+/// Merge the installed instances of each `name.arch` into a component, and
+/// give it the paths of `commit_paths` (with the sizes of their files) owned
+/// by it alone.  Sizes only count what ends up in the component's layer, so
+/// not e.g. files shared with other packages.  Returns the components and the
+/// remaining paths.
+fn assign_owners(
+    packages: Vec<PackageMeta>,
+    commit_paths: Vec<(String, u64)>,
+) -> (Vec<Component>, Unpackaged) {
+    let mut components: Vec<Component> = Vec::new();
+    let mut indices: HashMap<String, usize> = HashMap::new();
+    // The owning component of each path, or None if there are several.
+    let mut owners: HashMap<String, Option<usize>> = HashMap::new();
+    for pkg in packages {
+        let name = pkg.name;
+        let i = *indices.entry(name.clone()).or_insert_with(|| {
+            components.push(Component {
+                name,
+                size: 0,
+                frequency: 0,
+                paths: Vec::new(),
+            });
+            components.len() - 1
+        });
+        let c = &mut components[i];
+        c.frequency = c.frequency.max(update_frequency(&pkg.changelogs));
+        for path in pkg.paths {
+            owners
+                .entry(path)
+                .and_modify(|o| {
+                    if *o != Some(i) {
+                        *o = None
+                    }
+                })
+                .or_insert(Some(i));
+        }
+    }
+
+    let mut unpackaged = Unpackaged::default();
+    for (path, size) in commit_paths {
+        match owners.get(&path) {
+            Some(Some(i)) => {
+                let c = &mut components[*i];
+                c.size += size;
+                c.paths.push(path);
+            }
+            _ => {
+                unpackaged.size += size;
+                unpackaged.paths.push(path);
+            }
+        }
+    }
+    (components, unpackaged)
+}
+
+/// Recursively collect the paths under `dir`, which is at `prefix`, along
+/// with the sizes of regular files.
+fn walk_commit_dir(dir: &gio::File, prefix: &str, paths: &mut Vec<(String, u64)>) -> Result<()> {
+    let children = dir.enumerate_children(
+        "standard::name,standard::type,standard::size",
+        gio::FileQueryInfoFlags::NOFOLLOW_SYMLINKS,
+        gio::NONE_CANCELLABLE,
+    )?;
+    while let Some(info) = children.next_file(gio::NONE_CANCELLABLE)? {
+        let name = info
+            .get_name()
+            .ok_or_else(|| anyhow!("Missing name in {}", prefix))?;
+        let name = name
+            .to_str()
+            .ok_or_else(|| anyhow!("Invalid UTF-8 name in {}", prefix))?;
+        let path = format!("{}/{}", prefix, name);
+        let size = match info.get_file_type() {
+            gio::FileType::Directory => {
+                walk_commit_dir(&dir.get_child(name), &path, paths)?;
+                0
+            }
+            gio::FileType::Regular => info.get_size() as u64,
+            _ => 0,
+        };
+        paths.push((path, size));
+    }
+    Ok(())
+}
+
+/// Gather the packages of a commit from its rpmdb, and assign each path of
+/// the commit to the package owning it.  Returns the packages, and the paths
+/// not owned by exactly one of them.
+pub(crate) fn components_for_commit(
+    repo: &ostree::Repo,
+    rev: &str,
+) -> Result<(Vec<Component>, Unpackaged)> {
+    let ts = crate::ffi::rpmts_for_commit(repo.gobj_rewrap(), rev)?;
+    let (root, _) = repo.read_commit(rev, gio::NONE_CANCELLABLE)?;
+    let mut commit_paths = Vec::new();
+    walk_commit_dir(&root, "", &mut commit_paths)?;
+    Ok(assign_owners(ts.packages(), commit_paths))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn component(name: &str, size: u64, frequency: u32) -> Component {
+        Component {
+            name: name.to_string(),
+            size,
+            frequency,
+            paths: vec![format!("/usr/share/{}", name)],
+        }
+    }
+
+    fn layer_of<'a>(plan: &'a LayerPlan, pkg: &str) -> &'a str {
+        plan.layers
+            .iter()
+            .find(|l| l.packages.iter().any(|p| p == pkg))
+            .map(|l| l.name.as_str())
+            .unwrap()
+    }
+
+    #[test]
+    fn test_layer_counts() {
+        assert_eq!(layer_counts(64), (48, 15));
+        assert_eq!(layer_counts(4), (2, 1));
+        assert_eq!(layer_counts(2), (0, 1));
+        assert_eq!(layer_counts(1), (0, 0));
+    }
+
+    #[test]
+    fn test_update_frequency() {
+        let year = 365 * 24 * 60 * 60;
+        assert_eq!(update_frequency(&[]), 0);
+        assert_eq!(update_frequency(&[10 * year, 9 * year, 7 * year]), 2);
+    }
+
+    #[test]
+    fn test_assign_layers() {
+        let components = || {
+            let mut v = vec![
+                component("kernel-core.x86_64", 1000, 50),
+                component("glibc.x86_64", 800, 10),
+                component("bash.x86_64", 100, 1),
+            ];
+            for i in 0..10 {
+                v.push(component(&format!("small{}.noarch", i), 1, 0));
+            }
+            v
+        };
+        let none = BTreeSet::new();
+        // 2 dedicated, 1 shared, 1 unpackaged
+        let rpmdb = || Unpackaged {
+            size: 5,
+            paths: vec!["/usr/share/rpm".into()],
+        };
+        let plan = assign_layers(components(), rpmdb(), 4, &none);
+        assert_eq!(plan.layers.len(), 4);
+        assert_eq!(
+            layer_of(&plan, "kernel-core.x86_64"),
+            "pkg-kernel-core.x86_64"
+        );
+        assert_eq!(layer_of(&plan, "glibc.x86_64"), "pkg-glibc.x86_64");
+        assert_eq!(layer_of(&plan, "bash.x86_64"), "shared-0");
+        assert_eq!(plan.layers.last().unwrap().name, UNPACKAGED_LAYER);
+        let paths: usize = plan.layers.iter().map(|l| l.paths.len()).sum();
+        assert_eq!(paths, 14);
+        assert_eq!(plan.layers[3].paths, vec!["/usr/share/rpm"]);
+        assert_eq!(plan.layers[3].size, 5);
+
+        // With a single layer, everything goes in it.
+        let single = assign_layers(components(), rpmdb(), 1, &none);
+        assert_eq!(single.layers.len(), 1);
+        assert_eq!(single.layers[0].name, UNPACKAGED_LAYER);
+        assert_eq!(single.layers[0].packages.len(), 13);
+        assert_eq!(single.layers[0].paths.len(), 14);
+        assert_eq!(single.layers[0].size, 1000 + 800 + 100 + 10 + 5);
+
+        // A bigger bash takes glibc's place, unless glibc was dedicated before.
+        let mut grown = components();
+        grown[2].size = 10000;
+        let plan2 = assign_layers(grown, Unpackaged::default(), 4, &none);
+        assert_eq!(layer_of(&plan2, "glibc.x86_64"), "shared-0");
+        let mut grown = components();
+        grown[2].size = 10000;
+        let plan3 = assign_layers(grown, Unpackaged::default(), 4, &plan.dedicated_packages());
+        assert_eq!(layer_of(&plan3, "glibc.x86_64"), "pkg-glibc.x86_64");
+        assert_eq!(layer_of(&plan3, "bash.x86_64"), "shared-0");
+    }
+
+    #[test]
+    fn test_shared_layers_stable() {
+        let none = BTreeSet::new();
+        let components = |skip: usize| {
+            // 6 dedicated, 2 shared, 1 unpackaged
+            let big = (0..6).map(|i| component(&format!("big{}.x86_64", i), 1000, 0));
+            let small = (skip..40).map(|i| component(&format!("small{}.noarch", i), 1, 0));
+            big.chain(small).collect::<Vec<_>>()
+        };
+        let plan = assign_layers(components(0), Unpackaged::default(), 9, &none);
+        assert_eq!(plan.layers.len(), 9);
+        assert!(!plan.layers[6].packages.is_empty());
+        assert!(!plan.layers[7].packages.is_empty());
+
+        // Dropping or updating a package doesn't move any of the others.
+        let mut fewer = components(1);
+        fewer[6].size = 2;
+        let plan2 = assign_layers(fewer, Unpackaged::default(), 9, &none);
+        for i in 1..40 {
+            let name = format!("small{}.noarch", i);
+            assert_eq!(layer_of(&plan, &name), layer_of(&plan2, &name));
+        }
+    }
+
+    #[test]
+    fn test_assign_owners() {
+        let pkg = |name: &str, paths: &[&str]| PackageMeta {
+            name: name.to_string(),
+            changelogs: vec![],
+            paths: paths.iter().map(|s| s.to_string()).collect(),
+        };
+        let packages = vec![
+            pkg("bash.x86_64", &["/usr/bin/bash", "/usr/share/licenses"]),
+            pkg(
+                "glibc.x86_64",
+                &["/usr/lib64/libc.so.6", "/usr/share/licenses"],
+            ),
+            pkg("kernel.x86_64", &["/usr/lib/modules/1"]),
+            pkg("kernel.x86_64", &["/usr/lib/modules/2"]),
+            pkg("setup.noarch", &["/usr/etc/passwd", "/var/log"]),
+            pkg("gpg-pubkey.", &[]),
+        ];
+        let commit_paths = [
+            ("/usr", 0),
+            ("/usr/bin", 0),
+            ("/usr/bin/bash", 1),
+            ("/usr/etc/passwd", 1),
+            ("/usr/lib/modules/1", 1),
+            ("/usr/lib/modules/2", 1),
+            ("/usr/lib64/libc.so.6", 1),
+            ("/usr/share/licenses", 10),
+            ("/usr/share/rpm", 100),
+        ];
+        let (components, unpackaged) = assign_owners(
+            packages,
+            commit_paths
+                .iter()
+                .map(|(p, s)| (p.to_string(), *s))
+                .collect(),
+        );
+        let by_name: BTreeMap<_, _> = components
+            .iter()
+            .map(|c| (c.name.as_str(), (c.size, c.paths.clone())))
+            .collect();
+        assert_eq!(by_name.len(), 5);
+        assert_eq!(by_name["bash.x86_64"], (1, vec!["/usr/bin/bash".into()]));
+        assert_eq!(
+            by_name["kernel.x86_64"],
+            (
+                2,
+                vec!["/usr/lib/modules/1".into(), "/usr/lib/modules/2".into()]
+            )
+        );
+        assert_eq!(by_name["setup.noarch"], (1, vec!["/usr/etc/passwd".into()]));
+        assert!(by_name["gpg-pubkey."].1.is_empty());
+        // The shared license file counts towards neither bash nor glibc
+        assert_eq!(by_name["glibc.x86_64"].0, 1);
+        assert_eq!(
+            unpackaged.paths,
+            vec!["/usr", "/usr/bin", "/usr/share/licenses", "/usr/share/rpm"]
+        );
+        assert_eq!(unpackaged.size, 110);
+    }
+}
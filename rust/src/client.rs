@@ -111,6 +111,11 @@ fn is_http(arg: &str) -> bool {
 /// Given a string from the command line, determine if it represents one or more
 /// RPM URLs we need to fetch, and if so download those URLs and return file
 /// descriptors for the content.
+///
+/// The URLs are fetched concurrently, but each file is only imported once all
+/// of them are in: the importer runs in the daemon, which receives the fds in
+/// a single D-Bus call per transaction.  Importing each file as it lands would
+/// need an API to stream fds into a running transaction.
 /// TODO(cxx-rs): This would be slightly more elegant as Result<Option<Vec<i32>>>
 pub(crate) fn client_handle_fd_argument(arg: &str, arch: &str) -> CxxResult<Vec<i32>> {
     #[cfg(feature = "fedora-integration")]
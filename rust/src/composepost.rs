@@ -889,6 +889,7 @@ fn hardlink_rpmdb_base_location(
         rootfs,
         RPMOSTREE_RPMDB_LOCATION,
         RPMOSTREE_BASE_RPMDB,
+        false,
         cancellable,
     )?;
 
@@ -899,23 +900,102 @@ fn hardlink_rpmdb_base_location(
     Ok(true)
 }
 
-/// Recursively hard-link `source` hierarchy to `target` directory.
+/// Recursively hard-link `source` hierarchy to `target` directory.  If `copy_metadata`
+/// is set, new directories are also given the owner and xattrs (e.g. the SELinux
+/// label) of their source; see `copy_dir_metadata()`.
 ///
 /// Both directories must exist beforehand.
 #[context("Hardlinking /{} to /{}", source, target)]
-fn hardlink_hierarchy(
+pub(crate) fn hardlink_hierarchy(
     rootfs: &openat::Dir,
     source: &str,
     target: &str,
+    copy_metadata: bool,
     cancellable: Option<&gio::Cancellable>,
 ) -> Result<()> {
     let mut prefix = "".to_string();
-    hardlink_recurse(rootfs, source, target, &mut prefix, &cancellable)
-        .with_context(|| format!("Analyzing /{}/{} content", source, prefix))?;
+    hardlink_recurse(
+        rootfs,
+        source,
+        target,
+        &mut prefix,
+        copy_metadata,
+        &cancellable,
+    )
+    .with_context(|| format!("Analyzing /{}/{} content", source, prefix))?;
 
     Ok(())
 }
 
+/// Give the directory `dest` the owner and extended attributes of `source`.
+/// Unlike files, directories can't be hardlinked, so this is what keeps e.g.
+/// their SELinux labels when copying a tree by hardlinks.
+pub(crate) fn copy_dir_metadata(rootfs: &openat::Dir, source: &str, dest: &str) -> Result<()> {
+    use nix::fcntl::OFlag;
+    // fchown() and the xattr calls don't operate on an O_PATH descriptor
+    let flag = OFlag::O_DIRECTORY | OFlag::O_NOFOLLOW | OFlag::O_CLOEXEC;
+    let src = nix::dir::Dir::openat(rootfs.as_raw_fd(), source, flag, Mode::empty())?;
+    let dest = nix::dir::Dir::openat(rootfs.as_raw_fd(), dest, flag, Mode::empty())?;
+    let stat = nix::sys::stat::fstat(src.as_raw_fd())?;
+    nix::unistd::fchown(
+        dest.as_raw_fd(),
+        Some(nix::unistd::Uid::from_raw(stat.st_uid)),
+        Some(nix::unistd::Gid::from_raw(stat.st_gid)),
+    )?;
+
+    let (src_fd, dest_fd) = (src.as_raw_fd(), dest.as_raw_fd());
+    let len = unsafe { libc::flistxattr(src_fd, std::ptr::null_mut(), 0) };
+    if len < 0 {
+        let e = std::io::Error::last_os_error();
+        if e.raw_os_error() == Some(libc::ENOTSUP) {
+            return Ok(());
+        }
+        return Err(anyhow::Error::new(e).context("flistxattr"));
+    }
+    let mut names = vec![0u8; len as usize];
+    let len =
+        unsafe { libc::flistxattr(src_fd, names.as_mut_ptr() as *mut libc::c_char, names.len()) };
+    if len < 0 {
+        return Err(anyhow::Error::new(std::io::Error::last_os_error()).context("flistxattr"));
+    }
+    names.truncate(len as usize);
+    for name in names.split(|&c| c == 0).filter(|n| !n.is_empty()) {
+        let name = std::ffi::CString::new(name)?;
+        let len = unsafe { libc::fgetxattr(src_fd, name.as_ptr(), std::ptr::null_mut(), 0) };
+        if len < 0 {
+            return Err(anyhow::Error::new(std::io::Error::last_os_error())
+                .context(format!("fgetxattr({:?})", name)));
+        }
+        let mut value = vec![0u8; len as usize];
+        let len = unsafe {
+            libc::fgetxattr(
+                src_fd,
+                name.as_ptr(),
+                value.as_mut_ptr() as *mut libc::c_void,
+                value.len(),
+            )
+        };
+        if len < 0 {
+            return Err(anyhow::Error::new(std::io::Error::last_os_error())
+                .context(format!("fgetxattr({:?})", name)));
+        }
+        let r = unsafe {
+            libc::fsetxattr(
+                dest_fd,
+                name.as_ptr(),
+                value.as_ptr() as *const libc::c_void,
+                len as usize,
+                0,
+            )
+        };
+        if r < 0 {
+            return Err(anyhow::Error::new(std::io::Error::last_os_error())
+                .context(format!("fsetxattr({:?})", name)));
+        }
+    }
+    Ok(())
+}
+
 /// Recursively hard-link `source_prefix` to `dest_prefix.`
 ///
 /// `relative_path` is updated at each recursive step, so that in case of errors
@@ -925,6 +1005,7 @@ fn hardlink_recurse(
     source_prefix: &str,
     dest_prefix: &str,
     relative_path: &mut String,
+    copy_metadata: bool,
     cancellable: &Option<&gio::Cancellable>,
 ) -> Result<()> {
     use openat::SimpleType;
@@ -957,6 +1038,9 @@ fn hardlink_recurse(
             let perms = rootfs.metadata(&source_path)?.stat().st_mode & !libc::S_IFMT;
             rootfs.ensure_dir(&dest_path, perms)?;
             rootfs.set_mode(&dest_path, perms)?;
+            if copy_metadata {
+                copy_dir_metadata(rootfs, &source_path, &dest_path)?;
+            }
 
             // Recurse into the subdirectory.
             *relative_path = full_path.clone();
@@ -965,6 +1049,7 @@ fn hardlink_recurse(
                 source_prefix,
                 dest_prefix,
                 relative_path,
+                copy_metadata,
                 cancellable,
             )?;
         } else {
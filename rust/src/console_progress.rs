@@ -13,8 +13,15 @@
 
 use indicatif::{ProgressBar, ProgressDrawTarget, ProgressStyle};
 use lazy_static::lazy_static;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
 use std::sync::Mutex;
 use std::sync::MutexGuard;
+use std::thread;
+use std::time::Duration;
+
+/// How often the renderer samples the progress position.
+const RENDER_TICK: Duration = Duration::from_millis(100);
 
 #[derive(PartialEq)]
 enum ProgressType {
@@ -29,13 +36,22 @@ struct ProgressState {
     // In some cases we still want to print things even if stdout
     // isn't a tty; this helps us know that.
     is_hidden: bool,
-    // We have a high level concept of progress bar types.
-    ptype: ProgressType,
     // indicatif doesn't expose an API to retrieve the message used,
     // but we want to print "Frobnicating...done".  So we keep around
     // the original message and use it sometimes.  Also, to add confusion
     // this `message` is really the `prefix` in the format string.
     message: String,
+    // For percent/nitems progress, a thread which periodically
+    // copies `POSITION` into the bar.
+    renderer: Option<Renderer>,
+}
+
+/// Samples `POSITION` at a fixed tick and draws it.  This is what keeps
+/// updates from worker threads off the `PROGRESS` lock and away from
+/// the terminal.
+struct Renderer {
+    stop: Arc<AtomicBool>,
+    thread: thread::JoinHandle<()>,
 }
 
 // We only have one stdout, so we can really only print one progress
@@ -45,6 +61,30 @@ lazy_static! {
     static ref PROGRESS: Mutex<Option<ProgressState>> = Mutex::new(None);
 }
 
+// The position of the current percent/nitems progress.  Updates only
+// store here; the renderer picks it up on its next tick.
+static POSITION: AtomicU64 = AtomicU64::new(0);
+
+impl Renderer {
+    fn spawn(bar: ProgressBar) -> Self {
+        let stop = Arc::new(AtomicBool::new(false));
+        let thread_stop = Arc::clone(&stop);
+        let thread = thread::spawn(move || {
+            while !thread_stop.load(Ordering::Acquire) {
+                bar.set_position(POSITION.load(Ordering::Relaxed));
+                thread::park_timeout(RENDER_TICK);
+            }
+        });
+        Self { stop, thread }
+    }
+
+    fn stop(self) {
+        self.stop.store(true, Ordering::Release);
+        self.thread.thread().unpark();
+        self.thread.join().expect("progress renderer");
+    }
+}
+
 impl ProgressState {
     /// Create a new progress bar.  Should really only be stored
     /// in the PROGRESS static ref.
@@ -77,6 +117,12 @@ impl ProgressState {
             }
         };
         let is_hidden = target.is_hidden();
+        POSITION.store(0, Ordering::Relaxed);
+        let renderer = match ptype {
+            ProgressType::Task => None,
+            _ if is_hidden => None,
+            _ => Some(Renderer::spawn(pb.clone())),
+        };
         if is_hidden {
             print!("{}...", msg);
         } else {
@@ -89,8 +135,8 @@ impl ProgressState {
         Self {
             bar: pb,
             is_hidden,
-            ptype,
             message: msg,
+            renderer,
         }
     }
 
@@ -113,14 +159,11 @@ impl ProgressState {
         }
     }
 
-    /// For a percent or nitems progress, set the progress state.
-    fn update(&self, n: u64) {
-        assert!(!(self.ptype == ProgressType::Task));
-        self.bar.set_position(n);
-    }
-
     /// Clear the progress bar and print a completion message even on non-ttys.
-    fn end<T: AsRef<str>>(&self, suffix: Option<T>) {
+    fn end<T: AsRef<str>>(mut self, suffix: Option<T>) {
+        if let Some(renderer) = self.renderer.take() {
+            renderer.stop();
+        }
         self.bar.finish_and_clear();
         let suffix = suffix.as_ref().map(|s| s.as_ref()).unwrap_or("done");
         if self.is_hidden {
@@ -204,10 +247,11 @@ pub(crate) fn console_progress_set_sub_message(msg: &str) {
     state.set_sub_message(msg);
 }
 
+/// For a percent or nitems progress, set the progress state.  This is
+/// called from worker threads, so it must not take the `PROGRESS` lock
+/// or draw anything itself.
 pub(crate) fn console_progress_update(n: u64) {
-    let lock = PROGRESS.lock().unwrap();
-    let state = lock.as_ref().expect("progress to update");
-    state.update(n);
+    POSITION.store(n, Ordering::Relaxed);
 }
 
 pub(crate) fn console_progress_end(suffix: &str) {
@@ -2,10 +2,67 @@
 
 // SPDX-License-Identifier: Apache-2.0 OR MIT
 
+use crate::chunking;
 use anyhow::{Context, Result};
+use std::io::{BufReader, BufWriter, Write};
+use structopt::StructOpt;
+
+#[derive(Debug, StructOpt)]
+#[structopt(rename_all = "kebab-case")]
+/// Compute a package-aware assignment of files to image layers
+struct ChunkPlanOpts {
+    /// Path to OSTree repository
+    #[structopt(long)]
+    repo: String,
+
+    /// Previously generated plan; its dedicated layers are kept where possible
+    #[structopt(long)]
+    previous: Option<String>,
+
+    /// Maximum number of layers
+    #[structopt(long)]
+    max_layers: Option<u32>,
+
+    /// Commit or ref to plan for
+    rev: String,
+}
+
+/// Print a layer plan for a commit as JSON.  Note the export below doesn't use
+/// the plan (yet); this is for evaluating it, and for external tooling.
+fn chunk_plan(args: &[&str]) -> Result<()> {
+    let opts = ChunkPlanOpts::from_iter(args.iter().skip(2));
+    let repo = ostree::Repo::new_for_path(&opts.repo);
+    repo.open(gio::NONE_CANCELLABLE)?;
+
+    let previous = match opts.previous.as_ref() {
+        Some(path) => {
+            let f = std::fs::File::open(path).with_context(|| format!("Opening {}", path))?;
+            let plan: chunking::LayerPlan = serde_json::from_reader(BufReader::new(f))
+                .with_context(|| format!("Parsing {}", path))?;
+            plan.dedicated_packages()
+        }
+        None => Default::default(),
+    };
+    let max_layers = opts.max_layers.unwrap_or(chunking::DEFAULT_MAX_LAYERS);
+    if max_layers == 0 {
+        anyhow::bail!("--max-layers must be at least 1");
+    }
+    let (components, unpackaged) = chunking::components_for_commit(&repo, &opts.rev)?;
+    let plan = chunking::assign_layers(components, unpackaged, max_layers, &previous);
+
+    let stdout = std::io::stdout();
+    let mut stdout = BufWriter::new(stdout.lock());
+    serde_json::to_writer_pretty(&mut stdout, &plan)?;
+    writeln!(stdout)?;
+    stdout.flush()?;
+    Ok(())
+}
 
 /// Main entrypoint for container
 pub fn entrypoint(args: &[&str]) -> Result<()> {
+    if args.get(2) == Some(&"chunk-plan") {
+        return chunk_plan(args);
+    }
     // Right now we're only exporting the `container` bits, not tar.  So inject that argument.
     // And we also need to skip the main arg and the `ex-container` arg.
     let args = ["rpm-ostree", "container"]
@@ -0,0 +1,396 @@
+//! Concurrent fetching of URLs into temporary files.  This is used
+//! by `rpm-ostree install https://...` and the Koji/Bodhi integration,
+//! where a single argument can expand into dozens of RPM URLs.
+//!
+//! We drive all transfers through a single curl "multi" handle so
+//! that connections (and TLS sessions) to the same host are reused,
+//! and we cap the number of transfers in flight.  Data is streamed
+//! directly into the target tmpfile; if a transfer dies partway
+//! through we resume it with a Range request rather than starting over.
+
+// SPDX-License-Identifier: Apache-2.0 OR MIT
+
+use anyhow::{anyhow, Context, Result};
+use curl::easy::{Easy2, Handler, WriteError};
+use curl::multi::{Easy2Handle, Multi};
+use std::collections::{HashMap, VecDeque};
+use std::fs;
+use std::io;
+use std::io::prelude::*;
+use std::time::Duration;
+
+/// Default number of transfers that run at the same time.
+pub(crate) const DEFAULT_MAX_PARALLEL: usize = 8;
+/// Default number of times we will try to resume an interrupted transfer.
+pub(crate) const DEFAULT_MAX_RETRIES: u32 = 3;
+/// How long we block in a single `curl_multi_wait()` call.
+const WAIT_TIMEOUT: Duration = Duration::from_secs(1);
+
+/// Knobs for `fetch_urls_to_tmpfiles()`.
+#[derive(Debug, Clone)]
+pub(crate) struct FetchOptions {
+    /// Maximum number of concurrent transfers.
+    pub(crate) max_parallel: usize,
+    /// Maximum number of resume attempts per URL.
+    pub(crate) max_retries: u32,
+    /// Print a line to stdout as each URL completes.
+    pub(crate) progress: bool,
+}
+
+impl Default for FetchOptions {
+    fn default() -> Self {
+        Self {
+            max_parallel: DEFAULT_MAX_PARALLEL,
+            max_retries: DEFAULT_MAX_RETRIES,
+            progress: false,
+        }
+    }
+}
+
+/// State for a single transfer; this is the curl `Handler` which
+/// writes received data into the tmpfile.
+struct Collector {
+    out: Option<io::BufWriter<fs::File>>,
+    /// Number of bytes of the body written so far.
+    written: u64,
+    /// Offset we asked the server to resume from, if this is a retry.
+    resume_offset: u64,
+    /// HTTP status of the last response seen; redirects produce several.
+    last_status: u32,
+    /// Whether we have seen body data for the current attempt.
+    got_body: bool,
+    /// A local I/O error; curl only sees a short write.
+    error: Option<io::Error>,
+}
+
+impl Collector {
+    fn new() -> Result<Self> {
+        Ok(Self {
+            out: Some(io::BufWriter::new(tempfile::tempfile()?)),
+            written: 0,
+            resume_offset: 0,
+            last_status: 0,
+            got_body: false,
+            error: None,
+        })
+    }
+
+    fn out(&mut self) -> &mut io::BufWriter<fs::File> {
+        self.out.as_mut().expect("collector output")
+    }
+
+    fn write_body(&mut self, data: &[u8]) -> io::Result<()> {
+        if !self.got_body {
+            self.got_body = true;
+            // The server ignored our Range request and is sending the
+            // whole body again; throw away what we have and start over.
+            if self.resume_offset > 0 && self.last_status != 206 {
+                let out = self.out();
+                out.seek(io::SeekFrom::Start(0))?;
+                out.get_ref().set_len(0)?;
+                self.written = 0;
+            }
+        }
+        self.out().write_all(data)?;
+        self.written += data.len() as u64;
+        Ok(())
+    }
+
+    /// Flush buffered data and return the offset to resume from.
+    fn prepare_resume(&mut self) -> Result<u64> {
+        self.out().flush()?;
+        self.resume_offset = self.written;
+        self.last_status = 0;
+        self.got_body = false;
+        Ok(self.written)
+    }
+
+    /// Flush buffered data and return the file, positioned at the start.
+    fn finish(&mut self) -> Result<fs::File> {
+        let out = self.out.take().expect("collector output");
+        let mut f = out.into_inner()?;
+        f.seek(io::SeekFrom::Start(0))?;
+        Ok(f)
+    }
+}
+
+impl Handler for Collector {
+    fn write(&mut self, data: &[u8]) -> std::result::Result<usize, WriteError> {
+        match self.write_body(data) {
+            Ok(()) => Ok(data.len()),
+            Err(e) => {
+                self.error = Some(e);
+                // A short write makes curl abort the transfer.
+                Ok(0)
+            }
+        }
+    }
+
+    fn header(&mut self, data: &[u8]) -> bool {
+        if let Some(status) = parse_status_line(data) {
+            self.last_status = status;
+        }
+        true
+    }
+}
+
+/// Parse the status code out of an HTTP status line, e.g. `HTTP/1.1 206 Partial Content`.
+fn parse_status_line(line: &[u8]) -> Option<u32> {
+    let line = std::str::from_utf8(line).ok()?;
+    if !line.starts_with("HTTP/") {
+        return None;
+    }
+    line.split_whitespace().nth(1)?.parse().ok()
+}
+
+/// Errors where it's worth trying to pick the transfer back up.
+fn is_resumable(e: &curl::Error) -> bool {
+    e.is_partial_file()
+        || e.is_recv_error()
+        || e.is_send_error()
+        || e.is_got_nothing()
+        || e.is_operation_timedout()
+        || e.is_couldnt_connect()
+}
+
+fn new_transfer(url: &str) -> Result<Easy2<Collector>> {
+    let mut easy = Easy2::new(Collector::new()?);
+    easy.url(url)?;
+    easy.follow_location(true)?;
+    easy.fail_on_error(true)?;
+    Ok(easy)
+}
+
+/// Given multiple URLs, download them concurrently into O_TMPFILE-style
+/// temporary files.  The returned files are in the same order as `urls`,
+/// and positioned at the start.
+pub(crate) fn fetch_urls_to_tmpfiles<S: AsRef<str>>(
+    urls: &[S],
+    opts: &FetchOptions,
+) -> Result<Vec<fs::File>> {
+    let n = urls.len();
+    let max_parallel = opts.max_parallel.max(1);
+    let multi = Multi::new();
+    multi.set_max_host_connections(max_parallel)?;
+    // Let curl multiplex over HTTP/2 where the server supports it.
+    multi.pipelining(false, true)?;
+
+    let mut results: Vec<Option<fs::File>> = (0..n).map(|_| None).collect();
+    let mut attempts = vec![0u32; n];
+    let mut active: HashMap<usize, Easy2Handle<Collector>> = HashMap::new();
+    let mut retries: VecDeque<(usize, Easy2<Collector>)> = VecDeque::new();
+    let mut next = 0;
+
+    loop {
+        while active.len() < max_parallel {
+            let (idx, easy) = if let Some(r) = retries.pop_front() {
+                r
+            } else if next < n {
+                next += 1;
+                (next - 1, new_transfer(urls[next - 1].as_ref())?)
+            } else {
+                break;
+            };
+            let mut handle = multi.add2(easy)?;
+            handle.set_token(idx)?;
+            active.insert(idx, handle);
+        }
+        if active.is_empty() {
+            break;
+        }
+
+        multi.perform()?;
+        let mut finished = Vec::new();
+        multi.messages(|msg| {
+            if let Ok(idx) = msg.token() {
+                if let Some(r) = active.get(&idx).and_then(|h| msg.result_for2(h)) {
+                    finished.push((idx, r));
+                }
+            }
+        });
+
+        for (idx, r) in finished {
+            let url = urls[idx].as_ref();
+            let handle = active.remove(&idx).expect("active transfer");
+            let mut easy = multi.remove2(handle)?;
+            if let Some(e) = easy.get_mut().error.take() {
+                return Err(e).with_context(|| format!("Writing {}", url));
+            }
+            match r {
+                Ok(()) => {
+                    let f = easy.get_mut().finish()?;
+                    if opts.progress {
+                        println!("Downloaded {}", url);
+                    }
+                    results[idx] = Some(f);
+                }
+                Err(e) if is_resumable(&e) && attempts[idx] < opts.max_retries => {
+                    attempts[idx] += 1;
+                    let offset = easy.get_mut().prepare_resume()?;
+                    easy.resume_from(offset)?;
+                    retries.push_back((idx, easy));
+                }
+                Err(e) => {
+                    if opts.progress {
+                        println!("Failed to download {}", url);
+                    }
+                    return Err(anyhow!(e)).with_context(|| format!("Failed to download {}", url));
+                }
+            }
+        }
+
+        if !active.is_empty() {
+            multi.wait(&mut [], WAIT_TIMEOUT)?;
+        }
+    }
+
+    // Unwrap safety: the loop above only exits once every transfer has completed.
+    Ok(results
+        .into_iter()
+        .map(|f| f.expect("downloaded file"))
+        .collect())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::net::{TcpListener, TcpStream};
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::sync::Arc;
+
+    /// Body of `/file-<n>`.
+    fn body_for(n: usize) -> Vec<u8> {
+        format!("content of file {}\n", n).repeat(1000).into_bytes()
+    }
+
+    fn parse_range(line: &str) -> Option<usize> {
+        let v = line.strip_prefix("Range: bytes=")?;
+        v.trim().trim_end_matches('-').parse().ok()
+    }
+
+    /// A minimal HTTP/1.1 stand-in.  `/file-<n>` serves `body_for(n)`,
+    /// `/flaky-<n>` truncates the first response to exercise resuming,
+    /// and everything else is a 404.
+    fn handle_conn(stream: TcpStream, flaky_hits: Arc<AtomicUsize>) -> Result<()> {
+        let mut reader = io::BufReader::new(stream.try_clone()?);
+        let mut stream = stream;
+        let mut request = String::new();
+        reader.read_line(&mut request)?;
+        let mut range = None;
+        loop {
+            let mut line = String::new();
+            reader.read_line(&mut line)?;
+            if line.trim().is_empty() {
+                break;
+            }
+            range = range.or_else(|| parse_range(&line));
+        }
+        let path = request.split_whitespace().nth(1).unwrap_or("");
+        let (flaky, n) = if let Some(n) = path.strip_prefix("/file-") {
+            (false, n.parse::<usize>().ok())
+        } else if let Some(n) = path.strip_prefix("/flaky-") {
+            (true, n.parse::<usize>().ok())
+        } else {
+            (false, None)
+        };
+        let n = match n {
+            Some(n) => n,
+            None => {
+                write!(
+                    stream,
+                    "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+                )?;
+                return Ok(());
+            }
+        };
+        let body = body_for(n);
+        let start = range.unwrap_or(0);
+        if start > 0 {
+            write!(
+                stream,
+                "HTTP/1.1 206 Partial Content\r\nContent-Length: {}\r\nContent-Range: bytes {}-{}/{}\r\nConnection: close\r\n\r\n",
+                body.len() - start,
+                start,
+                body.len() - 1,
+                body.len()
+            )?;
+        } else {
+            write!(
+                stream,
+                "HTTP/1.1 200 OK\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",
+                body.len()
+            )?;
+        }
+        let body = &body[start..];
+        if flaky && flaky_hits.fetch_add(1, Ordering::SeqCst) == 0 {
+            // Advertise the full length, then hang up halfway through.
+            stream.write_all(&body[..body.len() / 2])?;
+            return Ok(());
+        }
+        stream.write_all(body)?;
+        Ok(())
+    }
+
+    fn serve() -> Result<String> {
+        let listener = TcpListener::bind("127.0.0.1:0")?;
+        let addr = listener.local_addr()?;
+        let flaky_hits = Arc::new(AtomicUsize::new(0));
+        std::thread::spawn(move || {
+            for stream in listener.incoming() {
+                let stream = stream.expect("accept");
+                let flaky_hits = Arc::clone(&flaky_hits);
+                std::thread::spawn(move || handle_conn(stream, flaky_hits));
+            }
+        });
+        Ok(format!("http://{}", addr))
+    }
+
+    fn read_all(mut f: &fs::File) -> Result<Vec<u8>> {
+        let mut buf = Vec::new();
+        f.read_to_end(&mut buf)?;
+        Ok(buf)
+    }
+
+    #[test]
+    fn test_parse_status_line() {
+        assert_eq!(
+            parse_status_line(b"HTTP/1.1 206 Partial Content\r\n"),
+            Some(206)
+        );
+        assert_eq!(parse_status_line(b"HTTP/2 200\r\n"), Some(200));
+        assert_eq!(parse_status_line(b"Content-Length: 5\r\n"), None);
+    }
+
+    #[test]
+    fn test_fetch_many() -> Result<()> {
+        let base = serve()?;
+        let urls: Vec<String> = (0..20).map(|i| format!("{}/file-{}", base, i)).collect();
+        let opts = FetchOptions {
+            max_parallel: 4,
+            ..Default::default()
+        };
+        let files = fetch_urls_to_tmpfiles(&urls, &opts)?;
+        assert_eq!(files.len(), urls.len());
+        for (i, f) in files.iter().enumerate() {
+            assert_eq!(read_all(f)?, body_for(i));
+        }
+        Ok(())
+    }
+
+    #[test]
+    fn test_fetch_resume() -> Result<()> {
+        let base = serve()?;
+        let urls = vec![format!("{}/flaky-3", base)];
+        let files = fetch_urls_to_tmpfiles(&urls, &Default::default())?;
+        assert_eq!(read_all(&files[0])?, body_for(3));
+        Ok(())
+    }
+
+    #[test]
+    fn test_fetch_error() -> Result<()> {
+        let base = serve()?;
+        let urls = vec![format!("{}/file-1", base), format!("{}/missing", base)];
+        assert!(fetch_urls_to_tmpfiles(&urls, &Default::default()).is_err());
+        Ok(())
+    }
+}
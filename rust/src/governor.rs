@@ -0,0 +1,297 @@
+//! Resource governor for background transactions.
+//!
+//! Nobody is waiting on transactions started by automatic updates,
+//! `cleanup` or `refresh-md`, so if limits are configured we run them
+//! under cgroup v2 weights and limits.  This relies on `Delegate=` being
+//! set on our unit: our cgroup is split into a `daemon` leaf for normal
+//! operation and a `background` leaf carrying the limits, and the daemon
+//! moves between the two for the duration of a background transaction.
+//! Since only one transaction runs at a time, moving the whole process is
+//! simpler than threaded cgroups, and also works for the io and memory
+//! controllers, which don't support threaded mode.
+//!
+//! Parallel phases should size their worker pools with
+//! [`governor_parallelism`] rather than the raw number of CPUs.
+
+// SPDX-License-Identifier: Apache-2.0 OR MIT
+
+use crate::cxxrsutil::*;
+use crate::ffi::GovernorLimits;
+use anyhow::{anyhow, Context, Result};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Mutex;
+
+const CGROUP_MOUNT: &str = "/sys/fs/cgroup";
+const DAEMON_LEAF: &str = "daemon";
+const BACKGROUND_LEAF: &str = "background";
+/// The period we use for `cpu.max`, in microseconds; same as systemd.
+const CPU_PERIOD_USEC: u64 = 100_000;
+
+lazy_static::lazy_static! {
+    /// Our cgroup, once split into leaves.
+    static ref DELEGATED: Mutex<Option<PathBuf>> = Mutex::new(None);
+}
+
+/// Worker threads granted to the current transaction; zero if not limited.
+static GRANTED_PARALLELISM: AtomicU32 = AtomicU32::new(0);
+
+impl GovernorLimits {
+    fn is_set(&self) -> bool {
+        self.cpu_weight > 0 || self.io_weight > 0 || self.memory_high > 0 || self.cpu_quota > 0
+    }
+}
+
+/// Extract the cgroup v2 path from the contents of `/proc/self/cgroup`,
+/// minus any of our own leaves.
+fn parse_unified_cgroup(buf: &str) -> Option<&str> {
+    let path = buf.lines().find_map(|l| l.strip_prefix("0::"))?;
+    let parent = path
+        .strip_suffix(DAEMON_LEAF)
+        .or_else(|| path.strip_suffix(BACKGROUND_LEAF))
+        .and_then(|p| p.strip_suffix('/'));
+    Some(parent.unwrap_or(path))
+}
+
+/// The controllers we want enabled for our leaves, in `cgroup.subtree_control` syntax.
+fn subtree_control(available: &str) -> String {
+    available
+        .split_whitespace()
+        .filter(|c| matches!(*c, "cpu" | "io" | "memory"))
+        .map(|c| format!("+{}", c))
+        .collect::<Vec<_>>()
+        .join(" ")
+}
+
+fn cpu_max(quota_percent: u64) -> String {
+    if quota_percent == 0 {
+        format!("max {}", CPU_PERIOD_USEC)
+    } else {
+        format!(
+            "{} {}",
+            quota_percent * CPU_PERIOD_USEC / 100,
+            CPU_PERIOD_USEC
+        )
+    }
+}
+
+/// A quota of e.g. 150% is worth two workers; never more than we have CPUs.
+fn parallelism_for_quota(quota_percent: u64, ncpus: u32) -> u32 {
+    let ncpus = ncpus.max(1);
+    if quota_percent == 0 {
+        return ncpus;
+    }
+    let granted = (quota_percent + 99) / 100;
+    granted.min(ncpus as u64) as u32
+}
+
+/// The number of CPUs we may run on; unlike the number online, this respects
+/// our affinity mask (e.g. from `taskset` or systemd's `CPUAffinity=`).
+fn ncpus() -> u32 {
+    let mut set: libc::cpu_set_t = unsafe { std::mem::zeroed() };
+    let r = unsafe { libc::sched_getaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &mut set) };
+    let n = if r == 0 {
+        unsafe { libc::CPU_COUNT(&set) as libc::c_long }
+    } else {
+        unsafe { libc::sysconf(libc::_SC_NPROCESSORS_ONLN) }
+    };
+    n.max(1) as u32
+}
+
+fn write_cgroup_file(dir: &Path, name: &str, val: &str) -> Result<()> {
+    let path = dir.join(name);
+    std::fs::write(&path, val).with_context(|| format!("Writing {}", path.display()))
+}
+
+fn move_self(leaf: &Path) -> Result<()> {
+    write_cgroup_file(leaf, "cgroup.procs", &std::process::id().to_string())
+}
+
+/// Split our cgroup into leaves if not done already, and return its path.
+fn delegated_cgroup() -> Result<PathBuf> {
+    let mut delegated = DELEGATED.lock().unwrap();
+    if let Some(base) = delegated.as_ref() {
+        return Ok(base.clone());
+    }
+    let buf = std::fs::read_to_string("/proc/self/cgroup")?;
+    let path = parse_unified_cgroup(&buf).ok_or_else(|| anyhow!("cgroup v2 is not in use"))?;
+    let base = Path::new(CGROUP_MOUNT).join(path.trim_start_matches('/'));
+    for leaf in &[DAEMON_LEAF, BACKGROUND_LEAF] {
+        match std::fs::create_dir(base.join(leaf)) {
+            Ok(_) => {}
+            Err(e) if e.kind() == std::io::ErrorKind::AlreadyExists => {}
+            Err(e) => {
+                return Err(e).with_context(|| {
+                    format!("Creating cgroup in {} (is Delegate= set?)", base.display())
+                })
+            }
+        }
+    }
+    // Controllers can only be enabled for children once we're out of the way.
+    move_self(&base.join(DAEMON_LEAF))?;
+    let available = std::fs::read_to_string(base.join("cgroup.controllers"))?;
+    let control = subtree_control(&available);
+    if !control.is_empty() {
+        write_cgroup_file(&base, "cgroup.subtree_control", &control)?;
+    }
+    *delegated = Some(base.clone());
+    Ok(base)
+}
+
+/// Write all limits, resetting unset ones to their defaults in case they were
+/// set by a previous configuration.  Files of controllers which aren't
+/// available are skipped, unless we actually need them.
+fn apply_limits(leaf: &Path, limits: &GovernorLimits) -> Result<()> {
+    let or_default = |v: u64, dfault: &str| {
+        if v > 0 {
+            v.to_string()
+        } else {
+            dfault.to_string()
+        }
+    };
+    let settings = [
+        (
+            "cpu.weight",
+            limits.cpu_weight > 0,
+            or_default(limits.cpu_weight, "100"),
+        ),
+        (
+            "io.weight",
+            limits.io_weight > 0,
+            format!("default {}", or_default(limits.io_weight, "100")),
+        ),
+        (
+            "memory.high",
+            limits.memory_high > 0,
+            or_default(limits.memory_high, "max"),
+        ),
+        ("cpu.max", limits.cpu_quota > 0, cpu_max(limits.cpu_quota)),
+    ];
+    for (name, set, val) in settings.iter() {
+        if !set && !leaf.join(name).exists() {
+            continue;
+        }
+        write_cgroup_file(leaf, name, val)?;
+    }
+    Ok(())
+}
+
+/// Move the daemon under the background limits, if any are set.  Returns
+/// whether we did; if so, [`governor_leave`] must be called afterwards.
+pub(crate) fn governor_enter(limits: &GovernorLimits) -> CxxResult<bool> {
+    if !limits.is_set() {
+        return Ok(false);
+    }
+    let base = delegated_cgroup()?;
+    let leaf = base.join(BACKGROUND_LEAF);
+    apply_limits(&leaf, limits)?;
+    move_self(&leaf)?;
+    GRANTED_PARALLELISM.store(
+        parallelism_for_quota(limits.cpu_quota, ncpus()),
+        Ordering::SeqCst,
+    );
+    Ok(true)
+}
+
+/// Move the daemon back out from under the background limits.
+pub(crate) fn governor_leave() -> CxxResult<()> {
+    GRANTED_PARALLELISM.store(0, Ordering::SeqCst);
+    let base = DELEGATED.lock().unwrap().clone();
+    if let Some(base) = base {
+        move_self(&base.join(DAEMON_LEAF))?;
+    }
+    Ok(())
+}
+
+/// The number of workers parallel phases should use.
+pub(crate) fn governor_parallelism() -> u32 {
+    match GRANTED_PARALLELISM.load(Ordering::SeqCst) {
+        0 => ncpus(),
+        n => n,
+    }
+}
+
+/// Run `f`, with rayon parallelism restricted to what we've been granted.
+pub(crate) fn governor_install<R: Send>(f: impl FnOnce() -> R + Send) -> Result<R> {
+    match GRANTED_PARALLELISM.load(Ordering::SeqCst) {
+        0 => Ok(f()),
+        n => {
+            let pool = rayon::ThreadPoolBuilder::new()
+                .num_threads(n as usize)
+                .build()?;
+            Ok(pool.install(f))
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_unified_cgroup() {
+        let buf = "0::/system.slice/rpm-ostreed.service\n";
+        assert_eq!(
+            parse_unified_cgroup(buf),
+            Some("/system.slice/rpm-ostreed.service")
+        );
+        let buf = "0::/system.slice/rpm-ostreed.service/background\n";
+        assert_eq!(
+            parse_unified_cgroup(buf),
+            Some("/system.slice/rpm-ostreed.service")
+        );
+        // hybrid hierarchy
+        let buf = "12:cpu,cpuacct:/system.slice\n0::/system.slice/rpm-ostreed.service/daemon\n";
+        assert_eq!(
+            parse_unified_cgroup(buf),
+            Some("/system.slice/rpm-ostreed.service")
+        );
+        assert_eq!(parse_unified_cgroup("1:name=systemd:/foo\n"), None);
+    }
+
+    #[test]
+    fn test_subtree_control() {
+        assert_eq!(
+            subtree_control("cpuset cpu io memory hugetlb pids rdma\n"),
+            "+cpu +io +memory"
+        );
+        assert_eq!(subtree_control("pids"), "");
+    }
+
+    #[test]
+    fn test_quota() {
+        assert_eq!(cpu_max(0), "max 100000");
+        assert_eq!(cpu_max(50), "50000 100000");
+        assert_eq!(cpu_max(250), "250000 100000");
+        assert_eq!(parallelism_for_quota(0, 8), 8);
+        assert_eq!(parallelism_for_quota(50, 8), 1);
+        assert_eq!(parallelism_for_quota(150, 8), 2);
+        assert_eq!(parallelism_for_quota(2000, 8), 8);
+        assert_eq!(parallelism_for_quota(100, 0), 1);
+    }
+
+    #[test]
+    fn test_apply_limits() -> Result<()> {
+        let td = tempfile::tempdir()?;
+        let leaf = td.path();
+        let mut limits = GovernorLimits {
+            cpu_weight: 20,
+            io_weight: 10,
+            memory_high: 0,
+            cpu_quota: 0,
+        };
+        apply_limits(leaf, &limits)?;
+        let read = |n: &str| std::fs::read_to_string(leaf.join(n)).unwrap();
+        assert_eq!(read("cpu.weight"), "20");
+        assert_eq!(read("io.weight"), "default 10");
+        // not set and not available
+        assert!(!leaf.join("memory.high").exists());
+        assert!(!leaf.join("cpu.max").exists());
+        limits.cpu_weight = 0;
+        limits.cpu_quota = 50;
+        apply_limits(leaf, &limits)?;
+        assert_eq!(read("cpu.weight"), "100");
+        assert_eq!(read("cpu.max"), "50000 100000");
+        Ok(())
+    }
+}
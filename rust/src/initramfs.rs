@@ -4,25 +4,39 @@
 use crate::cxxrsutil::*;
 use anyhow::{Context, Result};
 use camino::Utf8Path;
+use flate2::write::GzEncoder;
 use gio::prelude::*;
 use openat::SimpleType;
-use std::collections::BTreeSet;
+use openat_ext::OpenatDirExt;
+use rayon::prelude::*;
+use serde_derive::{Deserialize, Serialize};
+use std::collections::BTreeMap;
 use std::collections::HashSet;
 use std::convert::TryInto;
 use std::fs;
 use std::io;
 use std::io::prelude::*;
-use std::os::unix::io::AsRawFd;
+use std::os::unix::ffi::OsStrExt;
 use std::os::unix::io::IntoRawFd;
 use std::path::Path;
 use std::pin::Pin;
-use std::rc;
-use subprocess::Exec;
+
+/// Where we keep the last generated overlay, along with the key it was generated from.
+const OVERLAY_CACHE_DIR: &str = "var/cache/rpm-ostree/initramfs-etc";
+const OVERLAY_CACHE_ARCHIVE: &str = "overlay.cpio.gz";
+const OVERLAY_CACHE_KEY: &str = "overlay.json";
+/// Bump this if the archive format changes in a way that should invalidate the cache.
+const OVERLAY_CACHE_VERSION: u32 = 2;
+/// Approximate amount of uncompressed data per independently compressed archive.
+const OVERLAY_CHUNK_SIZE: u64 = 4 * 1024 * 1024;
+
+/// Maps paths (relative to `/etc`) to their `lstat()` results.
+type FileList = BTreeMap<String, libc::stat>;
 
 fn list_files_recurse<P: glib::IsA<gio::Cancellable>>(
     d: &openat::Dir,
     path: &str,
-    filelist: &mut BTreeSet<String>,
+    filelist: &mut FileList,
     cancellable: Option<&P>,
 ) -> Result<()> {
     // Maybe add a glib feature for openat-ext to support cancellability?  Or
@@ -43,7 +57,7 @@ fn list_files_recurse<P: glib::IsA<gio::Cancellable>>(
         }
         _ => anyhow::bail!("Invalid non-regfile/symlink/directory: {}", path),
     }
-    filelist.insert(path.to_string());
+    filelist.insert(path.to_string(), *meta.stat());
     Ok(())
 }
 
@@ -51,8 +65,8 @@ fn gather_filelist<P: glib::IsA<gio::Cancellable>>(
     d: &openat::Dir,
     input: &HashSet<String>,
     cancellable: Option<&P>,
-) -> Result<BTreeSet<String>> {
-    let mut filelist: BTreeSet<String> = BTreeSet::new();
+) -> Result<FileList> {
+    let mut filelist = FileList::new();
     for file in input {
         let file = match file.strip_prefix("/etc/") {
             Some(f) => f,
@@ -64,53 +78,233 @@ fn gather_filelist<P: glib::IsA<gio::Cancellable>>(
     Ok(filelist)
 }
 
+/// A minimal writer for the "newc" cpio format, which is what the kernel
+/// accepts for initramfs images.  Like `cpio --reproducible`, inodes are
+/// renumbered sequentially and device numbers are zeroed.
+struct NewcWriter<W: Write> {
+    out: W,
+    offset: u64,
+    next_ino: u32,
+}
+
+impl<W: Write> NewcWriter<W> {
+    fn new(out: W) -> Self {
+        Self {
+            out,
+            offset: 0,
+            next_ino: 1,
+        }
+    }
+
+    fn write_raw(&mut self, buf: &[u8]) -> Result<()> {
+        self.out.write_all(buf)?;
+        self.offset += buf.len() as u64;
+        Ok(())
+    }
+
+    /// Entries and file data are aligned to 4 bytes.
+    fn pad(&mut self) -> Result<()> {
+        let n = ((4 - (self.offset % 4)) % 4) as usize;
+        self.write_raw(&[0u8; 4][..n])
+    }
+
+    fn write_header(&mut self, name: &str, st: &libc::stat, filesize: u64) -> Result<()> {
+        let filesize: u32 = filesize
+            .try_into()
+            .with_context(|| format!("{} is too large for cpio", name))?;
+        let ino = self.next_ino;
+        self.next_ino += 1;
+        let nlink = if (st.st_mode & libc::S_IFMT) == libc::S_IFDIR {
+            2
+        } else {
+            1
+        };
+        let fields: [u32; 13] = [
+            ino,
+            st.st_mode,
+            st.st_uid,
+            st.st_gid,
+            nlink,
+            st.st_mtime as u32,
+            filesize,
+            0,
+            0,
+            0,
+            0,
+            (name.len() + 1) as u32,
+            0,
+        ];
+        let mut hdr = String::with_capacity(110);
+        hdr.push_str("070701");
+        for v in fields.iter() {
+            hdr.push_str(&format!("{:08X}", v));
+        }
+        self.write_raw(hdr.as_bytes())?;
+        self.write_raw(name.as_bytes())?;
+        self.write_raw(&[0u8])?;
+        self.pad()
+    }
+
+    /// Append an entry; `data` is the file content or the symlink target.
+    fn append(&mut self, name: &str, st: &libc::stat, data: &[u8]) -> Result<()> {
+        self.write_header(name, st, data.len() as u64)?;
+        self.write_raw(data)?;
+        self.pad()
+    }
+
+    /// Append a regular file, streaming its content from `src`.
+    fn append_file(&mut self, name: &str, st: &libc::stat, src: &mut fs::File) -> Result<()> {
+        let size = st.st_size as u64;
+        self.write_header(name, st, size)?;
+        let n = io::copy(&mut src.take(size), &mut self.out)?;
+        if n != size {
+            anyhow::bail!("{} changed size while archiving", name);
+        }
+        self.offset += n;
+        self.pad()
+    }
+
+    fn finish(mut self) -> Result<W> {
+        let st: libc::stat = unsafe { std::mem::zeroed() };
+        self.append("TRAILER!!!", &st, &[])?;
+        Ok(self.out)
+    }
+}
+
+/// Generate a gzip-compressed newc archive holding `entries`, with paths
+/// prefixed by `etc/`.
+fn write_overlay_chunk(etcd: &openat::Dir, entries: &[(&String, &libc::stat)]) -> Result<Vec<u8>> {
+    let enc = GzEncoder::new(Vec::new(), flate2::Compression::fast());
+    let mut w = NewcWriter::new(enc);
+    for &(path, st) in entries {
+        let name = format!("etc/{}", path);
+        match st.st_mode & libc::S_IFMT {
+            libc::S_IFDIR => w.append(&name, st, &[])?,
+            libc::S_IFLNK => {
+                let target = etcd.read_link(path.as_str())?;
+                w.append(&name, st, target.as_os_str().as_bytes())?
+            }
+            _ => {
+                let mut f = etcd.open_file(path.as_str())?;
+                w.append_file(&name, st, &mut f)?
+            }
+        }
+    }
+    Ok(w.finish()?.finish()?)
+}
+
+/// Write the overlay for `filelist` to `out`.  The entries are split into
+/// chunks which are each archived and compressed on a separate thread; the kernel
+/// (and dracut) accept a concatenation of compressed cpio archives.
+fn write_overlay<W: Write>(etcd: &openat::Dir, filelist: &FileList, out: &mut W) -> Result<()> {
+    let mut chunks: Vec<Vec<(&String, &libc::stat)>> = vec![Vec::new()];
+    let mut chunk_size = 0u64;
+    for (path, st) in filelist.iter() {
+        if chunk_size >= OVERLAY_CHUNK_SIZE {
+            chunks.push(Vec::new());
+            chunk_size = 0;
+        }
+        chunk_size += st.st_size as u64;
+        chunks.last_mut().expect("chunk").push((path, st));
+    }
+    let compressed = crate::governor::governor_install(|| {
+        chunks
+            .par_iter()
+            .map(|entries| write_overlay_chunk(etcd, entries))
+            .collect::<Result<Vec<_>>>()
+    })??;
+    for buf in compressed {
+        out.write_all(&buf)?;
+    }
+    Ok(())
+}
+
+/// One entry of the cache key; if any of these change we regenerate the overlay.
+#[derive(Serialize, Deserialize, PartialEq, Debug)]
+struct OverlayCacheEntry {
+    path: String,
+    size: u64,
+    mtime: i64,
+    mtime_nsec: i64,
+    // Catches in-place rewrites which preserve size and mtime
+    ctime: i64,
+    ctime_nsec: i64,
+    dev: u64,
+    ino: u64,
+    mode: u32,
+    uid: u32,
+    gid: u32,
+}
+
+#[derive(Serialize, Deserialize, PartialEq, Debug)]
+struct OverlayCacheKey {
+    version: u32,
+    entries: Vec<OverlayCacheEntry>,
+}
+
+impl OverlayCacheKey {
+    fn new(filelist: &FileList) -> Self {
+        let entries = filelist
+            .iter()
+            .map(|(path, st)| OverlayCacheEntry {
+                path: path.clone(),
+                size: st.st_size as u64,
+                mtime: st.st_mtime as i64,
+                mtime_nsec: st.st_mtime_nsec as i64,
+                ctime: st.st_ctime as i64,
+                ctime_nsec: st.st_ctime_nsec as i64,
+                dev: st.st_dev as u64,
+                ino: st.st_ino as u64,
+                mode: st.st_mode,
+                uid: st.st_uid,
+                gid: st.st_gid,
+            })
+            .collect();
+        Self {
+            version: OVERLAY_CACHE_VERSION,
+            entries,
+        }
+    }
+
+    /// Returns the cached archive if it was generated from the same key.
+    fn lookup(&self, cachedir: &openat::Dir) -> Result<Option<fs::File>> {
+        let prev: OverlayCacheKey = match cachedir.open_file_optional(OVERLAY_CACHE_KEY)? {
+            Some(f) => match serde_json::from_reader(io::BufReader::new(f)) {
+                Ok(k) => k,
+                // Treat a corrupted key like a cache miss.
+                Err(_) => return Ok(None),
+            },
+            None => return Ok(None),
+        };
+        if &prev != self {
+            return Ok(None);
+        }
+        Ok(cachedir.open_file_optional(OVERLAY_CACHE_ARCHIVE)?)
+    }
+}
+
 fn generate_initramfs_overlay<P: glib::IsA<gio::Cancellable>>(
     root: &openat::Dir,
     files: &HashSet<String>,
+    cachedir: &openat::Dir,
     cancellable: Option<&P>,
 ) -> Result<fs::File> {
-    let filelist = {
-        let etcd = root.sub_dir("etc")?;
-        gather_filelist(&etcd, files, cancellable)?
-    };
-    let out_tmpf = std::rc::Rc::new(tempfile::tempfile()?);
-    {
-        let cmd = Exec::cmd("cpio")
-            .args(&[
-                "--create",
-                "--format",
-                "newc",
-                "--quiet",
-                "--reproducible",
-                "--null",
-            ])
-            .cwd(format!("/proc/self/fd/{}", root.as_raw_fd()))
-            | Exec::cmd("gzip").arg("-1");
-        let mut children = cmd
-            .stdin(subprocess::Redirection::Pipe)
-            .stdout(subprocess::Redirection::RcFile(out_tmpf.clone()))
-            .popen()
-            .context("spawn")?;
-        {
-            let mut cstdin = std::io::BufWriter::new(children[0].stdin.take().expect("stdin"));
-            for f in filelist {
-                cstdin.write_all(b"etc/")?;
-                cstdin.write_all(f.as_bytes())?;
-                let nul = [0u8];
-                cstdin.write_all(&nul)?;
-            }
-            cstdin.flush()?;
-        }
-        for mut child in children {
-            let status = child.wait()?;
-            if !status.success() {
-                anyhow::bail!("Failed to generate cpio archive");
-            }
-        }
+    let etcd = root.sub_dir("etc")?;
+    let filelist = gather_filelist(&etcd, files, cancellable)?;
+    let key = OverlayCacheKey::new(&filelist);
+    if let Some(f) = key.lookup(cachedir)? {
+        return Ok(f);
     }
-    let mut out_tmpf = rc::Rc::try_unwrap(out_tmpf).expect("initramfs rc unexpected count");
-    out_tmpf.seek(io::SeekFrom::Start(0)).context("seek")?;
-    Ok(out_tmpf)
+    // Drop the key first, so that a crash below can't leave a stale
+    // key pointing at a new archive.
+    cachedir.remove_file_optional(OVERLAY_CACHE_KEY)?;
+    cachedir.write_file_with(OVERLAY_CACHE_ARCHIVE, 0o600, |w| -> Result<()> {
+        write_overlay(&etcd, &filelist, w)
+    })?;
+    cachedir.write_file_with(OVERLAY_CACHE_KEY, 0o600, |w| -> Result<()> {
+        Ok(serde_json::to_writer(w, &key)?)
+    })?;
+    Ok(cachedir.open_file(OVERLAY_CACHE_ARCHIVE)?)
 }
 
 fn generate_initramfs_overlay_etc<P: glib::IsA<gio::Cancellable>>(
@@ -118,7 +312,9 @@ fn generate_initramfs_overlay_etc<P: glib::IsA<gio::Cancellable>>(
     cancellable: Option<&P>,
 ) -> Result<fs::File> {
     let root = openat::Dir::open("/")?;
-    generate_initramfs_overlay(&root, files, cancellable)
+    root.ensure_dir_all(OVERLAY_CACHE_DIR, 0o700)?;
+    let cachedir = root.sub_dir(OVERLAY_CACHE_DIR)?;
+    generate_initramfs_overlay(&root, files, &cachedir, cancellable)
 }
 
 pub(crate) fn get_dracut_random_cpio() -> &'static [u8] {
@@ -141,23 +337,134 @@ pub(crate) fn initramfs_overlay_generate(
 mod test {
     use super::*;
     use openat_ext::FileExt;
+    use std::os::unix::fs::MetadataExt;
+
+    /// Parse a (possibly multi-member) gzip'd newc stream into (name, data) pairs.
+    fn parse_overlay(f: fs::File) -> Result<Vec<(String, Vec<u8>)>> {
+        let mut buf = Vec::new();
+        flate2::read::MultiGzDecoder::new(f).read_to_end(&mut buf)?;
+        let mut r = Vec::new();
+        let mut off = 0;
+        let align = |n: usize| (n + 3) & !3;
+        loop {
+            let hdr = std::str::from_utf8(&buf[off..off + 110])?;
+            assert_eq!(&hdr[0..6], "070701");
+            let field = |i: usize| usize::from_str_radix(&hdr[6 + i * 8..14 + i * 8], 16);
+            let filesize = field(6)?;
+            let namesize = field(11)?;
+            let name = std::str::from_utf8(&buf[off + 110..off + 110 + namesize - 1])?;
+            off = align(off + 110 + namesize);
+            let data = buf[off..off + filesize].to_vec();
+            off = align(off + filesize);
+            if name == "TRAILER!!!" {
+                if off == buf.len() {
+                    break;
+                }
+                continue;
+            }
+            r.push((name.to_string(), data));
+        }
+        Ok(r)
+    }
 
     #[test]
     fn test_initramfs_overlay() -> Result<()> {
         let cancellable = gio::NONE_CANCELLABLE;
-        let tmpd = tempfile::tempdir()?;
-        std::fs::create_dir_all(tmpd.path().join("etc/foo"))?;
-        std::fs::write(tmpd.path().join("etc/foo/somefile"), "somecontents")?;
-        std::fs::write(tmpd.path().join("etc/foo/otherfile"), "othercontents")?;
-        let tmpd = openat::Dir::open(tmpd.path())?;
+        let tmpdir = tempfile::tempdir()?;
+        std::fs::create_dir_all(tmpdir.path().join("etc/foo"))?;
+        std::fs::create_dir_all(tmpdir.path().join("cache"))?;
+        std::fs::write(tmpdir.path().join("etc/foo/somefile"), "somecontents")?;
+        std::fs::write(tmpdir.path().join("etc/foo/otherfile"), "othercontents")?;
+        std::os::unix::fs::symlink("somefile", tmpdir.path().join("etc/foo/link"))?;
+        let tmpd = openat::Dir::open(tmpdir.path())?;
+        let cachedir = tmpd.sub_dir("cache")?;
         let mut h = HashSet::new();
         h.insert("/etc/foo".to_string());
         {
-            let f = generate_initramfs_overlay(&tmpd, &h, cancellable)?;
+            let f = generate_initramfs_overlay(&tmpd, &h, &cachedir, cancellable)?;
             let o = tmpd.new_file("initramfs", 0o644)?;
             f.copy_to(&o)?;
         }
-        let _ = tmpd.metadata("initramfs").context("stat")?;
+        let entries = parse_overlay(tmpd.open_file("initramfs")?)?;
+        let names: Vec<&str> = entries.iter().map(|(n, _)| n.as_str()).collect();
+        assert_eq!(
+            names,
+            &[
+                "etc/foo",
+                "etc/foo/link",
+                "etc/foo/otherfile",
+                "etc/foo/somefile"
+            ]
+        );
+        assert_eq!(entries[1].1, b"somefile");
+        assert_eq!(entries[3].1, b"somecontents");
+
+        // Nothing changed, so we should get the cached archive back.
+        let ino = |f: &fs::File| -> Result<u64> { Ok(f.metadata()?.ino()) };
+        let cached = ino(&cachedir.open_file(OVERLAY_CACHE_ARCHIVE)?)?;
+        let f = generate_initramfs_overlay(&tmpd, &h, &cachedir, cancellable)?;
+        assert_eq!(ino(&f)?, cached);
+
+        // A new file invalidates the cache.
+        tmpd.write_file_contents("etc/foo/newfile", 0o644, "new")?;
+        let f = generate_initramfs_overlay(&tmpd, &h, &cachedir, cancellable)?;
+        assert_ne!(ino(&f)?, cached);
+        assert_eq!(parse_overlay(f)?.len(), 5);
+
+        // So does rewriting a file in place with the same size and mtime, as
+        // `touch -r` allows.  Keep the old archive open so its inode can't be
+        // reused.
+        let cached_f = cachedir.open_file(OVERLAY_CACHE_ARCHIVE)?;
+        let cached = ino(&cached_f)?;
+        let path = tmpdir.path().join("etc/foo/somefile");
+        let st = fs::metadata(&path)?;
+        fs::OpenOptions::new()
+            .write(true)
+            .open(&path)?
+            .write_all(b"SOMECONTENTS")?;
+        let times = [
+            libc::timespec {
+                tv_sec: st.atime() as _,
+                tv_nsec: st.atime_nsec() as _,
+            },
+            libc::timespec {
+                tv_sec: st.mtime() as _,
+                tv_nsec: st.mtime_nsec() as _,
+            },
+        ];
+        let cpath = std::ffi::CString::new(path.as_os_str().as_bytes())?;
+        let r = unsafe { libc::utimensat(libc::AT_FDCWD, cpath.as_ptr(), times.as_ptr(), 0) };
+        assert_eq!(r, 0);
+        let f = generate_initramfs_overlay(&tmpd, &h, &cachedir, cancellable)?;
+        assert_ne!(ino(&f)?, cached);
+        let entries = parse_overlay(f)?;
+        let (_, data) = entries
+            .iter()
+            .find(|(n, _)| n == "etc/foo/somefile")
+            .unwrap();
+        assert_eq!(data, b"SOMECONTENTS");
+        Ok(())
+    }
+
+    #[test]
+    fn test_initramfs_overlay_chunked() -> Result<()> {
+        let tmpd = tempfile::tempdir()?;
+        std::fs::create_dir_all(tmpd.path().join("etc/big"))?;
+        let content = vec![b'x'; (OVERLAY_CHUNK_SIZE / 2) as usize + 1];
+        for i in 0..5 {
+            std::fs::write(tmpd.path().join(format!("etc/big/{}", i)), &content)?;
+        }
+        let tmpd = openat::Dir::open(tmpd.path())?;
+        let etcd = tmpd.sub_dir("etc")?;
+        let mut h = HashSet::new();
+        h.insert("/etc/big".to_string());
+        let filelist = gather_filelist(&etcd, &h, gio::NONE_CANCELLABLE)?;
+        let mut out = tempfile::tempfile()?;
+        write_overlay(&etcd, &filelist, &mut out)?;
+        out.seek(io::SeekFrom::Start(0))?;
+        let entries = parse_overlay(out)?;
+        assert_eq!(entries.len(), 6);
+        assert!(entries[1..].iter().all(|(_, data)| data == &content));
         Ok(())
     }
 }
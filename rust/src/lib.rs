@@ -116,6 +116,30 @@ pub mod ffi {
         fn write_commit_id(target_path: &str, revision: &str) -> Result<()>;
     }
 
+    // checkpoint.rs
+    #[derive(Debug)]
+    struct AssemblyCheckpoint {
+        found: bool,
+        kernel_changed: bool,
+    }
+
+    extern "Rust" {
+        fn assembly_checkpoint_save(
+            repo_dfd: i32,
+            rootfs: &str,
+            checkpoint: &str,
+            inputs: &str,
+            kernel_changed: bool,
+        ) -> Result<()>;
+        fn assembly_checkpoint_find(
+            repo_dfd: i32,
+            checkpoint: &str,
+            inputs: &str,
+        ) -> Result<AssemblyCheckpoint>;
+        fn assembly_checkpoint_restore(repo_dfd: i32, checkpoint: &str, rootfs: &str)
+            -> Result<()>;
+    }
+
     // cliwrap.rs
     extern "Rust" {
         fn cliwrap_write_wrappers(rootfs: i32) -> Result<()>;
@@ -196,6 +220,26 @@ pub mod ffi {
         ) -> Result<DeploymentLayeredMeta>;
     }
 
+    // governor.rs
+    /// Resource limits for background transactions; zero means unset.
+    #[derive(Debug)]
+    struct GovernorLimits {
+        /// `cpu.weight`, from 1 to 10000
+        cpu_weight: u64,
+        /// Default `io.weight`, from 1 to 10000
+        io_weight: u64,
+        /// `memory.high`, in bytes
+        memory_high: u64,
+        /// `cpu.max`, in percent of a single CPU
+        cpu_quota: u64,
+    }
+
+    extern "Rust" {
+        fn governor_enter(limits: &GovernorLimits) -> Result<bool>;
+        fn governor_leave() -> Result<()>;
+        fn governor_parallelism() -> u32;
+    }
+
     // importer.rs
     extern "Rust" {
         fn path_is_in_opt(path: &str) -> bool;
@@ -216,6 +260,17 @@ pub mod ffi {
         fn journal_print_staging_failure();
     }
 
+    // pkgcache.rs
+    extern "Rust" {
+        fn pkgcache_retention_prune(
+            repo: Pin<&mut OstreeRepo>,
+            repo_dfd: i32,
+            refs: &Vec<StringMapping>,
+            referenced: &Vec<String>,
+            budget: u64,
+        ) -> Result<Vec<String>>;
+    }
+
     // progress.rs
     extern "Rust" {
         fn console_progress_begin_task(msg: &str);
@@ -517,6 +572,26 @@ pub mod ffi {
         fn nevra_to_cache_branch(nevra: &CxxString) -> Result<UniquePtr<CxxString>>;
         fn get_repodata_chksum_repr(pkg: &mut DnfPackage) -> Result<String>;
     }
+
+    /// An installed package, as read from an rpmdb.
+    #[derive(Debug)]
+    struct PackageMeta {
+        /// `name.arch`
+        name: String,
+        /// Timestamps of the %changelog entries
+        changelogs: Vec<u64>,
+        /// Paths owned by the package, as recorded in the rpmdb
+        paths: Vec<String>,
+    }
+
+    // rpmostree-refts.h
+    unsafe extern "C++" {
+        include!("rpmostree-refts.h");
+        type RpmTs;
+
+        fn rpmts_for_commit(repo: Pin<&mut OstreeRepo>, rev: &str) -> Result<UniquePtr<RpmTs>>;
+        fn packages(self: &RpmTs) -> Vec<PackageMeta>;
+    }
 }
 
 mod builtins;
@@ -524,6 +599,9 @@ pub(crate) use crate::builtins::apply_live::*;
 pub(crate) use crate::builtins::compose::commit::*;
 mod bwrap;
 pub(crate) use bwrap::*;
+mod checkpoint;
+pub(crate) use checkpoint::*;
+mod chunking;
 mod client;
 pub(crate) use client::*;
 mod cliwrap;
@@ -541,6 +619,9 @@ mod extensions;
 pub(crate) use extensions::*;
 #[cfg(feature = "fedora-integration")]
 mod fedora_integration;
+mod fetch;
+mod governor;
+pub(crate) use self::governor::*;
 mod history;
 pub use self::history::*;
 mod importer;
@@ -561,6 +642,8 @@ mod nameservice;
 mod origin;
 mod passwd;
 use passwd::*;
+mod pkgcache;
+pub(crate) use self::pkgcache::*;
 mod console_progress;
 pub(crate) use self::console_progress::*;
 mod progress;
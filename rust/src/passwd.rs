@@ -12,11 +12,13 @@ use gio::prelude::InputStreamExtManual;
 use gio::FileExt;
 use nix::unistd::{Gid, Uid};
 use openat_ext::OpenatDirExt;
+use rayon::prelude::*;
 use std::collections::{BTreeMap, BTreeSet, HashMap, HashSet};
+use std::ffi::OsString;
 use std::fs::File;
 use std::io::{BufRead, BufReader, BufWriter, Write};
 use std::os::unix::io::AsRawFd;
-use std::path::PathBuf;
+use std::path::{Path, PathBuf};
 use std::pin::Pin;
 
 const DEFAULT_MODE: u32 = 0o644;
@@ -244,6 +246,128 @@ fn compare_uid_gid(metadata: openat::Metadata, uid: &Option<Uid>, gid: &Option<G
     found
 }
 
+/// Paths owned by a single UID or GID.
+#[derive(Debug, Default)]
+struct OwnedPaths {
+    count: u64,
+    example: Option<PathBuf>,
+}
+
+impl OwnedPaths {
+    fn add<F: FnOnce() -> PathBuf>(&mut self, path: F) {
+        self.count += 1;
+        if self.example.is_none() {
+            self.example = Some(path());
+        }
+    }
+
+    fn merge(&mut self, other: Self) {
+        self.count += other.count;
+        if self.example.is_none() {
+            self.example = other.example;
+        }
+    }
+}
+
+/// File ownership of a whole rootfs, keyed by UID and GID.  This is built
+/// with a single walk so that checking many removed users/groups doesn't
+/// cost one full walk each.
+#[derive(Debug, Default)]
+struct OwnershipIndex {
+    uids: HashMap<u32, OwnedPaths>,
+    gids: HashMap<u32, OwnedPaths>,
+}
+
+impl OwnershipIndex {
+    /// Index `rootfs`, walking each toplevel directory in parallel.
+    #[context("Indexing file ownership")]
+    fn new(rootfs: &openat::Dir) -> Result<Self> {
+        use openat::SimpleType;
+
+        let root = Path::new("/");
+        let mut index = Self::default();
+        index.add(&rootfs.self_metadata()?, || root.to_path_buf());
+        let mut subdirs: Vec<OsString> = Vec::new();
+        for dir_entry in rootfs.list_self()? {
+            let dir_entry = dir_entry?;
+            let name = dir_entry.file_name();
+            match dir_entry.simple_type() {
+                Some(SimpleType::Dir) => subdirs.push(name.to_os_string()),
+                Some(_) => index.add(&rootfs.metadata(name)?, || root.join(name)),
+                None => continue,
+            }
+        }
+
+        let partials = subdirs
+            .par_iter()
+            .map(|name| -> Result<Self> {
+                let mut partial = Self::default();
+                let subdir = rootfs.sub_dir(name.as_os_str())?;
+                partial.walk(&subdir, &root.join(name))?;
+                Ok(partial)
+            })
+            .collect::<Result<Vec<_>>>()?;
+        for partial in partials {
+            index.merge(partial);
+        }
+        Ok(index)
+    }
+
+    fn walk(&mut self, dir: &openat::Dir, path: &Path) -> Result<()> {
+        use openat::SimpleType;
+
+        self.add(&dir.self_metadata()?, || path.to_path_buf());
+        for dir_entry in dir.list_self()? {
+            let dir_entry = dir_entry?;
+            let name = dir_entry.file_name();
+            match dir_entry.simple_type() {
+                Some(SimpleType::Dir) => {
+                    let subdir = dir.sub_dir(name)?;
+                    self.walk(&subdir, &path.join(name))?;
+                }
+                Some(_) => self.add(&dir.metadata(name)?, || path.join(name)),
+                None => continue,
+            }
+        }
+        Ok(())
+    }
+
+    fn add<F: Fn() -> PathBuf>(&mut self, metadata: &openat::Metadata, path: F) {
+        let stat = metadata.stat();
+        self.uids.entry(stat.st_uid).or_default().add(&path);
+        self.gids.entry(stat.st_gid).or_default().add(&path);
+    }
+
+    fn merge(&mut self, other: Self) {
+        for (uid, owned) in other.uids {
+            self.uids.entry(uid).or_default().merge(owned);
+        }
+        for (gid, owned) in other.gids {
+            self.gids.entry(gid).or_default().merge(owned);
+        }
+    }
+
+    fn uid(&self, uid: Uid) -> Option<&OwnedPaths> {
+        self.uids.get(&uid.as_raw())
+    }
+
+    fn gid(&self, gid: Gid) -> Option<&OwnedPaths> {
+        self.gids.get(&gid.as_raw())
+    }
+}
+
+/// Return the ownership index of `rootfs`, building it on first use; most
+/// composes don't remove any user or group and never need it.
+fn ownership_index<'a>(
+    index: &'a mut Option<OwnershipIndex>,
+    rootfs: &openat::Dir,
+) -> Result<&'a OwnershipIndex> {
+    if index.is_none() {
+        *index = Some(OwnershipIndex::new(rootfs)?);
+    }
+    Ok(index.as_ref().expect("ownership index"))
+}
+
 pub fn passwd_compose_prep(rootfs_dfd: i32, treefile: &mut Treefile) -> CxxResult<()> {
     let rootfs = ffiutil::ffi_view_openat_dir(rootfs_dfd);
     passwd_compose_prep_impl(&rootfs, treefile, None, true)?;
@@ -547,11 +671,15 @@ pub fn check_passwd_group_entries(
     old_entities.populate_users_from_treefile(treefile, &repo_previous_rev)?;
     old_entities.populate_groups_from_treefile(treefile, &repo_previous_rev)?;
 
+    // Shared by both checks below, so the rootfs is walked at most once.
+    let mut ownership = None;
+
     // See "man 5 passwd". We just make sure the name and uid/gid match,
     // and that none are missing. Don't care about GECOS/dir/shell.
     new_entities.validate_treefile_check_passwd(
         &old_entities,
-        rootfs.as_raw_fd(),
+        &rootfs,
+        &mut ownership,
         &treefile.parsed.ignore_removed_users,
     )?;
 
@@ -559,7 +687,8 @@ pub fn check_passwd_group_entries(
     // and that none are missing. Don't care about users.
     new_entities.validate_treefile_check_groups(
         &old_entities,
-        rootfs.as_raw_fd(),
+        &rootfs,
+        &mut ownership,
         &treefile.parsed.ignore_removed_groups,
     )?;
 
@@ -819,7 +948,8 @@ impl PasswdEntries {
     fn validate_treefile_check_passwd(
         &self,
         old_subset: &PasswdEntries,
-        rootfs: i32,
+        rootfs: &openat::Dir,
+        ownership: &mut Option<OwnershipIndex>,
         ignored_users: &Option<HashSet<String>>,
     ) -> Result<()> {
         let old_user_names: BTreeSet<&str> = old_subset.users.keys().map(|s| s.as_str()).collect();
@@ -849,9 +979,14 @@ impl PasswdEntries {
                 .users
                 .get(*missing_user)
                 .expect("invalid old passwd entry");
-            let found_matching = dir_contains_uid(rootfs, old_user_entry.0.as_raw())?;
-            if found_matching {
-                anyhow::bail!("User missing from new passwd file: {}", missing_user);
+            let owned = ownership_index(ownership, rootfs)?.uid(old_user_entry.0);
+            if let Some(owned) = owned {
+                anyhow::bail!(
+                    "User missing from new passwd file: {} (owns {} paths, e.g. {:?})",
+                    missing_user,
+                    owned.count,
+                    owned.example.as_ref().expect("owned path"),
+                );
             }
 
             println!("Unused user removed from new passwd file: {}", missing_user);
@@ -897,7 +1032,8 @@ impl PasswdEntries {
     fn validate_treefile_check_groups(
         &self,
         old_subset: &PasswdEntries,
-        rootfs: i32,
+        rootfs: &openat::Dir,
+        ownership: &mut Option<OwnershipIndex>,
         ignored_groups: &Option<HashSet<String>>,
     ) -> Result<()> {
         let old_group_names: BTreeSet<&str> =
@@ -928,9 +1064,14 @@ impl PasswdEntries {
                 .groups
                 .get(*missing_group)
                 .expect("invalid old group entry");
-            let found_matching = dir_contains_gid(rootfs, old_gid.as_raw())?;
-            if found_matching {
-                anyhow::bail!("Group missing from new group file: {}", missing_group);
+            let owned = ownership_index(ownership, rootfs)?.gid(*old_gid);
+            if let Some(owned) = owned {
+                anyhow::bail!(
+                    "Group missing from new group file: {} (owns {} paths, e.g. {:?})",
+                    missing_group,
+                    owned.count,
+                    owned.example.as_ref().expect("owned path"),
+                );
             }
 
             println!(
@@ -966,3 +1107,31 @@ impl PasswdEntries {
         Ok(())
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_ownership_index() -> Result<()> {
+        let td = tempfile::tempdir()?;
+        let d = openat::Dir::open(td.path())?;
+        d.ensure_dir_all("usr/bin", 0o755)?;
+        d.ensure_dir_all("var", 0o755)?;
+        d.write_file_contents("usr/bin/foo", 0o755, "foo")?;
+        d.symlink("bin", "usr/bin")?;
+
+        let index = OwnershipIndex::new(&d)?;
+        let uid = nix::unistd::getuid();
+        let gid = nix::unistd::getgid();
+        // The root, usr, usr/bin, usr/bin/foo, var and bin.
+        assert_eq!(index.uid(uid).unwrap().count, 6);
+        assert_eq!(index.gid(gid).unwrap().count, 6);
+        assert_eq!(
+            index.uid(uid).unwrap().example.as_deref(),
+            Some(Path::new("/"))
+        );
+        assert!(index.uid(Uid::from_raw(uid.as_raw() + 1)).is_none());
+        Ok(())
+    }
+}
@@ -0,0 +1,228 @@
+//! Retention policy for the `rpmostree/pkg/*` branches (the "pkgcache").
+//!
+//! By default, a cached package is dropped as soon as no deployment
+//! references it.  That means that e.g. rolling back and re-layering
+//! has to re-download and re-import the same RPMs.  If a byte budget
+//! is configured, unreferenced branches are instead kept around, and
+//! the least recently used ones are evicted once the budget is exceeded.
+//! A branch counts as "used" for as long as some deployment references it.
+
+// SPDX-License-Identifier: Apache-2.0 OR MIT
+
+use crate::cxxrsutil::*;
+use crate::ffi::StringMapping;
+use anyhow::{Context, Result};
+use openat_ext::OpenatDirExt;
+use serde_derive::{Deserialize, Serialize};
+use std::collections::{BTreeMap, HashSet};
+use std::pin::Pin;
+
+/// Retention state, relative to the repository directory.
+const PKGCACHE_STATE_DIR: &str = "extensions/rpmostree";
+const PKGCACHE_STATE_PATH: &str = "extensions/rpmostree/pkgcache-state.json";
+
+/// What we know about a single pkgcache branch.
+#[derive(Serialize, Deserialize, Debug, Clone, PartialEq)]
+#[serde(rename_all = "kebab-case")]
+struct PkgcacheEntry {
+    /// The commit the branch pointed to when `size` was computed.
+    commit: String,
+    /// Approximate on-disk size of the commit's objects, in bytes.
+    size: u64,
+    /// Last time (seconds since the epoch) a deployment referenced the branch.
+    /// Only updated when the branch starts or stops being referenced, so that
+    /// the state doesn't change (and need rewriting) on every cleanup.
+    last_used: u64,
+    /// Whether a deployment referenced the branch at the last cleanup.
+    #[serde(default)]
+    in_use: bool,
+}
+
+#[derive(Serialize, Deserialize, Debug, Default)]
+#[serde(rename_all = "kebab-case")]
+struct PkgcacheState {
+    entries: BTreeMap<String, PkgcacheEntry>,
+}
+
+impl PkgcacheState {
+    fn load(repo_dfd: &openat::Dir) -> Result<Self> {
+        let f = match repo_dfd.open_file_optional(PKGCACHE_STATE_PATH)? {
+            Some(f) => f,
+            None => return Ok(Self::default()),
+        };
+        match serde_json::from_reader(std::io::BufReader::new(f)) {
+            Ok(s) => Ok(s),
+            // This is just a cache; if it's corrupted start from scratch.
+            Err(_) => Ok(Self::default()),
+        }
+    }
+
+    fn store(&self, repo_dfd: &openat::Dir) -> Result<()> {
+        repo_dfd.ensure_dir_all(PKGCACHE_STATE_DIR, 0o755)?;
+        repo_dfd.write_file_with(PKGCACHE_STATE_PATH, 0o644, |w| -> Result<()> {
+            Ok(serde_json::to_writer(w, self)?)
+        })?;
+        Ok(())
+    }
+}
+
+/// Sum the storage size of all objects reachable from `commit`.  Objects
+/// shared with other commits are counted for each of them, so this is an
+/// upper bound on what deleting the branch would free.
+fn commit_size(repo: &ostree::Repo, commit: &str) -> Result<u64> {
+    let objects = repo.traverse_commit(commit, 0, gio::NONE_CANCELLABLE)?;
+    objects.iter().try_fold(0u64, |acc, obj| {
+        let size = repo.query_object_storage_size(
+            obj.object_type(),
+            obj.checksum(),
+            gio::NONE_CANCELLABLE,
+        )?;
+        Ok(acc + size)
+    })
+}
+
+/// Given the entries for all branches, return those to delete so that the total
+/// size of branches which aren't in `referenced` fits in `budget` bytes.
+/// Least recently used branches go first.
+fn select_evictions(
+    entries: &BTreeMap<String, PkgcacheEntry>,
+    referenced: &HashSet<&str>,
+    budget: u64,
+) -> Vec<String> {
+    let mut candidates: Vec<(&String, &PkgcacheEntry)> = entries
+        .iter()
+        .filter(|(r, _)| !referenced.contains(r.as_str()))
+        .collect();
+    candidates.sort_by(|a, b| a.1.last_used.cmp(&b.1.last_used).then(a.0.cmp(b.0)));
+    let mut total: u64 = candidates.iter().map(|(_, e)| e.size).sum();
+    let mut r = Vec::new();
+    for (name, entry) in candidates {
+        // Without a budget we don't track sizes; drop everything.
+        if budget > 0 && total <= budget {
+            break;
+        }
+        total -= entry.size;
+        r.push(name.clone());
+    }
+    r
+}
+
+fn now() -> u64 {
+    std::time::SystemTime::now()
+        .duration_since(std::time::UNIX_EPOCH)
+        .map(|d| d.as_secs())
+        .unwrap_or_default()
+}
+
+/// Update the retention state for the pkgcache branches in `refs` (mapping
+/// branch to commit), and return the branches which should be deleted.  A
+/// `budget` of zero keeps only the branches in `referenced`.
+pub(crate) fn pkgcache_retention_prune(
+    mut repo: Pin<&mut crate::FFIOstreeRepo>,
+    repo_dfd: i32,
+    refs: &Vec<StringMapping>,
+    referenced: &Vec<String>,
+    budget: u64,
+) -> CxxResult<Vec<String>> {
+    let repo = &repo.gobj_wrap();
+    let repo_dfd = crate::ffiutil::ffi_view_openat_dir(repo_dfd);
+    let referenced: HashSet<&str> = referenced.iter().map(|s| s.as_str()).collect();
+    let mut state = PkgcacheState::load(&repo_dfd)?;
+    let now = now();
+
+    let mut entries = BTreeMap::new();
+    for StringMapping { k: name, v: commit } in refs {
+        let prev = state.entries.get(name);
+        let in_use = referenced.contains(name.as_str());
+        // Without a budget we never need sizes, so don't pay for traversing.
+        let size = match prev {
+            Some(e) if &e.commit == commit => e.size,
+            _ if budget == 0 => 0,
+            _ => commit_size(repo, commit).with_context(|| format!("Sizing {}", name))?,
+        };
+        let last_used = match (prev, in_use) {
+            // Nothing changed; neither does the timestamp.
+            (Some(e), _) if e.in_use == in_use => e.last_used,
+            // We don't know anything about it; it's a prime eviction candidate.
+            (None, false) => 0,
+            // It started or stopped being used.
+            _ => now,
+        };
+        let entry = PkgcacheEntry {
+            commit: commit.clone(),
+            size,
+            last_used,
+            in_use,
+        };
+        entries.insert(name.clone(), entry);
+    }
+
+    let evict = select_evictions(&entries, &referenced, budget);
+    for name in evict.iter() {
+        entries.remove(name);
+    }
+    if entries != state.entries {
+        state.entries = entries;
+        state.store(&repo_dfd)?;
+    }
+    Ok(evict)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn entry(size: u64, last_used: u64) -> PkgcacheEntry {
+        PkgcacheEntry {
+            commit: "".into(),
+            size,
+            last_used,
+            in_use: false,
+        }
+    }
+
+    #[test]
+    fn test_select_evictions() {
+        let mut entries = BTreeMap::new();
+        entries.insert("rpmostree/pkg/a".to_string(), entry(100, 10));
+        entries.insert("rpmostree/pkg/b".to_string(), entry(100, 30));
+        entries.insert("rpmostree/pkg/c".to_string(), entry(100, 20));
+        entries.insert("rpmostree/pkg/d".to_string(), entry(1000, 0));
+        let mut referenced = HashSet::new();
+        referenced.insert("rpmostree/pkg/d");
+
+        // No budget: everything unreferenced goes
+        let mut r = select_evictions(&entries, &referenced, 0);
+        r.sort();
+        assert_eq!(
+            r,
+            &["rpmostree/pkg/a", "rpmostree/pkg/b", "rpmostree/pkg/c"]
+        );
+        // Enough budget for everything
+        assert!(select_evictions(&entries, &referenced, 300).is_empty());
+        // Least recently used goes first; referenced entries don't count
+        assert_eq!(
+            select_evictions(&entries, &referenced, 250),
+            &["rpmostree/pkg/a"]
+        );
+        assert_eq!(
+            select_evictions(&entries, &referenced, 100),
+            &["rpmostree/pkg/a", "rpmostree/pkg/c"]
+        );
+    }
+
+    #[test]
+    fn test_state_roundtrip() -> Result<()> {
+        let td = tempfile::tempdir()?;
+        let d = openat::Dir::open(td.path())?;
+        assert!(PkgcacheState::load(&d)?.entries.is_empty());
+        let mut s = PkgcacheState::default();
+        s.entries.insert("rpmostree/pkg/a".into(), entry(42, 7));
+        s.store(&d)?;
+        let s2 = PkgcacheState::load(&d)?;
+        assert_eq!(s.entries, s2.entries);
+        d.write_file_contents(PKGCACHE_STATE_PATH, 0o644, "garbage")?;
+        assert!(PkgcacheState::load(&d)?.entries.is_empty());
+        Ok(())
+    }
+}
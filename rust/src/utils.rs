@@ -8,6 +8,7 @@
  */
 
 use crate::cxxrsutil::*;
+use crate::fetch;
 use crate::variant_utils;
 use anyhow::{bail, Context, Result};
 use glib::translate::ToGlibPtr;
@@ -18,8 +19,6 @@ use std::path::Path;
 use std::pin::Pin;
 use std::{fs, io};
 
-use curl::easy::Easy;
-
 #[derive(PartialEq)]
 /// Supported config serialization used by treefile and lockfile
 pub enum InputFormat {
@@ -83,47 +82,19 @@ pub(crate) fn download_url_to_tmpfile(url: &str, progress: bool) -> Result<fs::F
 /// Given multiple URLs, download them to an O_TMPFILE (temporary file descriptor).
 /// This uses sane defaults for fetching files, such as following the location
 /// and making HTTP level errors also return an error rather than the error page HTML.
+/// The downloads run concurrently; see `fetch.rs`.
 pub(crate) fn download_urls_to_tmpfiles<S: AsRef<str>>(
     urls: Vec<S>,
     progress: bool,
 ) -> Result<Vec<fs::File>> {
-    let mut handle = Easy::new();
-    handle.follow_location(true)?;
-    handle.fail_on_error(true)?;
-    urls.iter()
-        .map(|url| {
-            let url = url.as_ref();
-            let mut tmpf = tempfile::tempfile()?;
-            if progress {
-                print!("Downloading {}...", url);
-            }
-            // Create an internally invoked closure so we can
-            // capture the success/error case to complete the progress output line.
-            let mut dl = || -> Result<()> {
-                let mut output = io::BufWriter::new(&mut tmpf);
-                handle.url(url)?;
-
-                let mut transfer = handle.transfer();
-                transfer
-                    .write_function(|data| output.write_all(data).and(Ok(data.len())).or(Ok(0)))?;
-                transfer.perform()?;
-                Ok(())
-            };
-            if progress {
-                match dl() {
-                    Ok(()) => println!("done"),
-                    Err(e) => {
-                        println!("failed");
-                        return Err(e);
-                    }
-                }
-            } else {
-                dl()?;
-            }
-            tmpf.seek(io::SeekFrom::Start(0))?;
-            Ok(tmpf)
-        })
-        .collect()
+    let opts = fetch::FetchOptions {
+        progress,
+        ..Default::default()
+    };
+    if progress && urls.len() > 1 {
+        println!("Downloading {} files...", urls.len());
+    }
+    fetch::fetch_urls_to_tmpfiles(&urls, &opts)
 }
 
 /// Open file for reading and provide context containing filename on failures.
@@ -58,7 +58,7 @@ static RpmOstreeCommand commands[] = {
   { "rollback", static_cast<RpmOstreeBuiltinFlags>(0),
     "Revert to the previously booted tree",
     rpmostree_builtin_rollback },
-  { "status", static_cast<RpmOstreeBuiltinFlags>(0),
+  { "status", static_cast<RpmOstreeBuiltinFlags>(RPM_OSTREE_BUILTIN_FLAG_STATUS_SNAPSHOT),
     "Get the version of the booted system",
     rpmostree_builtin_status },
   { "upgrade", static_cast<RpmOstreeBuiltinFlags>(RPM_OSTREE_BUILTIN_FLAG_SUPPORTS_PKG_INSTALLS),
@@ -296,6 +296,20 @@ rpmostree_option_context_parse (GOptionContext *context,
             }
         }
 
+      /* Read-only commands on the host don't need to wake up the daemon */
+      if ((flags & RPM_OSTREE_BUILTIN_FLAG_STATUS_SNAPSHOT) > 0 && !opt_sysroot && !opt_force_peer)
+        {
+          RPMOSTreeSysroot *snapshot = rpmostree_load_status_snapshot (cancellable);
+          if (snapshot)
+            {
+              *out_sysroot_proxy = snapshot;
+              use_daemon = FALSE;
+            }
+        }
+    }
+
+  if (use_daemon)
+    {
       /* root never needs to auth */
       if (getuid () != 0)
         /* ignore errors; we print out a warning if we fail to spawn pkttyagent */
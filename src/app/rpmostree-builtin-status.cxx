@@ -272,19 +272,28 @@ get_last_auto_update_run (GDBusConnection   *connection,
   return TRUE;
 }
 
+/* The system bus, for querying systemd; with a status snapshot there's no
+ * proxy whose connection we could reuse. */
+static GDBusConnection *
+get_system_bus (RPMOSTreeSysroot *sysroot_proxy,
+                GCancellable     *cancellable,
+                GError          **error)
+{
+  if (G_IS_DBUS_PROXY (sysroot_proxy))
+    return static_cast<GDBusConnection *>(g_object_ref (g_dbus_proxy_get_connection (G_DBUS_PROXY (sysroot_proxy))));
+  return g_bus_get_sync (G_BUS_TYPE_SYSTEM, cancellable, error);
+}
+
 /* Get the ActiveState and StatusText properties of `update_driver_sd_unit`. ActiveState
  * (and StatusText if found) is returned as a single string in `update_driver_state` if
  * ActiveState is not empty. */
 static gboolean
-get_update_driver_state (RPMOSTreeSysroot *sysroot_proxy,
+get_update_driver_state (GDBusConnection  *connection,
                          const char       *update_driver_sd_unit,
                          const char      **update_driver_state,
                          GCancellable     *cancellable,
                          GError          **error)
 {
-  GDBusConnection *connection =
-    g_dbus_proxy_get_connection (G_DBUS_PROXY (sysroot_proxy));
-
   const char *update_driver_objpath = NULL;
   if (!get_sd_unit_objpath (connection, "LoadUnit", g_variant_new ("(s)", update_driver_sd_unit),
                             &update_driver_objpath, cancellable, error))
@@ -353,6 +362,10 @@ print_daemon_state (RPMOSTreeSysroot *sysroot_proxy,
 
   g_print ("State: %s\n", txn_proxy ? "busy" : "idle");
 
+  g_autoptr(GDBusConnection) connection = get_system_bus (sysroot_proxy, cancellable, error);
+  if (!connection)
+    return FALSE;
+
   rpmostreecxx::journal_print_staging_failure ();
 
   g_autofree char *update_driver_sd_unit = NULL;
@@ -371,7 +384,7 @@ print_daemon_state (RPMOSTreeSysroot *sysroot_proxy,
       /* only try to get unit's StatusText if we're on the system bus */
       g_autofree const char *update_driver_state = NULL;
       g_autoptr(GError) local_error = NULL;
-      if (!get_update_driver_state (sysroot_proxy, update_driver_sd_unit,
+      if (!get_update_driver_state (connection, update_driver_sd_unit,
                                     &update_driver_state, cancellable, &local_error))
         g_printerr ("%s", local_error->message);
       else if (update_driver_state)
@@ -392,8 +405,6 @@ print_daemon_state (RPMOSTreeSysroot *sysroot_proxy,
       AutoUpdateSdState state;
       g_autofree char *last_run = NULL;
       g_print ("; ");
-      GDBusConnection *connection =
-        g_dbus_proxy_get_connection (G_DBUS_PROXY (sysroot_proxy));
       if (!get_last_auto_update_run (connection, &state, &last_run, cancellable, error))
         return FALSE;
       switch (state)
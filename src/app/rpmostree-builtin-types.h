@@ -37,6 +37,8 @@ typedef enum {
   RPM_OSTREE_BUILTIN_FLAG_REQUIRES_ROOT = 1 << 1,
   RPM_OSTREE_BUILTIN_FLAG_HIDDEN = 1 << 2,
   RPM_OSTREE_BUILTIN_FLAG_SUPPORTS_PKG_INSTALLS = 1 << 3,
+  /* May read the daemon's status snapshot instead of activating it */
+  RPM_OSTREE_BUILTIN_FLAG_STATUS_SNAPSHOT = 1 << 4,
 } RpmOstreeBuiltinFlags;
 
 typedef struct RpmOstreeCommand RpmOstreeCommand;
@@ -125,7 +125,7 @@ rpmostree_builtin_upgrade (int             argc,
   if (!opt_automatic)
     {
       const char *policy = rpmostree_sysroot_get_automatic_update_policy (sysroot_proxy);
-      if (policy && g_str_equal (policy, "stage"))
+      if (policy && (g_str_equal (policy, "stage") || g_str_equal (policy, "prepare")))
         g_print ("note: automatic updates (%s) are enabled\n", policy);
     }
 
@@ -38,6 +38,8 @@
 #include "rpmostree-util.h"
 #include "rpmostree-rpm-util.h"
 #include "rpmostree-cxxrs.h"
+#include "rpmostree-core.h"
+#include "rpmostree-paths.h"
 #include "rpmostreed-transaction-types.h"
 
 static gboolean
@@ -220,6 +222,134 @@ rpmostree_load_sysroot (const char        *sysroot,
   return TRUE;
 }
 
+/* Key for the OS object attached to a snapshot sysroot */
+#define SNAPSHOT_OS_KEY "rpmostree-snapshot-os"
+
+static gboolean
+daemon_is_running (GCancellable *cancellable,
+                   gboolean     *out_running,
+                   GError      **error)
+{
+  g_autoptr(GDBusConnection) connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, cancellable, error);
+  if (!connection)
+    return FALSE;
+  g_autoptr(GVariant) res =
+    g_dbus_connection_call_sync (connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                 "org.freedesktop.DBus", "NameHasOwner",
+                                 g_variant_new ("(s)", BUS_NAME), G_VARIANT_TYPE ("(b)"),
+                                 G_DBUS_CALL_FLAGS_NONE, -1, cancellable, error);
+  if (!res)
+    return FALSE;
+  g_variant_get (res, "(b)", out_running);
+  return TRUE;
+}
+
+/* The mtimes of what a status snapshot was derived from, in the same order as
+ * in rpmostreed_sysroot_write_status_snapshot(). */
+static GVariant *
+current_snapshot_stamp (GError **error)
+{
+  const char *paths[] = { "/ostree/deploy", "/ostree/repo", RPMOSTREED_CONF,
+                          RPMOSTREE_AUTOUPDATES_CACHE_FILE };
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("((tt)(tt)(tt)(tt))"));
+  for (guint i = 0; i < G_N_ELEMENTS (paths); i++)
+    {
+      g_autoptr(GVariant) stamp = rpmostree_mtime_stamp (AT_FDCWD, paths[i], error);
+      if (!stamp)
+        {
+          g_variant_builder_clear (&builder);
+          return NULL;
+        }
+      g_variant_builder_add_value (&builder, stamp);
+    }
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static gboolean
+load_status_snapshot_impl (GCancellable      *cancellable,
+                           RPMOSTreeSysroot **out_sysroot,
+                           GError           **error)
+{
+  *out_sysroot = NULL;
+
+  /* A running daemon may have changed state since it last wrote the snapshot */
+  gboolean running = FALSE;
+  if (!daemon_is_running (cancellable, &running, error))
+    return FALSE;
+  if (running)
+    return TRUE;
+
+  glnx_autofd int fd = -1;
+  if (!glnx_openat_rdonly (AT_FDCWD, RPMOSTREE_STATUS_SNAPSHOT, TRUE, &fd, error))
+    return FALSE;
+  g_autoptr(GBytes) data = glnx_fd_readall_bytes (fd, cancellable, error);
+  if (!data)
+    return FALSE;
+  g_autoptr(GVariant) snapshot =
+    g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT, data, FALSE));
+  g_auto(GVariantDict) dict;
+  g_variant_dict_init (&dict, snapshot);
+
+  const char *version = NULL;
+  if (!g_variant_dict_lookup (&dict, "version", "&s", &version) ||
+      !g_str_equal (version, PACKAGE_VERSION))
+    return TRUE;
+
+  g_autoptr(GVariant) stamp =
+    g_variant_dict_lookup_value (&dict, "stamp", G_VARIANT_TYPE ("((tt)(tt)(tt)(tt))"));
+  g_autoptr(GVariant) current_stamp = current_snapshot_stamp (error);
+  if (!current_stamp)
+    return FALSE;
+  if (!stamp || !g_variant_equal (stamp, current_stamp))
+    return TRUE;
+
+  g_autoptr(GVariant) deployments =
+    g_variant_dict_lookup_value (&dict, "deployments", G_VARIANT_TYPE ("aa{sv}"));
+  const char *booted = NULL;
+  const char *policy = NULL;
+  if (!deployments ||
+      !g_variant_dict_lookup (&dict, "booted", "&s", &booted) ||
+      !g_variant_dict_lookup (&dict, "automatic-update-policy", "&s", &policy))
+    return glnx_throw (error, "Invalid status snapshot");
+  g_autoptr(GVariant) cached_update =
+    g_variant_dict_lookup_value (&dict, "cached-update", G_VARIANT_TYPE_VARDICT);
+
+  glnx_unref_object RPMOSTreeSysroot *sysroot = rpmostree_sysroot_skeleton_new ();
+  rpmostree_sysroot_set_path (sysroot, "/");
+  rpmostree_sysroot_set_booted (sysroot, booted);
+  rpmostree_sysroot_set_deployments (sysroot, deployments);
+  rpmostree_sysroot_set_automatic_update_policy (sysroot, policy);
+  rpmostree_sysroot_set_active_transaction (sysroot, g_variant_new ("(sss)", "", "", ""));
+  rpmostree_sysroot_set_active_transaction_path (sysroot, "");
+
+  RPMOSTreeOS *os = rpmostree_os_skeleton_new ();
+  rpmostree_os_set_cached_update (os, cached_update);
+  rpmostree_os_set_has_cached_update_rpm_diff (os, cached_update != NULL);
+  g_object_set_data_full (G_OBJECT (sysroot), SNAPSHOT_OS_KEY, os, g_object_unref);
+
+  *out_sysroot = util::move_nullify (sysroot);
+  return TRUE;
+}
+
+/* If the daemon isn't running and the status snapshot it last wrote is still
+ * current, returns a local object holding the host's sysroot state from it;
+ * this avoids activating the daemon just to read properties.  The booted OS is
+ * available via rpmostree_load_os_proxy().  Returns %NULL otherwise. */
+RPMOSTreeSysroot *
+rpmostree_load_status_snapshot (GCancellable *cancellable)
+{
+  g_autoptr(GError) local_error = NULL;
+  RPMOSTreeSysroot *sysroot = NULL;
+  if (!load_status_snapshot_impl (cancellable, &sysroot, &local_error))
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        g_debug ("Not using status snapshot: %s", local_error->message);
+      return NULL;
+    }
+  return sysroot;
+}
+
 gboolean
 rpmostree_load_os_proxies (RPMOSTreeSysroot *sysroot_proxy,
                            const char *opt_osname,
@@ -228,6 +358,17 @@ rpmostree_load_os_proxies (RPMOSTreeSysroot *sysroot_proxy,
                            RPMOSTreeOSExperimental **out_osexperimental_proxy,
                            GError **error)
 {
+  /* See rpmostree_load_status_snapshot() */
+  if (!G_IS_DBUS_PROXY (sysroot_proxy))
+    {
+      auto os = static_cast<RPMOSTreeOS *>(g_object_get_data (G_OBJECT (sysroot_proxy),
+                                                             SNAPSHOT_OS_KEY));
+      if (!os || opt_osname || out_osexperimental_proxy)
+        return glnx_throw (error, "Only the booted OS is available without the daemon");
+      *out_os_proxy = static_cast<RPMOSTreeOS *>(g_object_ref (os));
+      return TRUE;
+    }
+
   g_autofree char *os_object_path = NULL;
   if (opt_osname == NULL)
     os_object_path = rpmostree_sysroot_dup_booted (sysroot_proxy);
@@ -66,6 +66,9 @@ rpmostree_load_sysroot                       (const char        *sysroot,
                                               RPMOSTreeSysroot **out_sysroot_proxy,
                                               GError **error);
 
+RPMOSTreeSysroot *
+rpmostree_load_status_snapshot               (GCancellable *cancellable);
+
 gboolean
 rpmostree_load_os_proxy                      (RPMOSTreeSysroot *sysroot_proxy,
                                               gchar *opt_osname,
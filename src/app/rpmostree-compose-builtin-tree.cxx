@@ -52,13 +52,14 @@
 static gboolean
 pull_local_into_target_repo (OstreeRepo   *src_repo,
                              OstreeRepo   *dest_repo,
-                             const char   *checksum,
+                             const char   *rev,
                              GCancellable *cancellable,
                              GError      **error);
 
 static char *opt_workdir;
 static gboolean opt_workdir_tmpfs;
 static char *opt_cachedir;
+static char *opt_shared_pkgcache;
 static gboolean opt_download_only;
 static gboolean opt_download_only_rpms;
 static gboolean opt_force_nocache;
@@ -79,6 +80,7 @@ static char *opt_write_lockfile_to;
 static char **opt_lockfiles;
 static gboolean opt_lockfile_strict;
 static char *opt_parent;
+static gboolean opt_static_delta;
 
 static char *opt_extensions_output_dir;
 static char *opt_extensions_base_rev;
@@ -93,6 +95,7 @@ static GOptionEntry install_option_entries[] = {
   { "force-nocache", 0, 0, G_OPTION_ARG_NONE, &opt_force_nocache, "Always create a new OSTree commit, even if nothing appears to have changed", NULL },
   { "cache-only", 0, 0, G_OPTION_ARG_NONE, &opt_cache_only, "Assume cache is present, do not attempt to update it", NULL },
   { "cachedir", 0, 0, G_OPTION_ARG_STRING, &opt_cachedir, "Cached state", "CACHEDIR" },
+  { "ex-shared-pkgcache", 0, 0, G_OPTION_ARG_STRING, &opt_shared_pkgcache, "Import packages into a pkgcache repo which concurrent composes may share; must be on the same filesystem as --cachedir", "PATH" },
   { "download-only", 0, 0, G_OPTION_ARG_NONE, &opt_download_only, "Like --dry-run, but download and import RPMs as well; requires --cachedir", NULL },
   { "download-only-rpms", 0, 0, G_OPTION_ARG_NONE, &opt_download_only_rpms, "Like --dry-run, but download RPMs as well; requires --cachedir", NULL },
   { "ex-unified-core", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &opt_unified_core, "Compat alias for --unified-core", NULL }, // Compat
@@ -121,6 +124,7 @@ static GOptionEntry commit_option_entries[] = {
   { "write-composejson-to", 0, 0, G_OPTION_ARG_STRING, &opt_write_composejson_to, "Write JSON to FILE containing information about the compose run", "FILE" },
   { "no-parent", 0, 0, G_OPTION_ARG_NONE, &opt_no_parent, "Always commit without a parent", NULL },
   { "parent", 0, 0, G_OPTION_ARG_STRING, &opt_parent, "Commit with specific parent", "REV" },
+  { "ex-static-delta", 0, 0, G_OPTION_ARG_NONE, &opt_static_delta, "Generate a static delta from the previous commit", NULL },
   { NULL }
 };
 
@@ -212,6 +216,118 @@ inputhash_from_commit (OstreeRepo *repo,
   return TRUE;
 }
 
+/* Where we remember the last solve for this ref; see compute_solve_cache_key() */
+static char *
+solve_cache_path (RpmOstreeTreeComposeContext *self)
+{
+  g_autofree char *ref_checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA256, self->ref, -1);
+  return g_strconcat ("solve-cache/", ref_checksum, ".gv", NULL);
+}
+
+static void
+checksum_file_contents (GChecksum  *checksum,
+                        const char *path)
+{
+  g_autofree char *contents = NULL;
+  gsize len = 0;
+  /* Missing files just hash as empty; their absence is part of the state too */
+  if (path && g_file_get_contents (path, &contents, &len, NULL))
+    g_checksum_update (checksum, (const guint8*)contents, len);
+  g_checksum_update (checksum, (const guint8*)"", 1);
+}
+
+/* The input hash is derived from the treefile and the result of depsolving.
+ * Since depsolving is deterministic, hashing what goes into it instead tells us
+ * whether we'd end up with the same input hash without actually solving: the
+ * treespec (packages, excludes, etc...), the rpm-md of the enabled repos, and
+ * any lockfiles.
+ */
+static gboolean
+compute_solve_cache_key (RpmOstreeTreeComposeContext *self,
+                         char                       **out_key,
+                         GError                     **error)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (const guint8*)PACKAGE_VERSION, strlen (PACKAGE_VERSION) + 1);
+
+  auto tf_checksum = (*self->treefile_rs)->get_checksum(*self->repo);
+  g_checksum_update (checksum, (const guint8*)tf_checksum.data(), tf_checksum.size());
+
+  g_autoptr(GVariant) spec = g_variant_ref_sink (rpmostree_treespec_to_variant (self->treespec));
+  g_checksum_update (checksum, (const guint8*)g_variant_get_data (spec), g_variant_get_size (spec));
+
+  DnfContext *dnfctx = rpmostree_context_get_dnf (self->corectx);
+  const char *basearch = dnf_context_get_base_arch (dnfctx);
+  g_checksum_update (checksum, (const guint8*)basearch, strlen (basearch) + 1);
+  g_autoptr(GPtrArray) rpmmd_repos =
+    rpmostree_get_enabled_rpmmd_repos (dnfctx, DNF_REPO_ENABLED_PACKAGES);
+  for (guint i = 0; i < rpmmd_repos->len; i++)
+    {
+      auto repo = static_cast<DnfRepo *>(rpmmd_repos->pdata[i]);
+      const char *id = dnf_repo_get_id (repo);
+      g_checksum_update (checksum, (const guint8*)id, strlen (id) + 1);
+      /* The .repo file may e.g. exclude packages */
+      checksum_file_contents (checksum, dnf_repo_get_filename (repo));
+      g_autofree char *repomd = g_build_filename (dnf_repo_get_location (repo),
+                                                  "repodata/repomd.xml", NULL);
+      checksum_file_contents (checksum, repomd);
+    }
+
+  for (char **it = opt_lockfiles; it && *it; it++)
+    checksum_file_contents (checksum, *it);
+  g_checksum_update (checksum, (const guint8*)&opt_lockfile_strict, sizeof (opt_lockfile_strict));
+
+  *out_key = g_strdup (g_checksum_get_string (checksum));
+  return TRUE;
+}
+
+/* Returns the input hash we computed the last time we solved from @key, if any */
+static gboolean
+solve_cache_lookup (RpmOstreeTreeComposeContext *self,
+                    const char                  *key,
+                    char                       **out_inputhash,
+                    GError                     **error)
+{
+  *out_inputhash = NULL;
+  g_autofree char *path = solve_cache_path (self);
+  glnx_autofd int fd = -1;
+  g_autoptr(GError) local_error = NULL;
+  if (!glnx_openat_rdonly (self->cachedir_dfd, path, TRUE, &fd, &local_error))
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        return g_propagate_error (error, util::move_nullify (local_error)), FALSE;
+      return TRUE; /* Note early return */
+    }
+  g_autoptr(GBytes) bytes = glnx_fd_readall_bytes (fd, NULL, error);
+  if (!bytes)
+    return FALSE;
+  g_autoptr(GVariant) entry =
+    g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(ss)"), bytes, FALSE));
+  const char *cached_key = NULL;
+  const char *inputhash = NULL;
+  g_variant_get (entry, "(&s&s)", &cached_key, &inputhash);
+  if (g_str_equal (cached_key, key))
+    *out_inputhash = g_strdup (inputhash);
+  return TRUE;
+}
+
+static gboolean
+solve_cache_store (RpmOstreeTreeComposeContext *self,
+                   const char                  *key,
+                   const char                  *inputhash,
+                   GCancellable                *cancellable,
+                   GError                     **error)
+{
+  g_autofree char *path = solve_cache_path (self);
+  if (!glnx_shutil_mkdir_p_at (self->cachedir_dfd, "solve-cache", 0755, cancellable, error))
+    return FALSE;
+  g_autoptr(GVariant) entry = g_variant_ref_sink (g_variant_new ("(ss)", key, inputhash));
+  return glnx_file_replace_contents_at (self->cachedir_dfd, path,
+                                        static_cast<const guint8*>(g_variant_get_data (entry)),
+                                        g_variant_get_size (entry),
+                                        GLNX_FILE_REPLACE_NODATASYNC, cancellable, error);
+}
+
 static gboolean
 try_load_previous_sepolicy (RpmOstreeTreeComposeContext *self,
                             GCancellable                 *cancellable,
@@ -352,6 +468,10 @@ install_packages (RpmOstreeTreeComposeContext  *self,
         }
 
       rpmostree_context_set_repos (self->corectx, self->build_repo, self->pkgcache_repo);
+      /* Coordinating with other composes only makes sense if we import; with
+       * --download-only-rpms, we need all the RPMs ourselves. */
+      if (opt_shared_pkgcache && !opt_download_only_rpms)
+        rpmostree_context_set_pkgcache_shared (self->corectx);
     }
   else
     {
@@ -365,6 +485,37 @@ install_packages (RpmOstreeTreeComposeContext  *self,
         }
     }
 
+  /* If nothing that goes into solving changed since the last time we built
+   * this ref, we can tell it's unmodified without solving at all; see
+   * compute_solve_cache_key().  This needs a persistent --cachedir. */
+  g_autofree char *previous_inputhash = NULL;
+  if (self->previous_checksum && out_unmodified != NULL)
+    {
+      if (!inputhash_from_commit (self->repo, self->previous_checksum,
+                                  &previous_inputhash, error))
+        return FALSE;
+    }
+  g_autofree char *solve_cache_key = NULL;
+  if (opt_cachedir && self->ref && !opt_write_lockfile_to)
+    {
+      if (!rpmostree_context_download_metadata (self->corectx,
+                                                DNF_CONTEXT_SETUP_SACK_FLAG_LOAD_UPDATEINFO,
+                                                cancellable, error))
+        return FALSE;
+      if (!compute_solve_cache_key (self, &solve_cache_key, error))
+        return FALSE;
+      g_autofree char *cached_inputhash = NULL;
+      if (previous_inputhash &&
+          !solve_cache_lookup (self, solve_cache_key, &cached_inputhash, error))
+        return FALSE;
+      if (cached_inputhash && g_str_equal (cached_inputhash, previous_inputhash))
+        {
+          g_print ("Input state hash: %s (solve cached)\n", cached_inputhash);
+          *out_unmodified = TRUE;
+          return TRUE; /* NB: early return */
+        }
+    }
+
   if (!rpmostree_context_prepare (self->corectx, cancellable, error))
     return FALSE;
 
@@ -392,14 +543,13 @@ install_packages (RpmOstreeTreeComposeContext  *self,
 
   g_print ("Input state hash: %s\n", ret_new_inputhash);
 
+  if (solve_cache_key &&
+      !solve_cache_store (self, solve_cache_key, ret_new_inputhash, cancellable, error))
+    return FALSE;
+
   /* Only look for previous checksum if caller has passed *out_unmodified */
   if (self->previous_checksum && out_unmodified != NULL)
     {
-      g_autofree char *previous_inputhash = NULL;
-      if (!inputhash_from_commit (self->repo, self->previous_checksum,
-                                  &previous_inputhash, error))
-        return FALSE;
-
       if (previous_inputhash)
         {
           if (strcmp (previous_inputhash, ret_new_inputhash) == 0)
@@ -603,6 +753,8 @@ rpm_ostree_compose_context_new (const char    *treefile_pathstr,
 
       if (opt_workdir)
         g_printerr ("note: --workdir is ignored for --unified-core\n");
+      if (opt_shared_pkgcache && !opt_cachedir)
+        return glnx_throw (error, "--ex-shared-pkgcache requires --cachedir");
 
       if (opt_cachedir)
         {
@@ -641,11 +793,31 @@ rpm_ostree_compose_context_new (const char    *treefile_pathstr,
             return glnx_throw_errno_prefix (error, "fcntl");
         }
 
-      self->pkgcache_repo = ostree_repo_create_at (self->cachedir_dfd, "pkgcache-repo",
-                                                   OSTREE_REPO_MODE_BARE_USER, NULL,
-                                                   cancellable, error);
-      if (!self->pkgcache_repo)
-        return FALSE;
+      if (opt_shared_pkgcache)
+        {
+          self->pkgcache_repo = ostree_repo_create_at (AT_FDCWD, opt_shared_pkgcache,
+                                                       OSTREE_REPO_MODE_BARE_USER, NULL,
+                                                       cancellable, error);
+          if (!self->pkgcache_repo)
+            return glnx_prefix_error (error, "Opening shared pkgcache");
+
+          /* Same reasoning as for ignoring --workdir above */
+          struct stat pkgcache_stbuf, cachedir_stbuf;
+          if (!glnx_fstat (ostree_repo_get_dfd (self->pkgcache_repo), &pkgcache_stbuf, error))
+            return FALSE;
+          if (!glnx_fstat (self->cachedir_dfd, &cachedir_stbuf, error))
+            return FALSE;
+          if (pkgcache_stbuf.st_dev != cachedir_stbuf.st_dev)
+            return glnx_throw (error, "--ex-shared-pkgcache must be on the same filesystem as the cachedir");
+        }
+      else
+        {
+          self->pkgcache_repo = ostree_repo_create_at (self->cachedir_dfd, "pkgcache-repo",
+                                                       OSTREE_REPO_MODE_BARE_USER, NULL,
+                                                       cancellable, error);
+          if (!self->pkgcache_repo)
+            return FALSE;
+        }
 
       /* We use a temporary repo for building and committing on the same FS as the
        * pkgcache to guarantee links and devino caching. We then pull-local into the "real"
@@ -661,6 +833,9 @@ rpm_ostree_compose_context_new (const char    *treefile_pathstr,
     }
   else
     {
+      if (opt_shared_pkgcache)
+        return glnx_throw (error, "--ex-shared-pkgcache requires --unified-core");
+
       if (!opt_workdir)
         {
           if (!glnx_mkdtempat (AT_FDCWD, "/var/tmp/rpm-ostree.XXXXXX", 0700, &self->workdir_tmp, error))
@@ -997,46 +1172,45 @@ impl_install_tree (RpmOstreeTreeComposeContext *self,
   return TRUE;
 }
 
-/* See canonical version of this in ot-builtin-pull.c */
-static void
-noninteractive_console_progress_changed (OstreeAsyncProgress *progress,
-                                         gpointer             user_data)
-{
-  /* We do nothing here - we just want the final status */
-}
-
+/* Move @rev from one of our repos into the other; both are local, so we don't
+ * need ostree_repo_pull() and its fetcher, just to hardlink what's missing.
+ */
 static gboolean
 pull_local_into_target_repo (OstreeRepo   *src_repo,
                              OstreeRepo   *dest_repo,
-                             const char   *checksum,
+                             const char   *rev,
                              GCancellable *cancellable,
                              GError      **error)
 {
-  const char *refs[] = { checksum, NULL };
-
-  /* really should enhance the pull API so we can just pass the src OstreeRepo directly */
-  g_autofree char *src_repo_uri =
-    g_strdup_printf ("file:///proc/self/fd/%d", ostree_repo_get_dfd (src_repo));
-
-  g_auto(GLnxConsoleRef) console = { 0, };
-  glnx_console_lock (&console);
-  g_autoptr(OstreeAsyncProgress) progress = ostree_async_progress_new_and_connect (
-      console.is_tty ? ostree_repo_pull_default_console_progress_changed
-                     : noninteractive_console_progress_changed, &console);
-
-  /* no fancy flags here, so just use the old school simpler API */
-  if (!ostree_repo_pull (dest_repo, src_repo_uri, (char**)refs, static_cast<OstreeRepoPullFlags>(0), progress,
-                         cancellable, error))
-    return FALSE;
-
-  if (!console.is_tty)
-    {
-      const char *status = ostree_async_progress_get_status (progress);
-      if (status)
-        g_print ("%s\n", status);
-    }
-  ostree_async_progress_finish (progress);
+  g_autofree char *msg = g_strdup_printf ("Importing %s", rev);
+  auto task = rpmostreecxx::progress_begin_task(msg);
+  guint n_transferred = 0;
+  if (!rpmostree_repo_transfer_commit (src_repo, dest_repo, rev, FALSE, &n_transferred,
+                                       cancellable, error))
+    return glnx_prefix_error (error, "Importing %s", rev);
+  g_autofree char *done_msg = g_strdup_printf ("%u objects", n_transferred);
+  task->end(done_msg);
+  return TRUE;
+}
 
+/* Generate a static delta from @from to @to, with libostree's default
+ * parameters.  Note this doesn't tailor the delta to the package diff:
+ * ostree_repo_static_delta_generate() takes no list of candidate objects and
+ * does its own scheduling, so there's nothing package-level to hand it.
+ */
+static gboolean
+generate_static_delta (RpmOstreeTreeComposeContext *self,
+                       const char                  *from,
+                       const char                  *to,
+                       GCancellable                *cancellable,
+                       GError                     **error)
+{
+  g_autoptr(GVariant) params = g_variant_ref_sink (g_variant_new ("a{sv}", NULL));
+  auto task = rpmostreecxx::progress_begin_task("Generating static delta");
+  if (!ostree_repo_static_delta_generate (self->repo, OSTREE_STATIC_DELTA_GENERATE_OPT_MAJOR,
+                                          from, to, NULL, params, cancellable, error))
+    return glnx_prefix_error (error, "Generating static delta %s-%s", from, to);
+  task->end("");
   return TRUE;
 }
 
@@ -1159,6 +1333,15 @@ impl_commit_tree (RpmOstreeTreeComposeContext *self,
   else
     g_print ("Wrote commit: %s\n", new_revision);
 
+  if (opt_static_delta)
+    {
+      if (!self->previous_checksum)
+        g_print ("No previous commit; not generating a static delta\n");
+      else if (!generate_static_delta (self, self->previous_checksum, new_revision,
+                                       cancellable, error))
+        return FALSE;
+    }
+
   if (!rpmostree_composeutil_write_composejson (self->repo,
                                                 opt_write_composejson_to, statsp,
                                                 new_revision, new_commit,
@@ -137,11 +137,13 @@ add_package_refs_to_set (RpmOstreeRefSack *rsack,
 
 /* Loop over all deployments, gathering all referenced NEVRAs for
  * layered packages.  Then delete any cached pkg refs that aren't in
- * that set.
+ * that set, except for those the retention policy lets us keep; see
+ * pkgcache.rs.
  */
 static gboolean
 generate_pkgcache_refs (OstreeSysroot            *sysroot,
                         OstreeRepo               *repo,
+                        guint64                   retention_size,
                         guint                    *out_n_freed,
                         GCancellable             *cancellable,
                         GError                  **error)
@@ -201,12 +203,19 @@ generate_pkgcache_refs (OstreeSysroot            *sysroot,
   if (!ostree_repo_list_refs_ext (repo, "rpmostree/pkg", &pkg_refs,
                                   OSTREE_REPO_LIST_REFS_EXT_NONE, cancellable, error))
     return FALSE;
-  GLNX_HASH_TABLE_FOREACH (pkg_refs, const char*, ref)
+  rust::Vec<rpmostreecxx::StringMapping> all_refs;
+  GLNX_HASH_TABLE_FOREACH_KV (pkg_refs, const char*, ref, const char*, rev)
+    all_refs.push_back(rpmostreecxx::StringMapping{ref, rev});
+  rust::Vec<rust::String> referenced;
+  GLNX_HASH_TABLE_FOREACH (referenced_pkgs, const char*, ref)
+    referenced.push_back(std::string(ref));
+
+  auto to_free =
+    rpmostreecxx::pkgcache_retention_prune (*repo, ostree_repo_get_dfd (repo), all_refs,
+                                            referenced, retention_size);
+  for (auto & ref : to_free)
     {
-      if (g_hash_table_contains (referenced_pkgs, ref))
-        continue;
-
-      ostree_repo_transaction_set_ref (repo, NULL, ref, NULL);
+      ostree_repo_transaction_set_ref (repo, NULL, ref.c_str(), NULL);
       n_freed++;
     }
 
@@ -214,10 +223,105 @@ generate_pkgcache_refs (OstreeSysroot            *sysroot,
   return TRUE;
 }
 
+/* Load the state written when preparing an update (see
+ * rpmostree_sysroot_upgrader_prepare()); sets @out_prepared to %NULL if there
+ * is none.
+ */
+gboolean
+rpmostree_syscore_load_prepared (GVariant **out_prepared,
+                                 GError   **error)
+{
+  *out_prepared = NULL;
+
+  glnx_autofd int fd = -1;
+  g_autoptr(GError) local_error = NULL;
+  if (!glnx_openat_rdonly (AT_FDCWD, RPMOSTREE_PREPARED_UPDATE_FILE, TRUE, &fd,
+                           &local_error))
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        return g_propagate_error (error, util::move_nullify (local_error)), FALSE;
+      return TRUE; /* Note early return */
+    }
+
+  struct stat stbuf;
+  if (!glnx_fstat (fd, &stbuf, error))
+    return FALSE;
+  if (!rpmostree_check_size_within_limit (stbuf.st_size, OSTREE_MAX_METADATA_SIZE,
+                                          RPMOSTREE_PREPARED_UPDATE_FILE, error))
+    return FALSE;
+
+  g_autoptr(GBytes) data = glnx_fd_readall_bytes (fd, NULL, error);
+  if (!data)
+    return FALSE;
+
+  *out_prepared =
+    g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT, data, FALSE));
+  return TRUE;
+}
+
+/* Drop refs to prepared layered commits which are no longer what the state
+ * file describes, e.g. because it was consumed by a deployment, replaced by a
+ * newer one, or wiped by `cleanup -m`.
+ */
+static gboolean
+generate_prepared_refs (OstreeRepo               *repo,
+                        GCancellable             *cancellable,
+                        GError                  **error)
+{
+  g_autoptr(GHashTable) refs = NULL;
+  if (!ostree_repo_list_refs_ext (repo, RPMOSTREE_PREPARED_REF_PREFIX, &refs,
+                                  OSTREE_REPO_LIST_REFS_EXT_NONE, cancellable, error))
+    return FALSE;
+  if (g_hash_table_size (refs) == 0)
+    return TRUE; /* Note early return */
+
+  g_autoptr(GVariant) prepared = NULL;
+  if (!rpmostree_syscore_load_prepared (&prepared, error))
+    return FALSE;
+  g_autofree char *keep_ref = NULL;
+  g_autofree char *keep_rev = NULL;
+  if (prepared)
+    {
+      g_auto(GVariantDict) dict;
+      g_variant_dict_init (&dict, prepared);
+      const char *osname = NULL;
+      g_variant_dict_lookup (&dict, "revision", "s", &keep_rev);
+      if (g_variant_dict_lookup (&dict, "osname", "&s", &osname))
+        keep_ref = g_strconcat (RPMOSTREE_PREPARED_REF_PREFIX "/", osname, NULL);
+    }
+
+  GLNX_HASH_TABLE_FOREACH_KV (refs, const char*, ref, const char*, rev)
+    {
+      if (g_strcmp0 (ref, keep_ref) == 0 && g_strcmp0 (rev, keep_rev) == 0)
+        continue;
+      ostree_repo_transaction_set_ref (repo, NULL, ref, NULL);
+    }
+
+  return TRUE;
+}
+
+/* The relabeled ostree layers are only used when composing (see
+ * relabel_ostree_layer()), so none of them are needed here.
+ */
+static gboolean
+generate_layer_refs (OstreeRepo               *repo,
+                     GCancellable             *cancellable,
+                     GError                  **error)
+{
+  g_autoptr(GHashTable) refs = NULL;
+  if (!ostree_repo_list_refs_ext (repo, RPMOSTREE_RELABELED_LAYER_PREFIX, &refs,
+                                  OSTREE_REPO_LIST_REFS_EXT_NONE, cancellable, error))
+    return FALSE;
+  GLNX_HASH_TABLE_FOREACH (refs, const char*, ref)
+    ostree_repo_transaction_set_ref (repo, NULL, ref, NULL);
+  return TRUE;
+}
+
 /* Regenerate base and pkgcache refs */
 static gboolean
 syscore_regenerate_refs (OstreeSysroot            *sysroot,
                          OstreeRepo               *repo,
+                         guint64                   pkgcache_retention_size,
                          guint                    *out_n_pkgcache_freed,
                          GCancellable             *cancellable,
                          GError                  **error)
@@ -234,7 +338,14 @@ syscore_regenerate_refs (OstreeSysroot            *sysroot,
     return FALSE;
 
   /* And the pkgcache refs */
-  if (!generate_pkgcache_refs (sysroot, repo, out_n_pkgcache_freed, cancellable, error))
+  if (!generate_pkgcache_refs (sysroot, repo, pkgcache_retention_size, out_n_pkgcache_freed,
+                               cancellable, error))
+    return FALSE;
+
+  if (!generate_prepared_refs (repo, cancellable, error))
+    return FALSE;
+
+  if (!generate_layer_refs (repo, cancellable, error))
     return FALSE;
 
   /* Delete our temporary ref */
@@ -247,11 +358,13 @@ syscore_regenerate_refs (OstreeSysroot            *sysroot,
 }
 
 /* Clean up to match the current deployments. This used to be a private static,
- * but is now used by the cleanup txn.
+ * but is now used by the cleanup txn.  Unreferenced pkgcache branches are kept
+ * up to @pkgcache_retention_size bytes; see pkgcache.rs.
  */
 gboolean
 rpmostree_syscore_cleanup (OstreeSysroot            *sysroot,
                            OstreeRepo               *repo,
+                           guint64                   pkgcache_retention_size,
                            GCancellable             *cancellable,
                            GError                  **error)
 {
@@ -266,12 +379,15 @@ rpmostree_syscore_cleanup (OstreeSysroot            *sysroot,
   if (!glnx_shutil_rm_rf_at (repo_dfd, RPMOSTREE_TMP_ROOTFS_DIR,
                              cancellable, error))
     return glnx_prefix_error (error, "cleaning tmp rootfs");
+  if (!glnx_shutil_rm_rf_at (repo_dfd, RPMOSTREE_TMP_CHECKPOINT_DIR,
+                             cancellable, error))
+    return glnx_prefix_error (error, "cleaning assembly checkpoint");
   /* also delete extra history entries */
   rpmostreecxx::history_prune();
 
   /* Regenerate all refs */
   guint n_pkgcache_freed = 0;
-  if (!syscore_regenerate_refs (sysroot, repo, &n_pkgcache_freed,
+  if (!syscore_regenerate_refs (sysroot, repo, pkgcache_retention_size, &n_pkgcache_freed,
                                 cancellable, error))
     return FALSE;
 
@@ -396,6 +512,7 @@ rpmostree_syscore_write_deployment (OstreeSysroot           *sysroot,
                                     OstreeDeployment        *new_deployment,
                                     OstreeDeployment        *merge_deployment,
                                     gboolean                 pushing_rollback,
+                                    guint64                  pkgcache_retention_size,
                                     GCancellable            *cancellable,
                                     GError                 **error)
 {
@@ -424,7 +541,7 @@ rpmostree_syscore_write_deployment (OstreeSysroot           *sysroot,
                                                merge_deployment, flags, cancellable, error))
     return FALSE;
 
-  if (!rpmostree_syscore_cleanup (sysroot, repo, cancellable, error))
+  if (!rpmostree_syscore_cleanup (sysroot, repo, pkgcache_retention_size, cancellable, error))
     return FALSE;
 
   return TRUE;
@@ -26,10 +26,15 @@ G_BEGIN_DECLS
 
 /* Used by the upgrader to hold a strong ref temporarily to a base commit */
 #define RPMOSTREE_TMP_BASE_REF "rpmostree/base/tmp"
+/* Holds a strong ref to a prepared layered commit (see RPMOSTREE_PREPARED_UPDATE_FILE);
+ * suffixed by the osname */
+#define RPMOSTREE_PREPARED_REF_PREFIX "rpmostree/prepared"
 /* Diretory that is defined to have 0700 mode always, used for checkouts */
 #define RPMOSTREE_TMP_PRIVATE_DIR "extensions/rpmostree/private"
 /* Where we check out a new rootfs */
 #define RPMOSTREE_TMP_ROOTFS_DIR RPMOSTREE_TMP_PRIVATE_DIR "/commit"
+/* Snapshot of the assembled rootfs, to resume from if we get interrupted */
+#define RPMOSTREE_TMP_CHECKPOINT_DIR RPMOSTREE_TMP_PRIVATE_DIR "/checkpoint"
 /* The legacy dir, which we will just delete if we find it */
 #define RPMOSTREE_OLD_TMP_ROOTFS_DIR "extensions/rpmostree/commit"
 
@@ -40,9 +45,14 @@ G_BEGIN_DECLS
 gboolean
 rpmostree_syscore_cleanup (OstreeSysroot            *sysroot,
                            OstreeRepo               *repo,
+                           guint64                   pkgcache_retention_size,
                            GCancellable             *cancellable,
                            GError                  **error);
 
+gboolean
+rpmostree_syscore_load_prepared (GVariant                **out_prepared,
+                                 GError                  **error);
+
 OstreeDeployment *rpmostree_syscore_get_origin_merge_deployment (OstreeSysroot *self, const char *osname);
 
 gboolean rpmostree_syscore_bump_mtime (OstreeSysroot *self, GError **error);
@@ -56,6 +66,7 @@ gboolean rpmostree_syscore_write_deployment (OstreeSysroot           *sysroot,
                                              OstreeDeployment        *new_deployment,
                                              OstreeDeployment        *merge_deployment,
                                              gboolean                 pushing_rollback,
+                                             guint64                  pkgcache_retention_size,
                                              GCancellable            *cancellable,
                                              GError                 **error);
 
@@ -91,8 +91,12 @@ struct RpmOstreeSysrootUpgrader {
   gboolean pkgs_imported; /* Whether pkgs to be layered have been downloaded & imported */
   char *base_revision; /* Non-layered replicated commit */
   char *final_revision; /* Computed by layering; if NULL, only using base_revision */
+  char *state_sha512; /* Checksum of the layering state, once prepped */
+  gboolean prepared_used; /* Whether final_revision was assembled by _prepare() earlier */
+  gboolean assembled_reused; /* Whether final_revision was assembled earlier; implied by prepared_used */
 
   char **kargs_strv; /* Kernel argument list to be written into deployment  */
+  guint64 pkgcache_retention_size; /* See rpmostree_syscore_cleanup() */
 };
 
 enum {
@@ -155,6 +159,9 @@ rpmostree_sysroot_upgrader_initable_init (GInitable        *initable,
   if (!ostree_sysroot_get_repo (self->sysroot, &self->repo, cancellable, error))
     return FALSE;
 
+  self->pkgcache_retention_size =
+    rpmostreed_get_pkgcache_retention_size (rpmostreed_daemon_get ());
+
   self->cfg_merge_deployment =
     ostree_sysroot_get_merge_deployment (self->sysroot, self->osname);
   self->origin_merge_deployment =
@@ -222,6 +229,7 @@ rpmostree_sysroot_upgrader_finalize (GObject *object)
   g_clear_pointer (&self->origin, (GDestroyNotify)rpmostree_origin_unref);
   g_free (self->base_revision);
   g_free (self->final_revision);
+  g_free (self->state_sha512);
   g_strfreev (self->kargs_strv);
   g_clear_pointer (&self->overlay_packages, (GDestroyNotify)g_ptr_array_unref);
   g_clear_pointer (&self->override_remove_packages, (GDestroyNotify)g_ptr_array_unref);
@@ -902,6 +910,137 @@ prepare_context_for_assembly (RpmOstreeSysrootUpgrader *self,
   return TRUE;
 }
 
+/* Covers the inputs of local assembly besides the base commit and the layering
+ * state: the origin (cliwrap, initramfs args, etc...) and the deployment whose
+ * /etc we configure from.
+ */
+static char *
+compute_prepared_origin_checksum (RpmOstreeSysrootUpgrader *self)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_autoptr(GKeyFile) origin = rpmostree_origin_dup_keyfile (self->origin);
+  gsize len;
+  g_autofree char *origin_data = g_key_file_to_data (origin, &len, NULL);
+  g_checksum_update (checksum, (const guint8*)origin_data, len);
+  const char *merge_csum = ostree_deployment_get_csum (self->cfg_merge_deployment);
+  g_checksum_update (checksum, (const guint8*)merge_csum, strlen (merge_csum));
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+/* If rpmostree_sysroot_upgrader_prepare() already assembled a commit for this
+ * exact base and state, use it rather than assembling it all over again.
+ */
+static gboolean
+find_prepared_commit (RpmOstreeSysrootUpgrader *self,
+                      GError                  **error)
+{
+  /* See rpmostree_sysroot_upgrader_prepare() */
+  if (rpmostree_origin_get_regenerate_initramfs (self->origin))
+    return TRUE;
+
+  g_autoptr(GVariant) prepared = NULL;
+  if (!rpmostree_syscore_load_prepared (&prepared, error))
+    return FALSE;
+  if (!prepared)
+    return TRUE;
+
+  g_auto(GVariantDict) dict;
+  g_variant_dict_init (&dict, prepared);
+  const char *osname = NULL;
+  const char *revision = NULL;
+  const char *base_revision = NULL;
+  const char *state_sha512 = NULL;
+  const char *origin_sha256 = NULL;
+  if (!g_variant_dict_lookup (&dict, "osname", "&s", &osname) ||
+      !g_variant_dict_lookup (&dict, "revision", "&s", &revision) ||
+      !g_variant_dict_lookup (&dict, "base-revision", "&s", &base_revision) ||
+      !g_variant_dict_lookup (&dict, "state-sha512", "&s", &state_sha512) ||
+      !g_variant_dict_lookup (&dict, "origin-sha256", "&s", &origin_sha256))
+    return TRUE; /* Just ignore anything we don't understand */
+
+  g_autofree char *origin_checksum = compute_prepared_origin_checksum (self);
+  if (!g_str_equal (osname, self->osname) ||
+      !g_str_equal (base_revision, self->base_revision) ||
+      !g_str_equal (state_sha512, self->state_sha512) ||
+      !g_str_equal (origin_sha256, origin_checksum))
+    return TRUE;
+
+  /* And make sure the commit is still around */
+  g_autofree char *ref = g_strconcat (RPMOSTREE_PREPARED_REF_PREFIX "/", self->osname, NULL);
+  g_autofree char *ref_revision = NULL;
+  if (!ostree_repo_resolve_rev_ext (self->repo, ref, TRUE,
+                                    OSTREE_REPO_RESOLVE_REV_EXT_NONE, &ref_revision, error))
+    return FALSE;
+  if (g_strcmp0 (ref_revision, revision) != 0)
+    return TRUE;
+
+  rpmostree_output_message ("Using prepared layered commit: %s", revision);
+  g_free (self->final_revision);
+  self->final_revision = g_strdup (revision);
+  self->prepared_used = TRUE;
+  self->assembled_reused = TRUE;
+  return TRUE;
+}
+
+/* Covers everything the result of perform_local_assembly() depends on.  The
+ * exception is a regenerated initramfs, which depends on the host /etc; we
+ * never reuse those, but still mark them so they aren't reused for an
+ * assembly without one either. */
+static char *
+compute_assembly_checksum (RpmOstreeSysrootUpgrader *self)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (const guint8*)self->base_revision, strlen (self->base_revision) + 1);
+  g_checksum_update (checksum, (const guint8*)self->state_sha512, strlen (self->state_sha512) + 1);
+  const gboolean cliwrap = rpmostree_origin_get_cliwrap (self->origin);
+  g_checksum_update (checksum, (const guint8*)&cliwrap, sizeof (cliwrap));
+  const gboolean regenerate_initramfs = rpmostree_origin_get_regenerate_initramfs (self->origin);
+  g_checksum_update (checksum, (const guint8*)&regenerate_initramfs, sizeof (regenerate_initramfs));
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+/* If one of our deployments is already on a commit assembled from the same
+ * inputs, e.g. because we're redeploying it or rolling forward to it again,
+ * just use that.
+ */
+static gboolean
+find_assembled_commit (RpmOstreeSysrootUpgrader *self,
+                       GError                  **error)
+{
+  /* See compute_assembly_checksum() */
+  if (rpmostree_origin_get_regenerate_initramfs (self->origin))
+    return TRUE;
+
+  g_autofree char *assembly_checksum = compute_assembly_checksum (self);
+  g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (self->sysroot);
+  for (guint i = 0; i < deployments->len; i++)
+    {
+      auto deployment = static_cast<OstreeDeployment*>(deployments->pdata[i]);
+      if (!g_str_equal (ostree_deployment_get_osname (deployment), self->osname))
+        continue;
+
+      const char *csum = ostree_deployment_get_csum (deployment);
+      g_autoptr(GVariant) commit = NULL;
+      if (!ostree_repo_load_commit (self->repo, csum, &commit, NULL, error))
+        return FALSE;
+      g_autoptr(GVariant) metadata = g_variant_get_child_value (commit, 0);
+      g_autoptr(GVariantDict) metadata_dict = g_variant_dict_new (metadata);
+      const char *commit_assembly_checksum = NULL;
+      if (!g_variant_dict_lookup (metadata_dict, "rpmostree.assembly-sha256", "&s",
+                                  &commit_assembly_checksum) ||
+          !g_str_equal (commit_assembly_checksum, assembly_checksum))
+        continue;
+
+      rpmostree_output_message ("Reusing assembled layered commit: %s", csum);
+      g_free (self->final_revision);
+      self->final_revision = g_strdup (csum);
+      self->assembled_reused = TRUE;
+      return TRUE;
+    }
+
+  return TRUE;
+}
+
 /* Initialize libdnf context from our configuration */
 static gboolean
 prep_local_assembly (RpmOstreeSysrootUpgrader *self,
@@ -969,6 +1108,9 @@ prep_local_assembly (RpmOstreeSysrootUpgrader *self,
         rpmostree_print_transaction (rpmostree_context_get_dnf (self->ctx));
     }
 
+  if (!rpmostree_context_get_state_sha512 (self->ctx, &self->state_sha512, error))
+    return FALSE;
+
   /* If the current state has layering, compare the depsolved set for changes. */
   if (self->final_revision)
     {
@@ -986,20 +1128,86 @@ prep_local_assembly (RpmOstreeSysrootUpgrader *self,
       if (!previous_sha512_v)
         return FALSE;
       const char *previous_state_sha512 = g_variant_get_string (previous_sha512_v, NULL);
-      g_autofree char *new_state_sha512 = NULL;
-      if (!rpmostree_context_get_state_sha512 (self->ctx, &new_state_sha512, error))
-        return FALSE;
-
-      self->layering_changed = strcmp (previous_state_sha512, new_state_sha512) != 0;
+      self->layering_changed = strcmp (previous_state_sha512, self->state_sha512) != 0;
     }
   else
     /* Otherwise, we're transitioning from not-layered to layered, so it
        definitely changed */
     self->layering_changed = TRUE;
 
+  if (!(self->flags & RPMOSTREE_SYSROOT_UPGRADER_FLAGS_DRY_RUN))
+    {
+      if (!find_prepared_commit (self, error))
+        return FALSE;
+      if (!self->assembled_reused && !find_assembled_commit (self, error))
+        return FALSE;
+    }
+
   return TRUE;
 }
 
+/* Assembly only depends on the base and the layering state; the rest of
+ * perform_local_assembly() happens on top of it. */
+static char *
+assembly_checkpoint_inputs (RpmOstreeSysrootUpgrader *self)
+{
+  g_autofree char *buf = g_strconcat (self->base_revision, ":", self->state_sha512, NULL);
+  return g_compute_checksum_for_string (G_CHECKSUM_SHA256, buf, -1);
+}
+
+/* If a previous assembly from the same inputs got interrupted after the
+ * packages were assembled, replace our fresh checkout with its result.  We
+ * can't skip that checkout: the inputs include the depsolve, which reads the
+ * base rpmdb from it. */
+static gboolean
+try_resume_from_checkpoint (RpmOstreeSysrootUpgrader *self,
+                            gboolean                 *out_resumed,
+                            GCancellable             *cancellable,
+                            GError                  **error)
+{
+  int repo_dfd = ostree_repo_get_dfd (self->repo); /* borrowed */
+  g_autofree char *inputs = assembly_checkpoint_inputs (self);
+  auto checkpoint = rpmostreecxx::assembly_checkpoint_find (repo_dfd, RPMOSTREE_TMP_CHECKPOINT_DIR,
+                                                            inputs);
+  if (!checkpoint.found)
+    {
+      *out_resumed = FALSE;
+      return TRUE;
+    }
+
+  auto task = rpmostreecxx::progress_begin_task("Resuming from checkpoint of assembled tree");
+  glnx_close_fd (&self->tmprootfs_dfd);
+  if (!glnx_shutil_rm_rf_at (repo_dfd, RPMOSTREE_TMP_ROOTFS_DIR, cancellable, error))
+    return FALSE;
+  rpmostreecxx::assembly_checkpoint_restore (repo_dfd, RPMOSTREE_TMP_CHECKPOINT_DIR,
+                                             RPMOSTREE_TMP_ROOTFS_DIR);
+  if (!glnx_opendirat (repo_dfd, RPMOSTREE_TMP_ROOTFS_DIR, FALSE,
+                       &self->tmprootfs_dfd, error))
+    return FALSE;
+  rpmostree_context_set_tmprootfs_dfd (self->ctx, self->tmprootfs_dfd);
+  rpmostree_context_set_kernel_changed (self->ctx, checkpoint.kernel_changed);
+
+  *out_resumed = TRUE;
+  return TRUE;
+}
+
+/* This is purely an optimization for the next attempt, so failing to save a
+ * checkpoint isn't fatal. */
+static void
+save_assembly_checkpoint (RpmOstreeSysrootUpgrader *self)
+{
+  int repo_dfd = ostree_repo_get_dfd (self->repo); /* borrowed */
+  g_autofree char *inputs = assembly_checkpoint_inputs (self);
+  try {
+    rpmostreecxx::assembly_checkpoint_save (repo_dfd, RPMOSTREE_TMP_ROOTFS_DIR,
+                                            RPMOSTREE_TMP_CHECKPOINT_DIR, inputs,
+                                            rpmostree_context_get_kernel_changed (self->ctx));
+    sd_journal_print (LOG_INFO, "Checkpointed assembled tree");
+  } catch (std::exception& e) {
+    sd_journal_print (LOG_WARNING, "Failed to checkpoint assembled tree: %s", e.what());
+  }
+}
+
 /* Overlay pkgs, run scripts, and commit final rootfs to ostree */
 static gboolean
 perform_local_assembly (RpmOstreeSysrootUpgrader *self,
@@ -1013,6 +1221,15 @@ perform_local_assembly (RpmOstreeSysrootUpgrader *self,
   if (self->layering_type == RPMOSTREE_SYSROOT_UPGRADER_LAYERING_NONE)
     return TRUE;
 
+  /* Same if it was already done for us; see find_prepared_commit() and
+   * find_assembled_commit() */
+  if (self->assembled_reused)
+    {
+      g_clear_object (&self->ctx);
+      glnx_close_fd (&self->tmprootfs_dfd);
+      return TRUE;
+    }
+
   rpmostree_context_set_devino_cache (self->ctx, self->devino_cache);
   rpmostree_context_set_tmprootfs_dfd (self->ctx, self->tmprootfs_dfd);
 
@@ -1020,9 +1237,21 @@ perform_local_assembly (RpmOstreeSysrootUpgrader *self,
     {
       g_clear_pointer (&self->final_revision, g_free);
 
-      /* --- override/overlay --- */
-      if (!rpmostree_context_assemble (self->ctx, cancellable, error))
+      gboolean resumed = FALSE;
+      if (!try_resume_from_checkpoint (self, &resumed, cancellable, error))
         return FALSE;
+
+      /* --- override/overlay --- */
+      if (!resumed)
+        {
+          if (!rpmostree_context_assemble (self->ctx, cancellable, error))
+            return FALSE;
+          /* Only worth it if we're about to spend a while in dracut; the
+           * rest is cheap enough to just redo along with the assembly. */
+          if (rpmostree_context_get_kernel_changed (self->ctx) ||
+              rpmostree_origin_get_regenerate_initramfs (self->origin))
+            save_assembly_checkpoint (self);
+        }
     }
 
   // TODO Unify with treefile origin handling in core
@@ -1126,11 +1355,18 @@ perform_local_assembly (RpmOstreeSysrootUpgrader *self,
         return glnx_prefix_error (error, "Finalizing kernel");
     }
 
+  g_autofree char *assembly_checksum = compute_assembly_checksum (self);
+  rpmostree_context_set_assembly_checksum (self->ctx, assembly_checksum);
   if (!rpmostree_context_commit (self->ctx, self->base_revision,
                                  RPMOSTREE_ASSEMBLE_TYPE_CLIENT_LAYERING,
                                  &self->final_revision, cancellable, error))
     return glnx_prefix_error (error, "Committing");
 
+  /* We won't need to resume anymore */
+  if (!glnx_shutil_rm_rf_at (ostree_repo_get_dfd (self->repo), RPMOSTREE_TMP_CHECKPOINT_DIR,
+                             cancellable, error))
+    return FALSE;
+
   /* Ensure we aren't holding any references to the tmpdir now that we're done;
    * rpmostree_sysroot_upgrader_deploy() eventually calls
    * rpmostree_syscore_cleanup() which deletes 🗑 the tmpdir.  See also similar
@@ -1223,6 +1459,10 @@ rpmostree_sysroot_upgrader_import_pkgs (RpmOstreeSysrootUpgrader *self,
   if (self->layering_type == RPMOSTREE_SYSROOT_UPGRADER_LAYERING_NONE)
     return TRUE;
 
+  /* the prepared or reused commit already has everything */
+  if (self->assembled_reused)
+    return TRUE;
+
   if (self->layering_type == RPMOSTREE_SYSROOT_UPGRADER_LAYERING_RPMMD_REPOS)
     {
       if (!rpmostree_context_download (self->ctx, cancellable, error))
@@ -1234,6 +1474,83 @@ rpmostree_sysroot_upgrader_import_pkgs (RpmOstreeSysrootUpgrader *self,
   return TRUE;
 }
 
+/**
+ * rpmostree_sysroot_upgrader_prepare:
+ * @self: Self
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Like rpmostree_sysroot_upgrader_deploy(), but stop once the final commit has
+ * been assembled.  The commit is remembered, so that a later deploy with the
+ * same base and layering state can use it as is.
+ */
+gboolean
+rpmostree_sysroot_upgrader_prepare (RpmOstreeSysrootUpgrader *self,
+                                    GCancellable             *cancellable,
+                                    GError                  **error)
+{
+  g_assert (!(self->flags & RPMOSTREE_SYSROOT_UPGRADER_FLAGS_DRY_RUN));
+
+  if (!self->layering_initialized)
+    {
+      RpmOstreeSysrootUpgraderLayeringType layering_type;
+      gboolean layering_changed = FALSE;
+      if (!rpmostree_sysroot_upgrader_prep_layering (self, &layering_type, &layering_changed,
+                                                     cancellable, error))
+        return FALSE;
+    }
+
+  /* Nothing to assemble, or already done */
+  if (self->layering_type == RPMOSTREE_SYSROOT_UPGRADER_LAYERING_NONE || self->assembled_reused)
+    return TRUE;
+
+  /* dracut would pick up the host /etc as it is *now*; it may well change before
+   * the update is actually deployed. */
+  if (rpmostree_origin_get_regenerate_initramfs (self->origin))
+    {
+      rpmostree_output_message ("Initramfs regeneration enabled; not preparing layered commit");
+      return TRUE;
+    }
+
+  if (!self->pkgs_imported)
+    {
+      if (!rpmostree_sysroot_upgrader_import_pkgs (self, cancellable, error))
+        return FALSE;
+    }
+
+  if (!perform_local_assembly (self, cancellable, error))
+    return FALSE;
+  g_assert (self->final_revision);
+
+  /* Keep it alive until it's deployed or superseded; see generate_prepared_refs() */
+  g_autofree char *ref = g_strconcat (RPMOSTREE_PREPARED_REF_PREFIX "/", self->osname, NULL);
+  if (!ostree_repo_set_ref_immediate (self->repo, NULL, ref, self->final_revision,
+                                      cancellable, error))
+    return FALSE;
+
+  g_autofree char *origin_checksum = compute_prepared_origin_checksum (self);
+  g_auto(GVariantDict) dict;
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "osname", "s", self->osname);
+  g_variant_dict_insert (&dict, "revision", "s", self->final_revision);
+  g_variant_dict_insert (&dict, "base-revision", "s", self->base_revision);
+  g_variant_dict_insert (&dict, "state-sha512", "s", self->state_sha512);
+  g_variant_dict_insert (&dict, "origin-sha256", "s", origin_checksum);
+  g_autoptr(GVariant) prepared = g_variant_ref_sink (g_variant_dict_end (&dict));
+
+  if (!glnx_shutil_mkdir_p_at (AT_FDCWD,
+                               dirname (strdupa (RPMOSTREE_PREPARED_UPDATE_FILE)),
+                               0775, cancellable, error))
+    return FALSE;
+  if (!glnx_file_replace_contents_at (AT_FDCWD, RPMOSTREE_PREPARED_UPDATE_FILE,
+                                      static_cast<const guint8*>(g_variant_get_data (prepared)),
+                                      g_variant_get_size (prepared),
+                                      static_cast<GLnxFileReplaceFlags>(0), cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
 /**
  * rpmostree_sysroot_upgrader_set_kargs:
  * @self: Self
@@ -1257,7 +1574,7 @@ write_history (RpmOstreeSysrootUpgrader *self,
 {
   g_autoptr(GVariant) deployment_variant =
     rpmostreed_deployment_generate_variant (self->sysroot, new_deployment, NULL,
-                                            self->repo, FALSE, error);
+                                            self->repo, NULL, FALSE, error);
   if (!deployment_variant)
     return FALSE;
 
@@ -1448,6 +1765,15 @@ rpmostree_sysroot_upgrader_deploy (RpmOstreeSysrootUpgrader *self,
   if (!write_history (self, new_deployment, cancellable, error))
     return FALSE;
 
+  /* The deployment holds on to the prepared commit now; forget about it so that
+   * the cleanup below drops its ref. */
+  if (self->prepared_used)
+    {
+      if (!glnx_shutil_rm_rf_at (AT_FDCWD, RPMOSTREE_PREPARED_UPDATE_FILE,
+                                 cancellable, error))
+        return FALSE;
+    }
+
   /* Also do a sanitycheck even if there's no local mutation; it's basically free
    * and might save someone in the future.  The RPMOSTREE_SKIP_SANITYCHECK
    * environment variable is just used by test-basic.sh currently.
@@ -1484,13 +1810,15 @@ rpmostree_sysroot_upgrader_deploy (RpmOstreeSysrootUpgrader *self,
        * do the prune.  The stage_tree() API above should have loaded our new deployment
        * into the set.
        */
-      if (!rpmostree_syscore_cleanup (self->sysroot, self->repo, cancellable, error))
+      if (!rpmostree_syscore_cleanup (self->sysroot, self->repo, self->pkgcache_retention_size,
+                                      cancellable, error))
         return FALSE;
     }
   else
     {
       if (!rpmostree_syscore_write_deployment (self->sysroot, new_deployment,
                                                self->cfg_merge_deployment, FALSE,
+                                               self->pkgcache_retention_size,
                                                cancellable, error))
         return FALSE;
     }
@@ -32,7 +32,6 @@
 
 #define RPMOSTREE_MESSAGE_TRANSACTION_STARTED SD_ID128_MAKE(d5,be,a3,7a,8f,c8,4f,f5,9d,bc,fd,79,17,7b,7d,f8)
 
-#define RPMOSTREED_CONF SYSCONFDIR "/rpm-ostreed.conf"
 #define DAEMON_CONFIG_GROUP "Daemon"
 #define EXPERIMENTAL_CONFIG_GROUP "Experimental"
 
@@ -71,9 +70,16 @@ struct _RpmostreedDaemon {
   /* Settings from the config file */
   guint idle_exit_timeout;
   RpmostreedAutomaticUpdatePolicy auto_update_policy;
+  guint64 pkgcache_retention_size;
+  guint64 background_cpu_weight;
+  guint64 background_io_weight;
+  guint64 background_memory_high;
+  guint64 background_cpu_quota;
 
   GDBusConnection *connection;
   GDBusObjectManagerServer *object_manager;
+  /* Set while exporting; see rpmostreed_daemon_is_publishing() */
+  gboolean publishing;
 };
 
 struct _RpmostreedDaemonClass {
@@ -381,6 +387,36 @@ rpmostreed_get_automatic_update_policy (RpmostreedDaemon *self)
   return self->auto_update_policy;
 }
 
+guint64
+rpmostreed_get_pkgcache_retention_size (RpmostreedDaemon *self)
+{
+  return self->pkgcache_retention_size;
+}
+
+guint64
+rpmostreed_get_background_cpu_weight (RpmostreedDaemon *self)
+{
+  return self->background_cpu_weight;
+}
+
+guint64
+rpmostreed_get_background_io_weight (RpmostreedDaemon *self)
+{
+  return self->background_io_weight;
+}
+
+guint64
+rpmostreed_get_background_memory_high (RpmostreedDaemon *self)
+{
+  return self->background_memory_high;
+}
+
+guint64
+rpmostreed_get_background_cpu_quota (RpmostreedDaemon *self)
+{
+  return self->background_cpu_quota;
+}
+
 /* in-place version of g_ascii_strdown */
 static inline void
 ascii_strdown_inplace (char *str)
@@ -416,9 +452,25 @@ rpmostreed_daemon_reload_config (RpmostreedDaemon *self,
         return FALSE;
     }
 
-  /* don't update changed for this; it's contained to RpmostreedDaemon so no other objects
-   * need to be reloaded if it changes */
+  /* default to keeping only pkgcache branches referenced by a deployment */
+  guint64 pkgcache_retention_size = get_config_uint64 (config, "PkgcacheRetentionSize", 0);
+
+  /* default to running background transactions like any other; see governor.rs */
+  guint64 background_cpu_weight = get_config_uint64 (config, "BackgroundCPUWeight", 0);
+  guint64 background_io_weight = get_config_uint64 (config, "BackgroundIOWeight", 0);
+  guint64 background_memory_high = get_config_uint64 (config, "BackgroundMemoryHigh", 0);
+  guint64 background_cpu_quota = get_config_uint64 (config, "BackgroundCPUQuota", 0);
+  if (background_cpu_weight > 10000 || background_io_weight > 10000)
+    return glnx_throw (error, "BackgroundCPUWeight and BackgroundIOWeight must be at most 10000");
+
+  /* don't update changed for these; they're contained to RpmostreedDaemon so no other
+   * objects need to be reloaded if they change */
   self->idle_exit_timeout = idle_exit_timeout;
+  self->pkgcache_retention_size = pkgcache_retention_size;
+  self->background_cpu_weight = background_cpu_weight;
+  self->background_io_weight = background_io_weight;
+  self->background_memory_high = background_memory_high;
+  self->background_cpu_quota = background_cpu_quota;
 
   gboolean changed = FALSE;
 
@@ -871,6 +923,7 @@ rpmostreed_daemon_publish (RpmostreedDaemon *self,
         object = owned_object = g_dbus_object_skeleton_new (path);
       (void)owned_object; /* Pacify static analysis */
 
+      self->publishing = TRUE;
       g_dbus_object_skeleton_add_interface (object, (GDBusInterfaceSkeleton*)iface);
     }
   else
@@ -883,6 +936,15 @@ rpmostreed_daemon_publish (RpmostreedDaemon *self,
     g_dbus_object_manager_server_export_uniquely (self->object_manager, object);
   else
     g_dbus_object_manager_server_export (self->object_manager, object);
+  self->publishing = FALSE;
+}
+
+/* Whether rpmostreed_daemon_publish() is in progress.  Exporting emits
+ * InterfacesAdded, which reads the properties of the new interfaces. */
+gboolean
+rpmostreed_daemon_is_publishing (RpmostreedDaemon *self)
+{
+  return self->publishing;
 }
 
 void
@@ -20,6 +20,7 @@
 
 #include "rpmostreed-types.h"
 #include "rpmostree-util.h"
+#include "rpmostree-paths.h"
 
 G_BEGIN_DECLS
 
@@ -31,7 +32,6 @@ G_BEGIN_DECLS
 #define BASE_DBUS_PATH "/org/projectatomic/rpmostree1"
 
 /* Update driver info */
-#define RPMOSTREE_RUN_DIR "/run/rpm-ostree/"
 #define RPMOSTREE_DRIVER_STATE RPMOSTREE_RUN_DIR "update-driver.gv"
 #define RPMOSTREE_DRIVER_SD_UNIT "driver-sd-unit"
 #define RPMOSTREE_DRIVER_NAME "driver-name"
@@ -64,6 +64,7 @@ void               rpmostreed_daemon_publish        (RpmostreedDaemon *self,
 void               rpmostreed_daemon_unpublish      (RpmostreedDaemon *self,
                                                      const gchar *path,
                                                      gpointer thing);
+gboolean           rpmostreed_daemon_is_publishing  (RpmostreedDaemon *self);
 gboolean           rpmostreed_daemon_reload_config  (RpmostreedDaemon *self,
                                                      gboolean         *out_changed,
                                                      GError          **error);
@@ -71,4 +72,19 @@ gboolean           rpmostreed_daemon_reload_config  (RpmostreedDaemon *self,
 RpmostreedAutomaticUpdatePolicy
 rpmostreed_get_automatic_update_policy (RpmostreedDaemon *self);
 
+guint64
+rpmostreed_get_pkgcache_retention_size (RpmostreedDaemon *self);
+
+guint64
+rpmostreed_get_background_cpu_weight (RpmostreedDaemon *self);
+
+guint64
+rpmostreed_get_background_io_weight (RpmostreedDaemon *self);
+
+guint64
+rpmostreed_get_background_memory_high (RpmostreedDaemon *self);
+
+guint64
+rpmostreed_get_background_cpu_quota (RpmostreedDaemon *self);
+
 G_END_DECLS
@@ -98,6 +98,259 @@ rpmostreed_deployment_get_for_index (OstreeSysroot *sysroot,
   return (OstreeDeployment*)g_object_ref (deployments->pdata[deployment_index]);
 }
 
+/* Verifying signatures is the most expensive part of generating the deployment
+ * variants, and we redo it for every deployment whenever the sysroot changes.
+ * So results are cached, keyed on everything that goes into them: the commit,
+ * its detached metadata, and the keyrings trusted for the remote.  Revoking a
+ * key means changing the keyring, so the only way a cached result can go
+ * stale is if one of the signatures or keys expires; we check for that from
+ * the expiry timestamps in the result itself.  The cache is persisted so that
+ * a restarted daemon doesn't have to verify everything again.
+ */
+#define GPG_VERIFY_CACHE_FILE RPMOSTREE_CORE_CACHEDIR "gpg-verify-cache.gv"
+#define GPG_VERIFY_CACHE_MAX_ENTRIES 64
+
+/* Deployment variants are generated both from the main thread and from
+ * transaction threads, so the cache state below is under this lock.
+ */
+G_LOCK_DEFINE_STATIC (gpg_verify_cache);
+/* Maps cache key to (verification time, signatures) */
+static GHashTable *gpg_verify_cache;
+/* Whether there are entries not written out yet; see
+ * rpmostreed_deployment_gpg_verify_cache_flush() */
+static gboolean gpg_verify_cache_dirty;
+
+static void
+checksum_update_stat (GChecksum   *checksum,
+                      struct stat *stbuf)
+{
+  const guint64 vals[] = { stbuf->st_dev, stbuf->st_ino, (guint64)stbuf->st_size,
+                           (guint64)stbuf->st_mtim.tv_sec, (guint64)stbuf->st_mtim.tv_nsec };
+  g_checksum_update (checksum, (const guchar*)vals, sizeof (vals));
+}
+
+/* Fold in the identity of the keyring file at @path, or of all the keyrings in it if
+ * it's a directory; we don't need to read them to notice they changed.
+ */
+static gboolean
+checksum_update_keyring_path (GChecksum  *checksum,
+                              int         dfd,
+                              const char *path,
+                              GError    **error)
+{
+  g_checksum_update (checksum, (const guchar*)path, strlen (path) + 1);
+  struct stat stbuf;
+  if (!glnx_fstatat_allow_noent (dfd, path, &stbuf, 0, error))
+    return FALSE;
+  if (errno == ENOENT)
+    return TRUE;
+  checksum_update_stat (checksum, &stbuf);
+  if (!S_ISDIR (stbuf.st_mode))
+    return TRUE;
+
+  g_auto(GLnxDirFdIterator) dfd_iter = { FALSE, };
+  if (!glnx_dirfd_iterator_init_at (dfd, path, TRUE, &dfd_iter, error))
+    return FALSE;
+  g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func (g_free);
+  while (TRUE)
+    {
+      struct dirent *dent = NULL;
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, NULL, error))
+        return FALSE;
+      if (!dent)
+        break;
+      g_ptr_array_add (names, g_strdup (dent->d_name));
+    }
+  g_ptr_array_sort (names, rpmostree_ptrarray_sort_compare_strings);
+  for (guint i = 0; i < names->len; i++)
+    {
+      auto name = static_cast<const char *>(names->pdata[i]);
+      if (!glnx_fstatat (dfd_iter.fd, name, &stbuf, 0, error))
+        return FALSE;
+      g_checksum_update (checksum, (const guchar*)name, strlen (name) + 1);
+      checksum_update_stat (checksum, &stbuf);
+    }
+  return TRUE;
+}
+
+static char *
+gpg_verify_cache_key (OstreeRepo  *repo,
+                      const char  *remote,
+                      const char  *checksum,
+                      GError     **error)
+{
+  g_autoptr(GChecksum) key = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (key, (const guchar*)checksum, strlen (checksum) + 1);
+  g_checksum_update (key, (const guchar*)remote, strlen (remote) + 1);
+
+  g_autoptr(GVariant) detached = NULL;
+  if (!ostree_repo_read_commit_detached_metadata (repo, checksum, &detached, NULL, error))
+    return NULL;
+  if (detached)
+    g_checksum_update (key, static_cast<const guchar*>(g_variant_get_data (detached)),
+                       g_variant_get_size (detached));
+
+  /* These are the keyrings libostree looks at for a remote */
+  g_autofree char *remote_keyring = g_strconcat (remote, ".trustedkeys.gpg", NULL);
+  if (!checksum_update_keyring_path (key, ostree_repo_get_dfd (repo), remote_keyring, error))
+    return NULL;
+  g_auto(GStrv) gpgkeypath = NULL;
+  if (!ostree_repo_get_remote_list_option (repo, remote, "gpgkeypath", &gpgkeypath, error))
+    return NULL;
+  for (char **it = gpgkeypath; it && *it; it++)
+    {
+      if (!checksum_update_keyring_path (key, AT_FDCWD, *it, error))
+        return NULL;
+    }
+  if (!checksum_update_keyring_path (key, AT_FDCWD, DATADIR "/ostree/trusted.gpg.d", error))
+    return NULL;
+
+  return g_strdup (g_checksum_get_string (key));
+}
+
+static gboolean
+gpg_verify_cache_load (GHashTable *cache,
+                       GError    **error)
+{
+  glnx_autofd int fd = -1;
+  g_autoptr(GError) local_error = NULL;
+  if (!glnx_openat_rdonly (AT_FDCWD, GPG_VERIFY_CACHE_FILE, TRUE, &fd, &local_error))
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        return g_propagate_error (error, util::move_nullify (local_error)), FALSE;
+      return TRUE; /* Note early return */
+    }
+
+  struct stat stbuf;
+  if (!glnx_fstat (fd, &stbuf, error))
+    return FALSE;
+  if (!rpmostree_check_size_within_limit (stbuf.st_size, OSTREE_MAX_METADATA_SIZE,
+                                          GPG_VERIFY_CACHE_FILE, error))
+    return FALSE;
+  g_autoptr(GBytes) data = glnx_fd_readall_bytes (fd, NULL, error);
+  if (!data)
+    return FALSE;
+
+  g_autoptr(GVariant) cache_v =
+    g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("a{s(xav)}"), data, FALSE));
+  GVariantIter iter;
+  g_variant_iter_init (&iter, cache_v);
+  const char *key;
+  GVariant *entry;
+  while (g_variant_iter_next (&iter, "{&s@(xav)}", &key, &entry))
+    g_hash_table_replace (cache, g_strdup (key), entry);
+  return TRUE;
+}
+
+/* Must be called with the gpg_verify_cache lock held */
+static GHashTable *
+gpg_verify_cache_get (void)
+{
+  if (gpg_verify_cache)
+    return gpg_verify_cache;
+
+  gpg_verify_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify)g_variant_unref);
+  g_autoptr(GError) local_error = NULL;
+  if (!gpg_verify_cache_load (gpg_verify_cache, &local_error))
+    sd_journal_print (LOG_WARNING, "Failed to load %s: %s", GPG_VERIFY_CACHE_FILE,
+                      local_error->message);
+  return gpg_verify_cache;
+}
+
+static gint
+compare_key_verify_time (gconstpointer a,
+                         gconstpointer b,
+                         gpointer      data)
+{
+  auto cache = static_cast<GHashTable*>(data);
+  auto entry_a = static_cast<GVariant*>(g_hash_table_lookup (cache, *(const char**)a));
+  auto entry_b = static_cast<GVariant*>(g_hash_table_lookup (cache, *(const char**)b));
+  gint64 time_a, time_b;
+  g_variant_get_child (entry_a, 0, "x", &time_a);
+  g_variant_get_child (entry_b, 0, "x", &time_b);
+  return (time_a > time_b) - (time_a < time_b);
+}
+
+/* Write out the signature verification cache if it gained entries since the
+ * last time.  Misses only update it in memory, so this is called once per
+ * batch of deployment variants, e.g. after loading the sysroot or at the end
+ * of a transaction.  This is just a cache, so failing to write it out isn't
+ * fatal.
+ */
+void
+rpmostreed_deployment_gpg_verify_cache_flush (void)
+{
+  G_LOCK (gpg_verify_cache);
+  if (!gpg_verify_cache_dirty)
+    {
+      G_UNLOCK (gpg_verify_cache);
+      return;
+    }
+  gpg_verify_cache_dirty = FALSE;
+  GHashTable *cache = gpg_verify_cache;
+
+  /* Keep it bounded, dropping the entries verified the longest ago */
+  if (g_hash_table_size (cache) > GPG_VERIFY_CACHE_MAX_ENTRIES)
+    {
+      g_autoptr(GPtrArray) keys = g_ptr_array_new_with_free_func (g_free);
+      GLNX_HASH_TABLE_FOREACH (cache, const char*, key)
+        g_ptr_array_add (keys, g_strdup (key));
+      g_ptr_array_sort_with_data (keys, compare_key_verify_time, cache);
+      for (guint i = 0; i < keys->len - GPG_VERIFY_CACHE_MAX_ENTRIES; i++)
+        g_hash_table_remove (cache, keys->pdata[i]);
+    }
+
+  g_auto(GVariantBuilder) builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(xav)}"));
+  GLNX_HASH_TABLE_FOREACH_KV (cache, const char*, key, GVariant*, entry)
+    g_variant_builder_add (&builder, "{s@(xav)}", key, entry);
+  g_autoptr(GVariant) cache_v = g_variant_ref_sink (g_variant_builder_end (&builder));
+  G_UNLOCK (gpg_verify_cache);
+
+  /* NB: concurrent flushes could write out of order, but each one writes a
+   * consistent snapshot, and any entry lost that way just gets verified again. */
+  g_autoptr(GError) local_error = NULL;
+  if (!glnx_shutil_mkdir_p_at (AT_FDCWD, dirname (strdupa (GPG_VERIFY_CACHE_FILE)),
+                               0775, NULL, &local_error) ||
+      !glnx_file_replace_contents_at (AT_FDCWD, GPG_VERIFY_CACHE_FILE,
+                                      static_cast<const guint8*>(g_variant_get_data (cache_v)),
+                                      g_variant_get_size (cache_v),
+                                      static_cast<GLnxFileReplaceFlags>(0), NULL, &local_error))
+    sd_journal_print (LOG_WARNING, "Failed to write %s: %s", GPG_VERIFY_CACHE_FILE,
+                      local_error->message);
+}
+
+/* Whether none of the signatures or keys in @entry expired since it was verified. */
+static gboolean
+gpg_verify_cache_entry_is_current (GVariant *entry,
+                                   gint64    now)
+{
+  gint64 verified = 0;
+  g_autoptr(GVariant) sigs = NULL;
+  g_variant_get (entry, "(x@av)", &verified, &sigs);
+  if (now < verified)
+    return FALSE; /* the clock went backwards; don't trust anything */
+
+  const guint exp_attrs[] = { OSTREE_GPG_SIGNATURE_ATTR_EXP_TIMESTAMP,
+                              OSTREE_GPG_SIGNATURE_ATTR_KEY_EXP_TIMESTAMP,
+                              OSTREE_GPG_SIGNATURE_ATTR_KEY_EXP_TIMESTAMP_PRIMARY };
+  const guint n_sigs = g_variant_n_children (sigs);
+  for (guint i = 0; i < n_sigs; i++)
+    {
+      g_autoptr(GVariant) sig_v = g_variant_get_child_value (sigs, i);
+      g_autoptr(GVariant) sig = g_variant_get_variant (sig_v);
+      for (guint j = 0; j < G_N_ELEMENTS (exp_attrs); j++)
+        {
+          gint64 exp = 0;
+          g_variant_get_child (sig, exp_attrs[j], "x", &exp);
+          if (exp > verified && exp <= now)
+            return FALSE;
+        }
+    }
+  return TRUE;
+}
+
 static gboolean
 variant_add_remote_status (OstreeRepo  *repo,
                            const gchar *origin_refspec,
@@ -133,6 +386,23 @@ variant_add_remote_status (OstreeRepo  *repo,
   if (!gpg_verify)
     return TRUE; /* Note early return; no need to verify signatures! */
 
+  g_autofree char *cache_key = gpg_verify_cache_key (repo, remote, checksum, error);
+  if (!cache_key)
+    return FALSE;
+  const gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  g_autoptr(GVariant) cached = NULL;
+  G_LOCK (gpg_verify_cache);
+  auto entry = static_cast<GVariant*>(g_hash_table_lookup (gpg_verify_cache_get (), cache_key));
+  if (entry)
+    cached = g_variant_ref (entry);
+  G_UNLOCK (gpg_verify_cache);
+  if (cached && gpg_verify_cache_entry_is_current (cached, now))
+    {
+      g_autoptr(GVariant) sigs = g_variant_get_child_value (cached, 1);
+      g_variant_dict_insert_value (dict, "signatures", sigs);
+      return TRUE; /* Note early return */
+    }
+
   g_autoptr(OstreeGpgVerifyResult) verify_result =
     ostree_repo_verify_commit_for_remote (repo, checksum, remote, NULL, NULL);
   if (!verify_result)
@@ -150,7 +420,15 @@ variant_add_remote_status (OstreeRepo  *repo,
   for (guint i = 0; i < n_sigs; i++)
     g_variant_builder_add (&builder, "v", ostree_gpg_verify_result_get_all (verify_result, i));
 
-  g_variant_dict_insert_value (dict, "signatures", g_variant_builder_end (&builder));
+  g_autoptr(GVariant) sigs = g_variant_ref_sink (g_variant_builder_end (&builder));
+  g_variant_dict_insert_value (dict, "signatures", sigs);
+
+  /* We don't cache failures; they're rare, and could be transient */
+  G_LOCK (gpg_verify_cache);
+  g_hash_table_replace (gpg_verify_cache_get (), util::move_nullify (cache_key),
+                        g_variant_ref_sink (g_variant_new ("(x@av)", now, sigs)));
+  gpg_verify_cache_dirty = TRUE;
+  G_UNLOCK (gpg_verify_cache);
   return TRUE;
 }
 
@@ -224,12 +502,45 @@ filter_commit_meta (GVariant *commit_meta)
   return g_variant_dict_end (&dict);
 }
 
+/* Returns a new table for use with rpmostreed_deployment_generate_variant(). */
+GHashTable *
+rpmostreed_commit_cache_new (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                (GDestroyNotify)g_variant_unref);
+}
+
+/* Load commit @checksum, through @commits if provided. */
+static gboolean
+load_commit_cached (OstreeRepo  *repo,
+                    GHashTable  *commits,
+                    const char  *checksum,
+                    GVariant   **out_commit,
+                    GError     **error)
+{
+  auto cached = commits ? static_cast<GVariant*>(g_hash_table_lookup (commits, checksum)) : NULL;
+  if (cached)
+    {
+      *out_commit = g_variant_ref (cached);
+      return TRUE;
+    }
+  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, checksum, out_commit, error))
+    return FALSE;
+  if (commits)
+    g_hash_table_insert (commits, g_strdup (checksum), g_variant_ref (*out_commit));
+  return TRUE;
+}
 
+/* If provided, @commits (see rpmostreed_commit_cache_new()) is used to share loaded
+ * commits between calls; deployments commonly have the same base, and the same
+ * deployments are generated for both the sysroot and its OS interfaces.
+ */
 GVariant*
 rpmostreed_deployment_generate_variant (OstreeSysroot    *sysroot,
                                         OstreeDeployment *deployment,
                                         const char       *booted_id,
                                         OstreeRepo       *repo,
+                                        GHashTable       *commits,
                                         gboolean          filter,
                                         GError          **error)
 {
@@ -239,11 +550,7 @@ rpmostreed_deployment_generate_variant (OstreeSysroot    *sysroot,
   const gchar *csum = ostree_deployment_get_csum (deployment);
   /* Load the commit object */
   g_autoptr(GVariant) commit = NULL;
-  if (!ostree_repo_load_variant (repo,
-                                 OSTREE_OBJECT_TYPE_COMMIT,
-                                 csum,
-                                 &commit,
-                                 error))
+  if (!load_commit_cached (repo, commits, csum, &commit, error))
     return NULL;
 
   /* And the origin */
@@ -259,17 +566,14 @@ rpmostreed_deployment_generate_variant (OstreeSysroot    *sysroot,
   g_auto(GStrv) layered_pkgs = NULL;
   g_autoptr(GVariant) removed_base_pkgs = NULL;
   g_autoptr(GVariant) replaced_base_pkgs = NULL;
-  if (!rpmostree_deployment_get_layered_info (repo, deployment, &is_layered, NULL,
-                                              &base_checksum, &layered_pkgs,
-                                              &removed_base_pkgs, &replaced_base_pkgs,
-                                              error))
-    return NULL;
+  rpmostree_deployment_get_layered_info_for_commit (deployment, commit, &is_layered, NULL,
+                                                    &base_checksum, &layered_pkgs,
+                                                    &removed_base_pkgs, &replaced_base_pkgs);
 
   g_autoptr(GVariant) base_commit = NULL;
   if (is_layered)
     {
-      if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT,
-                                     base_checksum, &base_commit, error))
+      if (!load_commit_cached (repo, commits, base_checksum, &base_commit, error))
         return NULL;
 
       g_variant_dict_insert (dict, "base-checksum", "s", base_checksum);
@@ -327,9 +631,8 @@ rpmostreed_deployment_generate_variant (OstreeSysroot    *sysroot,
           {
             g_autoptr(GVariant) pending_base_commit = NULL;
 
-            if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT,
-                                           pending_base_commitrev, &pending_base_commit,
-                                           error))
+            if (!load_commit_cached (repo, commits, pending_base_commitrev,
+                                     &pending_base_commit, error))
               return NULL;
 
             g_variant_dict_insert (dict, "pending-base-checksum", "s", pending_base_commitrev);
@@ -37,10 +37,15 @@ OstreeDeployment *
 
 GVariant *      rpmostreed_deployment_generate_blank_variant (void);
 
+void            rpmostreed_deployment_gpg_verify_cache_flush (void);
+
+GHashTable *    rpmostreed_commit_cache_new (void);
+
 GVariant *      rpmostreed_deployment_generate_variant (OstreeSysroot    *sysroot,
                                                         OstreeDeployment *deployment,
                                                         const char       *booted_id,
                                                         OstreeRepo       *repo,
+                                                        GHashTable       *commits,
                                                         gboolean          filter,
                                                         GError          **error);
 
@@ -43,6 +43,9 @@ struct _RpmostreedOS
   RPMOSTreeOSSkeleton parent_instance;
   gboolean on_session_bus;
   guint signal_id;
+  /* Properties are computed on first access or when idle; see os_ensure_loaded() */
+  gboolean loaded;
+  guint load_idle_id;
 };
 
 struct _RpmostreedOSClass
@@ -67,6 +70,50 @@ G_DEFINE_TYPE_WITH_CODE (RpmostreedOS,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Computing the deployment variants and the cached update is the bulk of the
+ * work of setting up an OS interface.  So that a freshly started daemon can
+ * answer calls sooner, the interface is exported right away and its properties
+ * filled in on first access over D-Bus, or once the daemon is idle so that
+ * ObjectManager clients get them via PropertiesChanged.
+ */
+static void
+os_ensure_loaded (RpmostreedOS *self)
+{
+  if (self->load_idle_id > 0)
+    {
+      g_source_remove (self->load_idle_id);
+      self->load_idle_id = 0;
+    }
+  if (self->loaded)
+    return;
+  self->loaded = TRUE;
+
+  g_autoptr(GError) local_error = NULL;
+  if (!rpmostreed_os_load_internals (self, &local_error))
+    g_warning ("%s", local_error->message);
+}
+
+static gboolean
+os_load_via_idle (gpointer user_data)
+{
+  RpmostreedOS *self = RPMOSTREED_OS (user_data);
+  self->load_idle_id = 0;
+  os_ensure_loaded (self);
+  return FALSE;
+}
+
+static void
+os_load_on_access (GDBusInterfaceSkeleton *skeleton)
+{
+  os_ensure_loaded (RPMOSTREED_OS (skeleton));
+}
+
+gboolean
+rpmostreed_os_is_loaded (RPMOSTreeOS *os)
+{
+  return RPMOSTREED_OS (os)->loaded;
+}
+
 static void
 sysroot_changed (RpmostreedSysroot *sysroot,
                  gpointer user_data)
@@ -75,6 +122,10 @@ sysroot_changed (RpmostreedSysroot *sysroot,
   g_autoptr(GError) local_error = NULL;
   GError **error = &local_error;
 
+  /* The pending load will pick up the new state */
+  if (!self->loaded)
+    return;
+
   if (!rpmostreed_os_load_internals (self, error))
       goto out;
 
@@ -278,6 +329,10 @@ os_dispose (GObject *object)
 
   self->signal_id = 0;
 
+  if (self->load_idle_id > 0)
+    g_source_remove (self->load_idle_id);
+  self->load_idle_id = 0;
+
   G_OBJECT_CLASS (rpmostreed_os_parent_class)->dispose (object);
 }
 
@@ -304,6 +359,7 @@ rpmostreed_os_class_init (RpmostreedOSClass *klass)
 
   gdbus_interface_skeleton_class = G_DBUS_INTERFACE_SKELETON_CLASS (klass);
   gdbus_interface_skeleton_class->g_authorize_method = os_authorize_method;
+  rpmostreed_skeleton_class_load_on_access (gdbus_interface_skeleton_class, os_load_on_access);
 }
 
 static void
@@ -793,6 +849,11 @@ os_handle_automatic_update_trigger (RPMOSTreeOS *interface,
       break;
     case RPMOSTREED_AUTOMATIC_UPDATE_POLICY_STAGE:
       break;
+    case RPMOSTREED_AUTOMATIC_UPDATE_POLICY_PREPARE:
+      dfault = static_cast<RpmOstreeTransactionDeployFlags>(
+        RPMOSTREE_TRANSACTION_DEPLOY_FLAG_DOWNLOAD_ONLY |
+        RPMOSTREE_TRANSACTION_DEPLOY_FLAG_PREPARE_ONLY);
+      break;
     default:
       g_assert_not_reached ();
     }
@@ -1763,6 +1824,7 @@ refresh_cached_update (RpmostreedOS *self, GError **error)
 
   rpmostree_os_set_cached_update (RPMOSTREE_OS (self), cached_update);
   rpmostree_os_set_has_cached_update_rpm_diff (RPMOSTREE_OS (self), cached_update != NULL);
+  rpmostreed_sysroot_write_status_snapshot (rpmostreed_sysroot_get ());
   return TRUE;
 }
 
@@ -1774,6 +1836,7 @@ rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
 
   OstreeSysroot *ot_sysroot = rpmostreed_sysroot_get_root (rpmostreed_sysroot_get ());
   OstreeRepo *ot_repo = rpmostreed_sysroot_get_repo (rpmostreed_sysroot_get ());
+  GHashTable *commits = rpmostreed_sysroot_get_commits (rpmostreed_sysroot_get ());
 
   /* Booted */
   g_autofree gchar* booted_id = NULL;
@@ -1784,7 +1847,7 @@ rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
       booted_variant =
         g_variant_ref_sink (
             rpmostreed_deployment_generate_variant (ot_sysroot, booted_deployment,
-                                                    booted_id, ot_repo, TRUE, error));
+                                                    booted_id, ot_repo, commits, TRUE, error));
       if (!booted_variant)
         return FALSE;
       auto bootedid_v = rpmostreecxx::deployment_generate_id(*booted_deployment);
@@ -1806,8 +1869,8 @@ rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
       default_variant =
         g_variant_ref_sink (rpmostreed_deployment_generate_variant (ot_sysroot,
                                                                     pending_deployment,
-                                                                    booted_id,
-                                                                    ot_repo, TRUE, error));
+                                                                    booted_id, ot_repo,
+                                                                    commits, TRUE, error));
       if (!default_variant)
         return FALSE;
     }
@@ -1820,13 +1883,14 @@ rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
     {
       rollback_variant =
         rpmostreed_deployment_generate_variant (ot_sysroot, rollback_deployment, booted_id,
-                                                ot_repo, TRUE, error);
+                                                ot_repo, commits, TRUE, error);
       if (!rollback_variant)
         return FALSE;
     }
   else
     rollback_variant = rpmostreed_deployment_generate_blank_variant ();
   rpmostree_os_set_rollback_deployment (RPMOSTREE_OS (self), rollback_variant);
+  rpmostreed_deployment_gpg_verify_cache_flush ();
 
   if (!refresh_cached_update (self, error))
     return FALSE;
@@ -1881,11 +1945,8 @@ rpmostreed_os_new (OstreeSysroot *sysroot,
 
   auto obj = (RpmostreedOS *)g_object_new (RPMOSTREED_TYPE_OS, "name", name, NULL);
 
-  /* FIXME - use GInitable */
-  { g_autoptr(GError) local_error = NULL;
-    if (!rpmostreed_os_load_internals (obj, &local_error))
-      g_warning ("%s", local_error->message);
-  }
+  /* See os_ensure_loaded() */
+  obj->load_idle_id = g_idle_add_full (G_PRIORITY_LOW, os_load_via_idle, obj, NULL);
 
   rpmostreed_daemon_publish (rpmostreed_daemon_get (), path, FALSE, obj);
 
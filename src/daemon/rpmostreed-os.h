@@ -33,4 +33,5 @@ GType             rpmostreed_os_get_type           (void) G_GNUC_CONST;
 RPMOSTreeOS *     rpmostreed_os_new                (OstreeSysroot *sysroot,
                                                     OstreeRepo *repo,
                                                     const char *name);
+gboolean          rpmostreed_os_is_loaded          (RPMOSTreeOS *os);
 G_END_DECLS
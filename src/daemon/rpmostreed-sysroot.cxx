@@ -23,6 +23,8 @@
 #include "rpmostreed-sysroot.h"
 #include "rpmostreed-os.h"
 #include "rpmostreed-os-experimental.h"
+#include "rpmostree-core.h"
+#include "rpmostree-paths.h"
 #include "rpmostree-util.h"
 #include "rpmostreed-utils.h"
 #include "rpmostreed-deployment-utils.h"
@@ -76,6 +78,16 @@ struct _RpmostreedSysroot {
 
   GHashTable *os_interfaces;
   GHashTable *osexperimental_interfaces;
+  /* Commits of the current deployments; see rpmostreed_deployment_generate_variant() */
+  GHashTable *commits;
+  /* Mtimes the loaded state corresponds to; see rpmostreed_sysroot_write_status_snapshot() */
+  GVariant *deploy_stamp;
+  GVariant *repo_stamp;
+  GVariant *config_stamp;
+  /* The Deployments property is computed on first access or when idle; see
+   * sysroot_ensure_deployments_loaded() */
+  gboolean deployments_loaded;
+  guint deployments_idle_id;
 
   GFileMonitor *monitor;
   guint sig_changed;
@@ -232,6 +244,96 @@ handle_get_os (RPMOSTreeSysroot *object,
   return TRUE;
 }
 
+/* Takes ownership of the stamps */
+static void
+set_stamps (RpmostreedSysroot *self,
+            GVariant          *deploy_stamp,
+            GVariant          *repo_stamp)
+{
+  g_clear_pointer (&self->deploy_stamp, g_variant_unref);
+  g_clear_pointer (&self->repo_stamp, g_variant_unref);
+  self->deploy_stamp = deploy_stamp;
+  self->repo_stamp = repo_stamp;
+}
+
+static gboolean
+sysroot_load_deployments (RpmostreedSysroot *self,
+                          GError           **error)
+{
+  g_autofree gchar *booted_id = NULL;
+  OstreeDeployment *booted = ostree_sysroot_get_booted_deployment (self->ot_sysroot);
+  if (booted)
+    {
+      auto bootedid_v = rpmostreecxx::deployment_generate_id(*booted);
+      booted_id = g_strdup(bootedid_v.c_str());
+    }
+
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+  g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (self->ot_sysroot);
+  for (guint i = 0; deployments != NULL && i < deployments->len; i++)
+    {
+      auto deployment = static_cast<OstreeDeployment *>(deployments->pdata[i]);
+      GVariant *variant =
+        rpmostreed_deployment_generate_variant (self->ot_sysroot, deployment,
+                                                booted_id, self->repo, self->commits,
+                                                TRUE, error);
+      if (!variant)
+        {
+          g_variant_builder_clear (&builder);
+          return glnx_prefix_error (error, "Reading deployment %u", i);
+        }
+      g_variant_builder_add_value (&builder, variant);
+    }
+
+  rpmostree_sysroot_set_deployments (RPMOSTREE_SYSROOT (self),
+                                     g_variant_builder_end (&builder));
+  rpmostreed_deployment_gpg_verify_cache_flush ();
+  g_dbus_interface_skeleton_flush (G_DBUS_INTERFACE_SKELETON (self));
+  return TRUE;
+}
+
+/* Like the OS interfaces (see os_ensure_loaded()), the variants of all the
+ * deployments are only computed once a client asks for them, or once the
+ * daemon is idle.  Populating the sysroot only tracks which OSes exist, until
+ * the first load; after that, it recomputes them directly.
+ */
+static void
+sysroot_ensure_deployments_loaded (RpmostreedSysroot *self)
+{
+  if (self->deployments_idle_id > 0)
+    {
+      g_source_remove (self->deployments_idle_id);
+      self->deployments_idle_id = 0;
+    }
+  if (self->deployments_loaded)
+    return;
+  self->deployments_loaded = TRUE;
+
+  g_autoptr(GError) local_error = NULL;
+  if (!sysroot_load_deployments (self, &local_error))
+    {
+      g_warning ("%s", local_error->message);
+      return;
+    }
+  rpmostreed_sysroot_write_status_snapshot (self);
+}
+
+static gboolean
+sysroot_load_deployments_via_idle (gpointer user_data)
+{
+  RpmostreedSysroot *self = RPMOSTREED_SYSROOT (user_data);
+  self->deployments_idle_id = 0;
+  sysroot_ensure_deployments_loaded (self);
+  return FALSE;
+}
+
+static void
+sysroot_load_on_access (GDBusInterfaceSkeleton *skeleton)
+{
+  sysroot_ensure_deployments_loaded (RPMOSTREED_SYSROOT (skeleton));
+}
+
 static gboolean
 sysroot_populate_deployments_unlocked (RpmostreedSysroot *self,
                                        gboolean *out_changed,
@@ -241,6 +343,17 @@ sysroot_populate_deployments_unlocked (RpmostreedSysroot *self,
   if (out_changed)
     *out_changed = FALSE;
 
+  /* Taken before loading so that a concurrent change makes the status snapshot
+   * look stale rather than fresh */
+  const int sysroot_dfd = ostree_sysroot_get_fd (self->ot_sysroot);
+  g_autoptr(GVariant) deploy_stamp =
+    rpmostree_mtime_stamp (sysroot_dfd, "ostree/deploy", error);
+  if (!deploy_stamp)
+    return FALSE;
+  g_autoptr(GVariant) repo_stamp = rpmostree_mtime_stamp (sysroot_dfd, "ostree/repo", error);
+  if (!repo_stamp)
+    return FALSE;
+
   gboolean sysroot_changed;
   if (!ostree_sysroot_load_if_changed (self->ot_sysroot, &sysroot_changed, NULL, error))
     return FALSE;
@@ -256,46 +369,39 @@ sysroot_populate_deployments_unlocked (RpmostreedSysroot *self,
     self->repo_last_stat = repo_new_stat;
 
   if (!(sysroot_changed || repo_changed))
-    return TRUE; /* Note early return */
+    {
+      set_stamps (self, util::move_nullify (deploy_stamp), util::move_nullify (repo_stamp));
+      return TRUE; /* Note early return */
+    }
 
   g_debug ("loading deployments");
 
-  GVariantBuilder builder;
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+  /* Start afresh so we don't hold on to the commits of deleted deployments */
+  g_clear_pointer (&self->commits, g_hash_table_unref);
+  self->commits = rpmostreed_commit_cache_new ();
 
   g_autoptr(GHashTable) seen_osnames =
     g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
 
   /* Updated booted property; object owned by sysroot */
-  g_autofree gchar *booted_id = NULL;
   OstreeDeployment *booted = ostree_sysroot_get_booted_deployment (self->ot_sysroot);
   if (booted)
     {
       const gchar *os = ostree_deployment_get_osname (booted);
       g_autofree gchar *path = rpmostreed_generate_object_path (BASE_DBUS_PATH, os, NULL);
       rpmostree_sysroot_set_booted (RPMOSTREE_SYSROOT (self), path);
-      auto bootedid_v = rpmostreecxx::deployment_generate_id(*booted);
-      booted_id = g_strdup(bootedid_v.c_str());
     }
   else
     {
       rpmostree_sysroot_set_booted (RPMOSTREE_SYSROOT (self), "/");
     }
 
-  /* Add deployment interfaces */
+  /* Add OS interfaces */
   g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (self->ot_sysroot);
 
   for (guint i = 0; deployments != NULL && i < deployments->len; i++)
     {
       auto deployment = static_cast<OstreeDeployment *>(deployments->pdata[i]);
-      GVariant *variant =
-        rpmostreed_deployment_generate_variant (self->ot_sysroot, deployment,
-                                                booted_id, self->repo, TRUE, error);
-      if (!variant)
-        return glnx_prefix_error (error, "Reading deployment %u", i);
-
-      g_variant_builder_add_value (&builder, variant);
-
       const char *deployment_os = ostree_deployment_get_osname (deployment);
 
       /* Have we not seen this osname instance before?  If so, add it
@@ -328,8 +434,20 @@ sysroot_populate_deployments_unlocked (RpmostreedSysroot *self,
         }
     }
 
-  rpmostree_sysroot_set_deployments (RPMOSTREE_SYSROOT (self),
-                                     g_variant_builder_end (&builder));
+  set_stamps (self, util::move_nullify (deploy_stamp), util::move_nullify (repo_stamp));
+
+  /* Once Deployments has been computed, clients may have it cached.  Update it
+   * right away, so that it's current before we emit UPDATED and before e.g. a
+   * transaction reports completion.  Until then, it's loaded lazily; see
+   * sysroot_ensure_deployments_loaded(). */
+  if (self->deployments_loaded)
+    {
+      if (!sysroot_load_deployments (self, error))
+        return FALSE;
+    }
+  else if (self->deployments_idle_id == 0)
+    self->deployments_idle_id =
+      g_idle_add_full (G_PRIORITY_LOW, sysroot_load_deployments_via_idle, self, NULL);
   g_debug ("finished deployments");
 
   if (out_changed)
@@ -378,6 +496,13 @@ reset_config_properties (RpmostreedSysroot  *self,
 {
   RpmostreedDaemon *daemon = rpmostreed_daemon_get ();
 
+  /* The config was just (re)loaded by the daemon */
+  g_autoptr(GVariant) config_stamp = rpmostree_mtime_stamp (AT_FDCWD, RPMOSTREED_CONF, error);
+  if (!config_stamp)
+    return FALSE;
+  g_clear_pointer (&self->config_stamp, g_variant_unref);
+  self->config_stamp = util::move_nullify (config_stamp);
+
   RpmostreedAutomaticUpdatePolicy policy = rpmostreed_get_automatic_update_policy (daemon);
   const char *policy_str = rpmostree_auto_update_policy_to_str (policy, NULL);
   g_assert (policy_str);
@@ -459,6 +584,7 @@ handle_reload_config (RPMOSTreeSysroot *object,
     g_signal_emit (self, signals[UPDATED], 0);
 
   rpmostree_sysroot_complete_reload_config (object, invocation);
+  rpmostreed_sysroot_write_status_snapshot (self);
 out:
   if (local_error)
     {
@@ -510,6 +636,10 @@ sysroot_dispose (GObject *object)
   g_clear_object (&self->transaction);
   g_clear_object (&self->authority);
 
+  if (self->deployments_idle_id > 0)
+    g_source_remove (self->deployments_idle_id);
+  self->deployments_idle_id = 0;
+
   G_OBJECT_CLASS (rpmostreed_sysroot_parent_class)->dispose (object);
 }
 
@@ -521,6 +651,10 @@ sysroot_finalize (GObject *object)
 
   g_hash_table_unref (self->os_interfaces);
   g_hash_table_unref (self->osexperimental_interfaces);
+  g_clear_pointer (&self->commits, g_hash_table_unref);
+  g_clear_pointer (&self->deploy_stamp, g_variant_unref);
+  g_clear_pointer (&self->repo_stamp, g_variant_unref);
+  g_clear_pointer (&self->config_stamp, g_variant_unref);
 
   g_clear_object (&self->monitor);
 
@@ -665,6 +799,8 @@ rpmostreed_sysroot_class_init (RpmostreedSysrootClass *klass)
 
   gdbus_interface_skeleton_class = G_DBUS_INTERFACE_SKELETON_CLASS (klass);
   gdbus_interface_skeleton_class->g_authorize_method = sysroot_authorize_method;
+  rpmostreed_skeleton_class_load_on_access (gdbus_interface_skeleton_class,
+                                            sysroot_load_on_access);
 }
 
 static gboolean
@@ -686,7 +822,10 @@ sysroot_reload_ostree_configs_and_deployments (RpmostreedSysroot *self,
     *out_changed = did_change;
  out:
   if (ret && did_change)
-    g_signal_emit (self, signals[UPDATED], 0);
+    {
+      g_signal_emit (self, signals[UPDATED], 0);
+      rpmostreed_sysroot_write_status_snapshot (self);
+    }
   return ret;
 }
 
@@ -782,9 +921,81 @@ rpmostreed_sysroot_populate (RpmostreedSysroot *self,
                                             self);
     }
 
+  rpmostreed_sysroot_write_status_snapshot (self);
   return TRUE;
 }
 
+static gboolean
+write_status_snapshot (RpmostreedSysroot *self,
+                       GError           **error)
+{
+  /* Clients only look for the snapshot of the host */
+  const char *sysroot_path = rpmostree_sysroot_get_path (RPMOSTREE_SYSROOT (self));
+  if (self->on_session_bus || !g_str_equal (sysroot_path, SYSROOT_DEFAULT_PATH))
+    return TRUE;
+  /* We'll be called again once the deployments are loaded */
+  if (!self->deployments_loaded)
+    return TRUE;
+  GVariant *deployments = rpmostree_sysroot_get_deployments (RPMOSTREE_SYSROOT (self));
+  if (!deployments || !self->deploy_stamp || !self->config_stamp)
+    return TRUE; /* Not populated yet */
+
+  /* Only the daemon writes the cache, so its current mtime matches the property */
+  g_autoptr(GVariant) cached_update_stamp =
+    rpmostree_mtime_stamp (AT_FDCWD, RPMOSTREE_AUTOUPDATES_CACHE_FILE, error);
+  if (!cached_update_stamp)
+    return FALSE;
+
+  g_auto(GVariantDict) dict;
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "version", "s", PACKAGE_VERSION);
+  g_variant_dict_insert_value (&dict, "stamp",
+                               g_variant_new ("(@(tt)@(tt)@(tt)@(tt))",
+                                              self->deploy_stamp, self->repo_stamp,
+                                              self->config_stamp, cached_update_stamp));
+  g_variant_dict_insert_value (&dict, "deployments", deployments);
+  g_variant_dict_insert (&dict, "booted", "s",
+                         rpmostree_sysroot_get_booted (RPMOSTREE_SYSROOT (self)));
+  g_variant_dict_insert (&dict, "automatic-update-policy", "s",
+                         rpmostree_sysroot_get_automatic_update_policy (RPMOSTREE_SYSROOT (self)));
+
+  OstreeDeployment *booted = ostree_sysroot_get_booted_deployment (self->ot_sysroot);
+  if (booted)
+    {
+      auto os = static_cast<RPMOSTreeOS *>(g_hash_table_lookup (self->os_interfaces,
+                                                                ostree_deployment_get_osname (booted)));
+      /* Its cached update isn't known yet; we'll be called again once it is */
+      if (os && !rpmostreed_os_is_loaded (os))
+        return TRUE;
+      GVariant *cached_update = os ? rpmostree_os_get_cached_update (os) : NULL;
+      if (cached_update)
+        g_variant_dict_insert_value (&dict, "cached-update", cached_update);
+    }
+
+  g_autoptr(GVariant) snapshot = g_variant_ref_sink (g_variant_dict_end (&dict));
+  if (!glnx_shutil_mkdir_p_at (AT_FDCWD, RPMOSTREE_RUN_DIR, 0755, NULL, error))
+    return FALSE;
+  if (!glnx_file_replace_contents_at (AT_FDCWD, RPMOSTREE_STATUS_SNAPSHOT,
+                                      static_cast<const guint8*>(g_variant_get_data (snapshot)),
+                                      g_variant_get_size (snapshot),
+                                      static_cast<GLnxFileReplaceFlags>(0), NULL, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Atomically persists the deployments and cached update of the host, so that
+ * `rpm-ostree status` can be served without activating the daemon; see
+ * rpmostree_load_status_snapshot().  Errors are only logged. */
+void
+rpmostreed_sysroot_write_status_snapshot (RpmostreedSysroot *self)
+{
+  g_autoptr(GError) local_error = NULL;
+  if (!write_status_snapshot (self, &local_error))
+    sd_journal_print (LOG_WARNING, "Failed to write status snapshot: %s",
+                      local_error->message);
+}
+
 /* Ensures the sysroot is up to date, and returns references to the underlying
  * libostree sysroot object as well as the repo.  This function should
  * be used at the start of both state querying and transactions.
@@ -928,6 +1139,15 @@ rpmostreed_sysroot_get_repo (RpmostreedSysroot *self)
   return self->repo;
 }
 
+/* Commits loaded for the current deployments, to share with the OS interfaces.
+ * May be %NULL if deployments weren't loaded yet.
+ */
+GHashTable *
+rpmostreed_sysroot_get_commits (RpmostreedSysroot *self)
+{
+  return self->commits;
+}
+
 PolkitAuthority *
 rpmostreed_sysroot_get_polkit_authority (RpmostreedSysroot *self)
 {
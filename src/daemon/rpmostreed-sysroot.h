@@ -42,6 +42,7 @@ gboolean            rpmostreed_sysroot_reload           (RpmostreedSysroot *self
 
 OstreeSysroot *     rpmostreed_sysroot_get_root         (RpmostreedSysroot *self);
 OstreeRepo *        rpmostreed_sysroot_get_repo         (RpmostreedSysroot *self);
+GHashTable *        rpmostreed_sysroot_get_commits      (RpmostreedSysroot *self);
 PolkitAuthority *   rpmostreed_sysroot_get_polkit_authority (RpmostreedSysroot *self);
 gboolean            rpmostreed_sysroot_is_on_session_bus    (RpmostreedSysroot *self);
 
@@ -66,4 +67,6 @@ void                rpmostreed_sysroot_set_txn (RpmostreedSysroot     *self,
 
 void                rpmostreed_sysroot_emit_update      (RpmostreedSysroot *self);
 
+void                rpmostreed_sysroot_write_status_snapshot (RpmostreedSysroot *self);
+
 G_END_DECLS
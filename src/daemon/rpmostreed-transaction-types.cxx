@@ -23,6 +23,8 @@
 #include <gio/gunixoutputstream.h>
 #include <libglnx.h>
 #include <systemd/sd-journal.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include "rpmostreed-transaction-types.h"
 #include "rpmostreed-transaction.h"
@@ -858,6 +860,41 @@ get_driver_info (char   **name,
   return TRUE;
 }
 
+/* There's no glibc wrapper for ioprio_set(); see linux/ioprio.h */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+/* Drops the CPU and I/O priority of the calling thread, and so of the processes
+ * it spawns (scriptlets, dracut...), while in scope.  Transactions run on a
+ * thread pool, so the previous priority is restored on the way out.
+ */
+struct BackgroundPriority {
+  pid_t tid = 0;
+  int prev_nice = 0;
+  int prev_ioprio = -1;
+  bool nice_changed = false;
+
+  void enter () {
+    tid = (pid_t) syscall (SYS_gettid);
+    errno = 0;
+    prev_nice = getpriority (PRIO_PROCESS, tid);
+    if (errno == 0)
+      nice_changed = (setpriority (PRIO_PROCESS, tid, 19) == 0);
+    prev_ioprio = (int) syscall (SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid);
+    if (prev_ioprio >= 0)
+      (void) syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+                      IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+  }
+
+  ~BackgroundPriority() {
+    if (nice_changed)
+      (void) setpriority (PRIO_PROCESS, tid, prev_nice);
+    if (prev_ioprio >= 0)
+      (void) syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, prev_ioprio);
+  }
+};
+
 static gboolean
 deploy_transaction_execute (RpmostreedTransaction *transaction,
                             GCancellable *cancellable,
@@ -873,7 +910,11 @@ deploy_transaction_execute (RpmostreedTransaction *transaction,
   const gboolean no_initramfs = deploy_has_bool_option (self, "no-initramfs");
   const gboolean cache_only = deploy_has_bool_option (self, "cache-only");
   const gboolean idempotent_layering = deploy_has_bool_option (self, "idempotent-layering");
-  const gboolean download_only =
+  /* Used by the "prepare" automatic update policy; this is download-only, plus assembling
+   * the layered commit in the background so that deploying it later is quick */
+  const gboolean prepare_only =
+    ((self->flags & RPMOSTREE_TRANSACTION_DEPLOY_FLAG_PREPARE_ONLY) > 0);
+  const gboolean download_only = prepare_only ||
     ((self->flags & RPMOSTREE_TRANSACTION_DEPLOY_FLAG_DOWNLOAD_ONLY) > 0);
   /* Mainly for the `install` and `override` commands */
   const gboolean no_pull_base =
@@ -922,7 +963,14 @@ deploy_transaction_execute (RpmostreedTransaction *transaction,
       /* special-case the automatic one, otherwise just use verbatim as title */
       const char *title = command_line;
       if (strstr (command_line, "--trigger-automatic-update-policy"))
-        title = download_metadata_only ? "automatic (check)" : "automatic (stage)";
+        {
+          if (download_metadata_only)
+            title = "automatic (check)";
+          else if (prepare_only)
+            title = "automatic (prepare)";
+          else
+            title = "automatic (stage)";
+        }
       rpmostree_transaction_set_title (RPMOSTREE_TRANSACTION (transaction), title);
     }
   else
@@ -946,6 +994,8 @@ deploy_transaction_execute (RpmostreedTransaction *transaction,
         g_string_append (txn_title, " (cache only)");
       else if (download_metadata_only)
         g_string_append (txn_title, " (check only)");
+      else if (prepare_only)
+        g_string_append (txn_title, " (prepare only)");
       else if (download_only)
         g_string_append (txn_title, " (download only)");
 
@@ -976,6 +1026,11 @@ deploy_transaction_execute (RpmostreedTransaction *transaction,
         }
     }
 
+  /* Nobody is waiting on us; stay out of the way of the actual workload */
+  BackgroundPriority background_priority;
+  if (prepare_only)
+    background_priority.enter ();
+
   int upgrader_flags = 0;
   if (self->flags & RPMOSTREE_TRANSACTION_DEPLOY_FLAG_ALLOW_DOWNGRADE)
     upgrader_flags |= RPMOSTREE_SYSROOT_UPGRADER_FLAGS_ALLOW_OLDER;
@@ -1475,10 +1530,29 @@ deploy_transaction_execute (RpmostreedTransaction *transaction,
   if (changed || self->refspec)
     {
       /* Note early return; we stop short of actually writing the deployment */
-      if (self->flags & RPMOSTREE_TRANSACTION_DEPLOY_FLAG_DOWNLOAD_ONLY)
+      if (download_only)
         {
+          if (prepare_only && changed)
+            {
+              if (!rpmostree_sysroot_upgrader_prepare (upgrader, cancellable, error))
+                return FALSE;
+
+              /* Like the "check" policy, show what we've got in the CachedUpdate */
+              OstreeDeployment *booted_deployment =
+                ostree_sysroot_get_booted_deployment (sysroot);
+              if (is_upgrade && booted_deployment &&
+                  g_str_equal (self->osname, ostree_deployment_get_osname (booted_deployment)))
+                {
+                  DnfSack *sack = rpmostree_sysroot_upgrader_get_sack (upgrader, error);
+                  if (!generate_update_variant (repo, booted_deployment, NULL, sack,
+                                                cancellable, error))
+                    return FALSE;
+                }
+
+              rpmostree_output_message ("Update prepared.");
+            }
           /* XXX: improve msg here; e.g. cache will be blown on next operation? */
-          if (changed)
+          else if (changed)
             rpmostree_output_message ("Update downloaded.");
           else
             rpmostree_output_message ("No changes.");
@@ -2230,7 +2304,9 @@ cleanup_transaction_execute (RpmostreedTransaction *transaction,
     }
   if (self->flags & RPMOSTREE_TRANSACTION_CLEANUP_BASE)
     {
-      if (!rpmostree_syscore_cleanup (sysroot, repo, cancellable, error))
+      guint64 retention_size =
+        rpmostreed_get_pkgcache_retention_size (rpmostreed_daemon_get ());
+      if (!rpmostree_syscore_cleanup (sysroot, repo, retention_size, cancellable, error))
         return FALSE;
     }
   if (self->flags & RPMOSTREE_TRANSACTION_CLEANUP_REPOMD)
@@ -57,6 +57,7 @@ typedef enum {
   RPMOSTREE_TRANSACTION_DEPLOY_FLAG_DRY_RUN = (1 << 5),
   RPMOSTREE_TRANSACTION_DEPLOY_FLAG_DOWNLOAD_ONLY = (1 << 8),
   RPMOSTREE_TRANSACTION_DEPLOY_FLAG_DOWNLOAD_METADATA_ONLY = (1 << 9),
+  RPMOSTREE_TRANSACTION_DEPLOY_FLAG_PREPARE_ONLY = (1 << 10),
 } RpmOstreeTransactionDeployFlags;
 
 
@@ -28,6 +28,8 @@
 #include "rpmostreed-errors.h"
 #include "rpmostreed-sysroot.h"
 #include "rpmostreed-daemon.h"
+#include "rpmostreed-deployment-utils.h"
+#include "rpmostree-cxxrs.h"
 
 struct _RpmostreedTransactionPrivate {
   GDBusMethodInvocation *invocation;
@@ -314,6 +316,18 @@ transaction_gpg_verify_result_cb (OstreeRepo *repo,
                                                  g_strdup (checksum));
 }
 
+/* Transactions which nobody is actively waiting on; these run under the
+ * background resource limits, if configured. */
+static gboolean
+transaction_is_background (RpmostreedTransaction *self)
+{
+  RpmostreedTransactionPrivate *priv = rpmostreed_transaction_get_private (self);
+  const char *method_name = g_dbus_method_invocation_get_method_name (priv->invocation);
+  return g_str_equal (method_name, "AutomaticUpdateTrigger") ||
+         g_str_equal (method_name, "Cleanup") ||
+         g_str_equal (method_name, "RefreshMd");
+}
+
 static void
 transaction_execute_thread (GTask *task,
                             gpointer source_object,
@@ -334,6 +348,25 @@ transaction_execute_thread (GTask *task,
    */
   g_main_context_push_thread_default (mctx);
 
+  /* Failing to apply limits isn't fatal; we'd rather update than not */
+  gboolean governed = FALSE;
+  if (transaction_is_background (self))
+    {
+      RpmostreedDaemon *daemon = rpmostreed_daemon_get ();
+      rpmostreecxx::GovernorLimits limits = {
+        rpmostreed_get_background_cpu_weight (daemon),
+        rpmostreed_get_background_io_weight (daemon),
+        rpmostreed_get_background_memory_high (daemon),
+        rpmostreed_get_background_cpu_quota (daemon),
+      };
+      try {
+        governed = rpmostreecxx::governor_enter (limits);
+      } catch (std::exception& e) {
+        sd_journal_print (LOG_WARNING, "Failed to apply background resource limits: %s",
+                          e.what());
+      }
+    }
+
   if (clazz->execute != NULL)
     {
       try {
@@ -343,6 +376,19 @@ transaction_execute_thread (GTask *task,
       }
     }
 
+  /* Write out whatever signatures were verified along the way */
+  rpmostreed_deployment_gpg_verify_cache_flush ();
+
+  if (governed)
+    {
+      try {
+        rpmostreecxx::governor_leave ();
+      } catch (std::exception& e) {
+        sd_journal_print (LOG_WARNING, "Failed to lift background resource limits: %s",
+                          e.what());
+      }
+    }
+
   if (local_error != NULL)
     {
       /* Also log to journal in addition to the client, so it's recorded
@@ -667,3 +667,80 @@ check_sd_inhibitor_locks (GCancellable    *cancellable,
     }
   return glnx_throw (error, "%s", error_msg->str);
 }
+
+/* Per-class state of rpmostreed_skeleton_class_load_on_access() */
+typedef struct {
+  GDBusInterfaceSkeletonClass *parent_class;
+  RpmostreedEnsureLoadedFunc ensure_loaded;
+  GDBusInterfaceVTable vtable;
+  GDBusInterfaceGetPropertyFunc parent_get_property;
+} LoadOnAccessData;
+
+G_DEFINE_QUARK (rpmostreed-load-on-access, load_on_access)
+
+static LoadOnAccessData *
+load_on_access_data (gpointer skeleton)
+{
+  auto data = static_cast<LoadOnAccessData *>(g_type_get_qdata (G_OBJECT_TYPE (skeleton),
+                                                                load_on_access_quark ()));
+  g_assert (data);
+  return data;
+}
+
+static GVariant *
+load_on_access_get_property (GDBusConnection *connection,
+                             const gchar     *sender,
+                             const gchar     *object_path,
+                             const gchar     *interface_name,
+                             const gchar     *property_name,
+                             GError         **error,
+                             gpointer         user_data)
+{
+  LoadOnAccessData *data = load_on_access_data (user_data);
+  data->ensure_loaded (G_DBUS_INTERFACE_SKELETON (user_data));
+  return data->parent_get_property (connection, sender, object_path, interface_name,
+                                    property_name, error, user_data);
+}
+
+static GDBusInterfaceVTable *
+load_on_access_get_vtable (GDBusInterfaceSkeleton *skeleton)
+{
+  LoadOnAccessData *data = load_on_access_data (skeleton);
+  if (data->parent_get_property == NULL)
+    {
+      data->vtable = *data->parent_class->get_vtable (skeleton);
+      data->parent_get_property = data->vtable.get_property;
+      data->vtable.get_property = load_on_access_get_property;
+    }
+  return &data->vtable;
+}
+
+/* ObjectManager's GetManagedObjects doesn't go through the vtable */
+static GVariant *
+load_on_access_get_properties (GDBusInterfaceSkeleton *skeleton)
+{
+  LoadOnAccessData *data = load_on_access_data (skeleton);
+  /* But don't load for the InterfacesAdded of our own export; clients get
+   * PropertiesChanged once we're loaded. */
+  if (!rpmostreed_daemon_is_publishing (rpmostreed_daemon_get ()))
+    data->ensure_loaded (skeleton);
+  return data->parent_class->get_properties (skeleton);
+}
+
+/* Hook the generated skeleton of @klass so that @ensure_loaded is called
+ * before its properties are read over D-Bus, for skeletons whose properties
+ * are filled in lazily.  Call from class_init. */
+void
+rpmostreed_skeleton_class_load_on_access (GDBusInterfaceSkeletonClass *klass,
+                                          RpmostreedEnsureLoadedFunc   ensure_loaded)
+{
+  /* Lives as long as the class, i.e. forever */
+  LoadOnAccessData *data = g_new0 (LoadOnAccessData, 1);
+  data->parent_class =
+    G_DBUS_INTERFACE_SKELETON_CLASS (g_type_class_peek_parent (klass));
+  data->ensure_loaded = ensure_loaded;
+  g_type_set_qdata (G_TYPE_FROM_CLASS (klass), load_on_access_quark (), data);
+
+  klass->get_vtable = load_on_access_get_vtable;
+  klass->get_properties = load_on_access_get_properties;
+}
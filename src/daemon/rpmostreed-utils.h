@@ -86,4 +86,9 @@ gboolean   rpmostreed_parse_revision (const char  *revision,
 gboolean   check_sd_inhibitor_locks (GCancellable    *cancellable,
                                      GError         **error);
 
-G_END_DECLS
\ No newline at end of file
+typedef void (*RpmostreedEnsureLoadedFunc) (GDBusInterfaceSkeleton *skeleton);
+
+void       rpmostreed_skeleton_class_load_on_access (GDBusInterfaceSkeletonClass *klass,
+                                                     RpmostreedEnsureLoadedFunc   ensure_loaded);
+
+G_END_DECLS
@@ -45,6 +45,9 @@ struct _RpmOstreeContext {
   RpmOstreeContextDnfCachePolicy dnf_cache_policy;
   OstreeRepo *ostreerepo;
   OstreeRepo *pkgcache_repo;
+  gboolean pkgcache_shared;
+  GHashTable *pkgcache_locks; /* lock name --> GLnxLockFile, for a shared pkgcache */
+  int pkgcache_locks_dfd;
   gboolean enable_rofiles;
   OstreeRepoDevInoCache *devino_cache;
   gboolean unprivileged;
@@ -61,12 +64,14 @@ struct _RpmOstreeContext {
   GPtrArray *pkgs; /* All packages */
   GPtrArray *pkgs_to_download;
   GPtrArray *pkgs_to_import;
+  GPtrArray *pkgs_importing; /* Borrowed; subset of pkgs_to_import in flight */
   guint n_async_pkgs_imported;
   GPtrArray *pkgs_to_relabel;
   guint n_async_pkgs_relabeled;
 
   GHashTable *pkgs_to_remove;  /* pkgname --> gv_nevra */
   GHashTable *pkgs_to_replace; /* new gv_nevra --> old gv_nevra */
+  GHashTable *files_remove_matchers; /* pkgname --> FilesRemoveMatcher; see checkout_filter() */
 
   std::optional<rust::Box<rpmostreecxx::LockfileConfig>> lockfile;
   gboolean lockfile_strict;
@@ -74,6 +79,7 @@ struct _RpmOstreeContext {
   GLnxTmpDir tmpdir;
 
   gboolean kernel_changed;
+  char *assembly_checksum; /* Recorded in client layered commits; see rpmostree_context_set_assembly_checksum() */
 
   int tmprootfs_dfd; /* Borrowed */
   GHashTable *rootfs_usrlinks;
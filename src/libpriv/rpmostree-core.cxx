@@ -282,6 +282,7 @@ rpmostree_context_finalize (GObject *object)
   g_clear_object (&rctx->dnfctx);
 
   g_clear_pointer (&rctx->ref, g_free);
+  g_clear_pointer (&rctx->assembly_checksum, g_free);
 
   g_clear_object (&rctx->pkgcache_repo);
   g_clear_object (&rctx->ostreerepo);
@@ -293,11 +294,14 @@ rpmostree_context_finalize (GObject *object)
 
   g_clear_pointer (&rctx->pkgs, g_ptr_array_unref);
   g_clear_pointer (&rctx->pkgs_to_download, g_ptr_array_unref);
+  g_clear_pointer (&rctx->pkgcache_locks, g_hash_table_unref);
+  glnx_close_fd (&rctx->pkgcache_locks_dfd);
   g_clear_pointer (&rctx->pkgs_to_import, g_ptr_array_unref);
   g_clear_pointer (&rctx->pkgs_to_relabel, g_ptr_array_unref);
 
   g_clear_pointer (&rctx->pkgs_to_remove, g_hash_table_unref);
   g_clear_pointer (&rctx->pkgs_to_replace, g_hash_table_unref);
+  g_clear_pointer (&rctx->files_remove_matchers, g_hash_table_unref);
 
   (void)glnx_tmpdir_delete (&rctx->tmpdir, NULL, NULL);
   (void)glnx_tmpdir_delete (&rctx->repo_tmpdir, NULL, NULL);
@@ -318,6 +322,7 @@ static void
 rpmostree_context_init (RpmOstreeContext *self)
 {
   self->tmprootfs_dfd = -1;
+  self->pkgcache_locks_dfd = -1;
   self->dnf_cache_policy = RPMOSTREE_CONTEXT_DNF_CACHE_DEFAULT;
   self->enable_rofiles = TRUE;
 }
@@ -517,6 +522,15 @@ get_pkgcache_repo (RpmOstreeContext *self)
   return self->pkgcache_repo ?: self->ostreerepo;
 }
 
+/* Declare that the pkgcache repo may be used by other processes at the same
+ * time (e.g. several composes sharing one cache); see import_shared().
+ */
+void
+rpmostree_context_set_pkgcache_shared (RpmOstreeContext *self)
+{
+  self->pkgcache_shared = TRUE;
+}
+
 /* I debated making this part of the treespec. Overall, I think it makes more
  * sense to define it outside since the policy to use depends on the context in
  * which the RpmOstreeContext is used, not something we can always guess on our
@@ -2226,6 +2240,67 @@ convert_dnf_action_to_string (DnfStateAction action)
   return NULL; /* satisfy static analysis tools */
 }
 
+typedef struct {
+  OstreeRepo *pkgcache;
+  GPtrArray *branches; /* pkgcache branches */
+  char **reprs;     /* out; repodata chksum repr of each branch, if any */
+} ChksumReprLoad;
+
+static gboolean
+load_one_chksum_repr (guint     i,
+                      gpointer  data,
+                      GError  **error)
+{
+  auto load = static_cast<ChksumReprLoad*>(data);
+  g_autofree char *rev = NULL;
+  g_autoptr(GVariant) commit = NULL;
+  if (!ostree_repo_resolve_rev (load->pkgcache, static_cast<const char*>(load->branches->pdata[i]),
+                                FALSE, &rev, error) ||
+      !ostree_repo_load_commit (load->pkgcache, rev, &commit, NULL, error))
+    return FALSE;
+  return get_pkgcache_repodata_chksum_repr (commit, &load->reprs[i], TRUE, error);
+}
+
+/* Look up the repodata chksum repr recorded in the pkgcache for each of @pkgs,
+ * in parallel.  Returns a map from package to repr; packages imported by
+ * versions which didn't record it are left out.
+ */
+static gboolean
+load_pkgcache_chksum_reprs (OstreeRepo  *pkgcache,
+                            GPtrArray   *pkgs,
+                            GHashTable **out_reprs,
+                            GError     **error)
+{
+  g_autoptr(GHashTable) reprs = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  if (pkgs->len == 0)
+    {
+      *out_reprs = util::move_nullify (reprs);
+      return TRUE;
+    }
+
+  g_autoptr(GPtrArray) branches = g_ptr_array_new_with_free_func (g_free);
+  for (guint i = 0; i < pkgs->len; i++)
+    g_ptr_array_add (branches, rpmostree_get_cache_branch_pkg (static_cast<DnfPackage *>(pkgs->pdata[i])));
+
+  g_autofree char **loaded = g_new0 (char*, branches->len);
+  ChksumReprLoad load = { pkgcache, branches, loaded, };
+  const gboolean success =
+    rpmostree_parallel_for (branches->len, "rpmostree-chksum", load_one_chksum_repr,
+                            &load, error);
+
+  /* Transfer ownership even on failure so nothing leaks */
+  for (guint i = 0; i < branches->len; i++)
+    {
+      if (loaded[i])
+        g_hash_table_insert (reprs, pkgs->pdata[i], loaded[i]);
+    }
+  if (!success)
+    return FALSE;
+
+  *out_reprs = util::move_nullify (reprs);
+  return TRUE;
+}
+
 /* Generate a checksum from a goal in a repeatable fashion - we checksum an ordered array of
  * the checksums of individual packages as well as the associated action. We *used* to just
  * checksum the NEVRAs but that breaks with RPM gpg signatures.
@@ -2246,6 +2321,26 @@ rpmostree_dnf_add_checksum_goal (GChecksum   *checksum,
                                                               -1);
   g_assert (pkglist);
   g_ptr_array_sort (pkglist, compare_pkgs);
+
+  /* For pkgs that were added from the pkgcache repo (e.g. local RPMs and replacement
+   * overrides), make sure to pick up the SHA256 from the pkg metadata, rather than what
+   * libsolv figured out (which is based on our chopped off fake RPM, which clearly will
+   * not match what's in the repo). This ensures that two goals are equivalent whether
+   * the same RPM comes from a yum repo or from the pkgcache. */
+  g_autoptr(GPtrArray) cached_pkgs = g_ptr_array_new ();
+  if (pkgcache)
+    {
+      for (guint i = 0; i < pkglist->len; i++)
+        {
+          auto pkg = static_cast<DnfPackage *>(pkglist->pdata[i]);
+          if (g_strcmp0 (dnf_package_get_reponame (pkg), HY_CMDLINE_REPO_NAME) == 0)
+            g_ptr_array_add (cached_pkgs, pkg);
+        }
+    }
+  g_autoptr(GHashTable) cached_reprs = NULL;
+  if (!load_pkgcache_chksum_reprs (pkgcache, cached_pkgs, &cached_reprs, error))
+    return FALSE;
+
   for (guint i = 0; i < pkglist->len; i++)
     {
       auto pkg = static_cast<DnfPackage *>(pkglist->pdata[i]);
@@ -2253,34 +2348,11 @@ rpmostree_dnf_add_checksum_goal (GChecksum   *checksum,
       const char *action_str = convert_dnf_action_to_string (action);
       g_checksum_update (checksum, (guint8*)action_str, strlen (action_str));
 
-      /* For pkgs that were added from the pkgcache repo (e.g. local RPMs and replacement
-       * overrides), make sure to pick up the SHA256 from the pkg metadata, rather than what
-       * libsolv figured out (which is based on our chopped off fake RPM, which clearly will
-       * not match what's in the repo). This ensures that two goals are equivalent whether
-       * the same RPM comes from a yum repo or from the pkgcache. */
-      const char *reponame = NULL;
-      if (pkgcache)
-        reponame = dnf_package_get_reponame (pkg);
-      if (g_strcmp0 (reponame, HY_CMDLINE_REPO_NAME) == 0)
+      auto cached_repr = static_cast<const char*>(g_hash_table_lookup (cached_reprs, pkg));
+      if (cached_repr)
         {
-          g_autofree char *cachebranch = rpmostree_get_cache_branch_pkg (pkg);
-          g_autofree char *cached_rev = NULL;
-          if (!ostree_repo_resolve_rev (pkgcache, cachebranch, FALSE, &cached_rev, error))
-            return FALSE;
-
-          g_autoptr(GVariant) commit = NULL;
-          if (!ostree_repo_load_commit (pkgcache, cached_rev, &commit, NULL, error))
-            return FALSE;
-
-          g_autofree char *chksum_repr = NULL;
-          if (!get_pkgcache_repodata_chksum_repr (commit, &chksum_repr, TRUE, error))
-            return FALSE;
-
-          if (chksum_repr)
-            {
-              g_checksum_update (checksum, (guint8*)chksum_repr, strlen (chksum_repr));
-              continue;
-            }
+          g_checksum_update (checksum, (guint8*)cached_repr, strlen (cached_repr));
+          continue;
         }
 
       auto chksum_repr = rpmostreecxx::get_repodata_chksum_repr(*pkg);
@@ -2371,24 +2443,38 @@ rpmostree_download_packages (GPtrArray      *packages,
   return TRUE;
 }
 
+static gboolean
+claim_shared_downloads (RpmOstreeContext *self,
+                        GPtrArray       **out_packages,
+                        GCancellable     *cancellable,
+                        GError          **error);
+
 gboolean
 rpmostree_context_download (RpmOstreeContext *self,
                             GCancellable     *cancellable,
                             GError          **error)
 {
-  int n = self->pkgs_to_download->len;
+  g_autoptr(GPtrArray) packages = g_ptr_array_ref (self->pkgs_to_download);
+  if (self->pkgcache_shared && packages->len > 0)
+    {
+      g_clear_pointer (&packages, g_ptr_array_unref);
+      if (!claim_shared_downloads (self, &packages, cancellable, error))
+        return FALSE;
+    }
+
+  int n = packages->len;
 
   if (n > 0)
     {
       guint64 size =
-        dnf_package_array_get_download_size (self->pkgs_to_download);
+        dnf_package_array_get_download_size (packages);
       g_autofree char *sizestr = g_format_size (size);
       rpmostree_output_message ("Will download: %u package%s (%s)", n, _NS(n), sizestr);
     }
   else
     return TRUE;
 
-  return rpmostree_download_packages (self->pkgs_to_download, cancellable, error);
+  return rpmostree_download_packages (packages, cancellable, error);
 }
 
 static gboolean
@@ -2412,7 +2498,7 @@ on_async_import_done (GObject                    *obj,
       g_assert (self->async_error != NULL);
     }
 
-  g_assert_cmpint (self->n_async_pkgs_imported, <, self->pkgs_to_import->len);
+  g_assert_cmpint (self->n_async_pkgs_imported, <, self->pkgs_importing->len);
   self->n_async_pkgs_imported++;
   g_assert_cmpint (self->n_async_running, >, 0);
   self->n_async_running--;
@@ -2469,11 +2555,11 @@ async_imports_mainctx_iter (gpointer user_data)
 {
   auto self = static_cast<RpmOstreeContext *>(user_data);
 
-  while (self->async_index < self->pkgs_to_import->len &&
+  while (self->async_index < self->pkgs_importing->len &&
          self->n_async_running < self->n_async_max &&
          self->async_error == NULL)
     {
-      auto pkg = static_cast<DnfPackage *>(self->pkgs_to_import->pdata[self->async_index]);
+      auto pkg = static_cast<DnfPackage *>(self->pkgs_importing->pdata[self->async_index]);
       if (!start_async_import_one_package (self, pkg, self->async_cancellable, &self->async_error))
         {
           g_cancellable_cancel (self->async_cancellable);
@@ -2492,22 +2578,20 @@ async_imports_mainctx_iter (gpointer user_data)
   return FALSE;
 }
 
-gboolean
-rpmostree_context_import (RpmOstreeContext *self,
-                          GCancellable     *cancellable,
-                          GError          **error)
+/* Import @pkgs into the pkgcache, in a single transaction */
+static gboolean
+import_packages (RpmOstreeContext *self,
+                 GPtrArray        *pkgs,
+                 GCancellable     *cancellable,
+                 GError          **error)
 {
-  DnfContext *dnfctx = self->dnfctx;
-  const int n = self->pkgs_to_import->len;
+  const guint n = pkgs->len;
   if (n == 0)
     return TRUE;
 
   OstreeRepo *repo = get_pkgcache_repo (self);
   g_assert (repo != NULL);
 
-  if (!dnf_transaction_import_keys (dnf_context_get_transaction (dnfctx), error))
-    return FALSE;
-
   g_auto(RpmOstreeRepoAutoTransaction) txn = { 0, };
   /* Note use of commit-on-failure */
   if (!rpmostree_repo_auto_transaction_start (&txn, repo, TRUE, cancellable, error))
@@ -2516,11 +2600,13 @@ rpmostree_context_import (RpmOstreeContext *self,
   self->async_running = TRUE;
   self->async_index = 0;
   self->n_async_running = 0;
-  /* We're CPU bound, so just use processors */
-  self->n_async_max = g_get_num_processors ();
+  self->pkgs_importing = pkgs;
+  self->n_async_pkgs_imported = 0;
+  /* We're CPU bound, so use as many processors as we're granted */
+  self->n_async_max = rpmostreecxx::governor_parallelism ();
   self->async_cancellable = cancellable;
 
-  self->async_progress = rpmostreecxx::progress_nitems_begin(self->pkgs_to_import->len, "Importing packages");
+  self->async_progress = rpmostreecxx::progress_nitems_begin(n, "Importing packages");
 
   /* Process imports */
   GMainContext *mainctx = g_main_context_get_thread_default ();
@@ -2533,6 +2619,7 @@ rpmostree_context_import (RpmOstreeContext *self,
   self->async_error = NULL;
   while (self->async_running)
     g_main_context_iteration (mainctx, TRUE);
+  self->pkgs_importing = NULL;
   if (self->async_error)
     {
       g_propagate_error (error, util::move_nullify (self->async_error));
@@ -2542,9 +2629,8 @@ rpmostree_context_import (RpmOstreeContext *self,
   self->async_progress->end("");
   self->async_progress.release();
 
-  if (!ostree_repo_commit_transaction (repo, NULL, cancellable, error))
+  if (!rpmostree_repo_auto_transaction_commit (&txn, NULL, cancellable, error))
     return FALSE;
-  txn.initialized = FALSE;
 
   sd_journal_send ("MESSAGE_ID=" SD_ID128_FORMAT_STR,
                    SD_ID128_FORMAT_VAL(RPMOSTREE_MESSAGE_PKG_IMPORT),
@@ -2554,6 +2640,276 @@ rpmostree_context_import (RpmOstreeContext *self,
   return TRUE;
 }
 
+static void
+pkgcache_lock_free (GLnxLockFile *lock)
+{
+  glnx_release_lock_file (lock);
+  g_free (lock);
+}
+
+/* The import lock of @pkg is keyed on its checksum, so that the same build
+ * gets the same lock in every process (and even if it's in several repos).
+ */
+static char *
+pkgcache_lock_name (DnfPackage *pkg)
+{
+  auto chksum_repr = rpmostreecxx::get_repodata_chksum_repr (*pkg);
+  char *lockname = g_strconcat (chksum_repr.c_str(), ".lock", NULL);
+  g_strdelimit (lockname, "/", '_');
+  return lockname;
+}
+
+/* Take the import lock @lockname for @pkg.  If @wait is FALSE and someone else
+ * holds it, return %TRUE with @out_lock set to %NULL.
+ */
+static gboolean
+lock_pkgcache_pkg (int            locks_dfd,
+                   DnfPackage    *pkg,
+                   const char    *lockname,
+                   gboolean       wait,
+                   GLnxLockFile **out_lock,
+                   GError       **error)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autofree GLnxLockFile *lock = g_new0 (GLnxLockFile, 1);
+  if (!glnx_make_lock_file (locks_dfd, lockname, wait ? LOCK_EX : LOCK_EX | LOCK_NB,
+                            lock, &local_error))
+    {
+      if (!wait && g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        {
+          *out_lock = NULL;
+          return TRUE;
+        }
+      g_propagate_error (error, util::move_nullify (local_error));
+      return glnx_prefix_error (error, "Locking %s", dnf_package_get_nevra (pkg));
+    }
+
+  *out_lock = util::move_nullify (lock);
+  return TRUE;
+}
+
+/* Check again whether @pkg is still missing from the pkgcache, now that we hold
+ * its lock; another process may have imported it in the meantime.
+ */
+static gboolean
+pkg_still_needs_import (RpmOstreeContext *self,
+                        DnfPackage       *pkg,
+                        gboolean         *out_needed,
+                        GError          **error)
+{
+  gboolean in_ostree = FALSE;
+  gboolean selinux_match = FALSE;
+  if (!find_pkg_in_ostree (self, pkg, self->sepolicy, &in_ostree, &selinux_match, error))
+    return FALSE;
+  /* It may have been imported with a different policy */
+  if (in_ostree && !selinux_match)
+    g_ptr_array_add (self->pkgs_to_relabel, g_object_ref (pkg));
+  *out_needed = !in_ostree;
+  return TRUE;
+}
+
+/* The locks keep referring to the directory fd until they're released, so it
+ * lives as long as the context.
+ */
+static gboolean
+open_pkgcache_locks_dir (RpmOstreeContext *self,
+                         GCancellable     *cancellable,
+                         GError          **error)
+{
+  if (self->pkgcache_locks_dfd != -1)
+    return TRUE;
+
+  OstreeRepo *repo = get_pkgcache_repo (self);
+  const char *locks_path = "extensions/rpmostree/pkgcache-locks";
+  if (!glnx_shutil_mkdir_p_at (ostree_repo_get_dfd (repo), locks_path, 0755,
+                               cancellable, error))
+    return FALSE;
+  if (!self->pkgcache_locks)
+    self->pkgcache_locks =
+      g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)pkgcache_lock_free);
+  return glnx_opendirat (ostree_repo_get_dfd (repo), locks_path, TRUE,
+                         &self->pkgcache_locks_dfd, error);
+}
+
+/* With a pkgcache shared between processes, only download the packages nobody
+ * else is importing; the others are most likely in the pkgcache by the time we
+ * get to import_shared().  The locks we take here are kept until then.
+ */
+static gboolean
+claim_shared_downloads (RpmOstreeContext *self,
+                        GPtrArray       **out_packages,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+  if (!open_pkgcache_locks_dir (self, cancellable, error))
+    return FALSE;
+  const int locks_dfd = self->pkgcache_locks_dfd;
+
+  g_autoptr(GPtrArray) claimed = g_ptr_array_new ();
+  guint n_contended = 0;
+  for (guint i = 0; i < self->pkgs_to_download->len; i++)
+    {
+      auto pkg = static_cast<DnfPackage *>(self->pkgs_to_download->pdata[i]);
+      g_autofree char *lockname = pkgcache_lock_name (pkg);
+      GLnxLockFile *lock = NULL;
+      if (!lock_pkgcache_pkg (locks_dfd, pkg, lockname, FALSE, &lock, error))
+        return FALSE;
+      if (!lock)
+        {
+          n_contended++;
+          continue;
+        }
+      g_hash_table_insert (self->pkgcache_locks, g_strdup (lockname), lock);
+      /* NB: relabeling is left to import_shared() */
+      gboolean in_ostree = FALSE;
+      gboolean selinux_match = FALSE;
+      if (!find_pkg_in_ostree (self, pkg, self->sepolicy, &in_ostree, &selinux_match, error))
+        return FALSE;
+      if (!in_ostree)
+        g_ptr_array_add (claimed, pkg);
+      else
+        g_hash_table_remove (self->pkgcache_locks, lockname);
+    }
+
+  if (n_contended > 0)
+    rpmostree_output_message ("Skipping download of %u package%s fetched concurrently",
+                              n_contended, _NS(n_contended));
+  *out_packages = util::move_nullify (claimed);
+  return TRUE;
+}
+
+/* Import the @claimed packages, downloading those we don't have yet; see
+ * claim_shared_downloads().  All locks are dropped once the transaction writing
+ * the branches is committed.
+ */
+static gboolean
+import_claimed (RpmOstreeContext *self,
+                GPtrArray        *claimed,
+                GCancellable     *cancellable,
+                GError          **error)
+{
+  g_autoptr(GPtrArray) to_download = g_ptr_array_new ();
+  for (guint i = 0; i < claimed->len; i++)
+    {
+      auto pkg = static_cast<DnfPackage *>(claimed->pdata[i]);
+      if (!pkg_is_cached (pkg))
+        g_ptr_array_add (to_download, pkg);
+    }
+  if (to_download->len > 0 &&
+      !rpmostree_download_packages (to_download, cancellable, error))
+    return FALSE;
+
+  if (!import_packages (self, claimed, cancellable, error))
+    return FALSE;
+  g_hash_table_remove_all (self->pkgcache_locks);
+  return TRUE;
+}
+
+/* With a pkgcache shared between processes, make sure only one of them imports
+ * a given package.  Packages nobody else is importing are claimed and imported
+ * first; we then wait for the others, and import the ones that are still
+ * missing (e.g. because their importer failed).  Locks are only dropped once
+ * the transaction writing the branches is committed.
+ *
+ * We never block on a lock while holding another: two processes waiting for
+ * the same packages in a different order would deadlock otherwise.  So the
+ * claimed locks are released before waiting, and the contended packages are
+ * then handled one at a time.
+ */
+static gboolean
+import_shared (RpmOstreeContext *self,
+               GCancellable     *cancellable,
+               GError          **error)
+{
+  if (!open_pkgcache_locks_dir (self, cancellable, error))
+    return FALSE;
+  const int locks_dfd = self->pkgcache_locks_dfd;
+
+  g_autoptr(GPtrArray) claimed = g_ptr_array_new ();
+  g_autoptr(GPtrArray) contended = g_ptr_array_new ();
+  for (guint i = 0; i < self->pkgs_to_import->len; i++)
+    {
+      auto pkg = static_cast<DnfPackage *>(self->pkgs_to_import->pdata[i]);
+      g_autofree char *lockname = pkgcache_lock_name (pkg);
+      /* We may already hold it since downloading */
+      if (!g_hash_table_contains (self->pkgcache_locks, lockname))
+        {
+          GLnxLockFile *lock = NULL;
+          if (!lock_pkgcache_pkg (locks_dfd, pkg, lockname, FALSE, &lock, error))
+            return FALSE;
+          if (!lock)
+            {
+              g_ptr_array_add (contended, pkg);
+              continue;
+            }
+          g_hash_table_insert (self->pkgcache_locks, util::move_nullify (lockname), lock);
+        }
+      gboolean needed;
+      if (!pkg_still_needs_import (self, pkg, &needed, error))
+        return FALSE;
+      if (needed)
+        g_ptr_array_add (claimed, pkg);
+    }
+
+  if (!import_claimed (self, claimed, cancellable, error))
+    return FALSE;
+
+  if (contended->len == 0)
+    return TRUE;
+
+  /* Lets tests have two processes wait for the same packages in opposite order */
+  if (getenv ("RPMOSTREE_DEBUG_REVERSE_CONTENDED_IMPORTS"))
+    {
+      for (guint i = 0; i < contended->len / 2; i++)
+        std::swap (contended->pdata[i], contended->pdata[contended->len - 1 - i]);
+    }
+
+  rpmostree_output_message ("Waiting for %u package%s imported concurrently",
+                            contended->len, _NS(contended->len));
+  g_assert_cmpuint (g_hash_table_size (self->pkgcache_locks), ==, 0);
+  for (guint i = 0; i < contended->len; i++)
+    {
+      auto pkg = static_cast<DnfPackage *>(contended->pdata[i]);
+      g_autofree char *lockname = pkgcache_lock_name (pkg);
+      GLnxLockFile *lock = NULL;
+      if (!lock_pkgcache_pkg (locks_dfd, pkg, lockname, TRUE, &lock, error))
+        return FALSE;
+      g_hash_table_insert (self->pkgcache_locks, util::move_nullify (lockname), lock);
+      gboolean needed;
+      if (!pkg_still_needs_import (self, pkg, &needed, error))
+        return FALSE;
+      if (!needed)
+        {
+          g_hash_table_remove_all (self->pkgcache_locks);
+          continue;
+        }
+      /* Rare, as its importer must have failed; so a transaction each is fine */
+      g_autoptr(GPtrArray) one = g_ptr_array_new ();
+      g_ptr_array_add (one, pkg);
+      if (!import_claimed (self, one, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+gboolean
+rpmostree_context_import (RpmOstreeContext *self,
+                          GCancellable     *cancellable,
+                          GError          **error)
+{
+  DnfContext *dnfctx = self->dnfctx;
+  if (self->pkgs_to_import->len == 0)
+    return TRUE;
+
+  if (!dnf_transaction_import_keys (dnf_context_get_transaction (dnfctx), error))
+    return FALSE;
+
+  if (self->pkgcache_shared)
+    return import_shared (self, cancellable, error);
+  return import_packages (self, self->pkgs_to_import, cancellable, error);
+}
+
 /* Given a single package, verify its GPG signature (if enabled), open a file
  * descriptor for it, and delete the on-disk downloaded copy.
  */
@@ -2745,9 +3101,171 @@ handle_file_dispositions (RpmOstreeContext *self,
   return TRUE;
 }
 
+/* The `remove-from-packages` patterns for a package, compiled once per context.
+ * Rather than running each pattern against every path of the package, they're
+ * combined into a single regex.  And if all of them are anchored to a literal
+ * prefix, most paths can be rejected without running a regex at all.
+ */
+typedef struct {
+  GPtrArray *prefixes; /* Literal prefixes a match must start with, or NULL if unknown */
+  GPtrArray *regexes;  /* Usually just the combined regex; see files_remove_matcher_new() */
+} FilesRemoveMatcher;
+
+static void
+files_remove_matcher_free (FilesRemoveMatcher *matcher)
+{
+  g_clear_pointer (&matcher->prefixes, g_ptr_array_unref);
+  g_clear_pointer (&matcher->regexes, g_ptr_array_unref);
+  g_free (matcher);
+}
+
+/* Returns the literal text any match of @pattern must start with, or %NULL if
+ * we can't tell, e.g. because it isn't anchored. */
+static char *
+pattern_get_literal_prefix (const char *pattern)
+{
+  if (*pattern != '^' || strchr (pattern, '|'))
+    return NULL;
+
+  g_autoptr(GString) prefix = g_string_new ("");
+  for (const char *it = pattern + 1; *it; it++)
+    {
+      char c = *it;
+      if (c == '\\' && it[1] && !g_ascii_isalnum (it[1]))
+        c = *(++it);
+      else if (strchr ("\\^$.[](){}?*+", c))
+        break;
+      /* A quantifier may make this character optional */
+      if (it[1] && strchr ("?*{", it[1]))
+        break;
+      g_string_append_c (prefix, c);
+    }
+  if (prefix->len == 0)
+    return NULL;
+  return g_string_free (util::move_nullify (prefix), FALSE);
+}
+
+static FilesRemoveMatcher *
+files_remove_matcher_new (rust::Vec<rust::String> &patterns,
+                          GError                 **error)
+{
+  g_autoptr(GPtrArray) prefixes = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) regexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_regex_unref);
+  g_autoptr(GString) combined = g_string_new ("");
+  gboolean can_combine = TRUE;
+  for (auto &pattern_rs : patterns)
+    {
+      auto pattern = std::string(pattern_rs);
+      if (prefixes)
+        {
+          char *prefix = pattern_get_literal_prefix (pattern.c_str());
+          if (prefix)
+            g_ptr_array_add (prefixes, prefix);
+          else
+            g_clear_pointer (&prefixes, g_ptr_array_unref);
+        }
+      /* Group numbers shift once combined, so backreferences (numbered, or
+       * relative like \g{-1}) could refer to the wrong group */
+      if (g_regex_match_simple ("\\\\([1-9]|g|k)", pattern.c_str(),
+                                static_cast<GRegexCompileFlags>(0),
+                                static_cast<GRegexMatchFlags>(0)))
+        can_combine = FALSE;
+      g_string_append_printf (combined, "%s(?:%s)", combined->len > 0 ? "|" : "", pattern.c_str());
+
+      /* Always compile them individually too, to get errors for the right pattern */
+      GRegex *regex = g_regex_new (pattern.c_str(), G_REGEX_JAVASCRIPT_COMPAT,
+                                   static_cast<GRegexMatchFlags>(0), error);
+      if (!regex)
+        {
+          glnx_prefix_error (error, "Compiling remove-from-packages pattern '%s'", pattern.c_str());
+          return NULL;
+        }
+      g_ptr_array_add (regexes, regex);
+    }
+
+  if (can_combine && regexes->len > 1)
+    {
+      /* Each pattern compiles on its own, but they may still not combine, e.g.
+       * if two of them use the same group name; just keep them separate then */
+      GRegex *regex = g_regex_new (combined->str,
+                                   static_cast<GRegexCompileFlags>(G_REGEX_JAVASCRIPT_COMPAT | G_REGEX_OPTIMIZE),
+                                   static_cast<GRegexMatchFlags>(0), NULL);
+      if (regex)
+        {
+          g_ptr_array_set_size (regexes, 0);
+          g_ptr_array_add (regexes, regex);
+        }
+    }
+
+  auto matcher = g_new0 (FilesRemoveMatcher, 1);
+  matcher->prefixes = util::move_nullify (prefixes);
+  matcher->regexes = util::move_nullify (regexes);
+  return matcher;
+}
+
+static gboolean
+files_remove_matcher_matches (FilesRemoveMatcher *matcher,
+                              const char         *path)
+{
+  if (matcher->prefixes)
+    {
+      gboolean have_prefix = FALSE;
+      for (guint i = 0; i < matcher->prefixes->len && !have_prefix; i++)
+        have_prefix = g_str_has_prefix (path, static_cast<const char*>(matcher->prefixes->pdata[i]));
+      if (!have_prefix)
+        return FALSE;
+    }
+
+  for (guint i = 0; i < matcher->regexes->len; i++)
+    {
+      auto regex = static_cast<GRegex *>(g_ptr_array_index (matcher->regexes, i));
+      if (g_regex_match (regex, path, static_cast<GRegexMatchFlags>(0), NULL))
+        return TRUE;
+    }
+  return FALSE;
+}
+
+/* Returns the matcher for the `remove-from-packages` patterns of @pkg, or %NULL
+ * if there are none.  Returns %FALSE on error. */
+static gboolean
+get_files_remove_matcher (RpmOstreeContext    *self,
+                          DnfPackage          *pkg,
+                          FilesRemoveMatcher **out_matcher,
+                          GError             **error)
+{
+  *out_matcher = NULL;
+  /* Only on the compose side, from the treefile */
+  if (!self->treefile_rs)
+    return TRUE;
+
+  const char *name = dnf_package_get_name (pkg);
+  if (!self->files_remove_matchers)
+    self->files_remove_matchers =
+      g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                             (GDestroyNotify)files_remove_matcher_free);
+  gpointer matcher = NULL;
+  if (g_hash_table_lookup_extended (self->files_remove_matchers, name, NULL, &matcher))
+    {
+      *out_matcher = static_cast<FilesRemoveMatcher*>(matcher);
+      return TRUE;
+    }
+
+  auto patterns = self->treefile_rs->get_files_remove_regex(name);
+  if (patterns.size() > 0)
+    {
+      matcher = files_remove_matcher_new (patterns, error);
+      if (!matcher)
+        return FALSE;
+    }
+  /* NB: we cache negative results too */
+  g_hash_table_insert (self->files_remove_matchers, g_strdup (name), matcher);
+  *out_matcher = static_cast<FilesRemoveMatcher*>(matcher);
+  return TRUE;
+}
+
 typedef struct {
   GHashTable *files_skip;
-  GPtrArray  *files_remove_regex;
+  FilesRemoveMatcher *files_remove;
 } FilterData;
 
 static OstreeRepoCheckoutFilterResult
@@ -2757,7 +3275,7 @@ checkout_filter (OstreeRepo         *self,
                  gpointer            user_data)
 {
   GHashTable *files_skip = ((FilterData*)user_data)->files_skip;
-  GPtrArray *files_remove_regex = ((FilterData*)user_data)->files_remove_regex;
+  FilesRemoveMatcher *files_remove = ((FilterData*)user_data)->files_remove;
 
   if (files_skip && g_hash_table_size (files_skip) > 0)
     {
@@ -2765,19 +3283,12 @@ checkout_filter (OstreeRepo         *self,
         return OSTREE_REPO_CHECKOUT_FILTER_SKIP;
     }
 
-  if (files_remove_regex)
+  if (files_remove && files_remove_matcher_matches (files_remove, path))
     {
-      for (guint i = 0; i < files_remove_regex->len; i++)
-        {
-          auto regex = static_cast<GRegex *>(g_ptr_array_index (files_remove_regex, i));
-          if (g_regex_match (regex, path, static_cast<GRegexMatchFlags>(0), NULL))
-            {
-              g_print ("Skipping file %s from checkout\n", path);
-              return OSTREE_REPO_CHECKOUT_FILTER_SKIP;
-            }
-        }
+      g_print ("Skipping file %s from checkout\n", path);
+      return OSTREE_REPO_CHECKOUT_FILTER_SKIP;
     }
-  
+
   /* Hack for nsswitch.conf: the glibc.i686 copy is identical to the one in glibc.x86_64,
    * but because we modify it at treecompose time, UNION_IDENTICAL wouldn't save us here. A
    * better heuristic here might be to skip all /etc files which have a different digest
@@ -2795,7 +3306,7 @@ checkout_package (OstreeRepo   *repo,
                   OstreeRepoDevInoCache *devino_cache,
                   const char   *pkg_commit,
                   GHashTable   *files_skip,
-                  GPtrArray    *files_remove_regex,
+                  FilesRemoveMatcher *files_remove,
                   OstreeRepoCheckoutOverwriteMode ovwmode,
                   gboolean      force_copy_zerosized,
                   GCancellable *cancellable,
@@ -2816,9 +3327,8 @@ checkout_package (OstreeRepo   *repo,
   opts.force_copy_zerosized = force_copy_zerosized;
 
   /* If called by `checkout_package_into_root()`, there may be files that need to be filtered. */
-  FilterData filter_data = { files_skip, files_remove_regex, };
-  if ((files_skip && g_hash_table_size (files_skip) > 0) ||
-      (files_remove_regex && files_remove_regex->len > 0))
+  FilterData filter_data = { files_skip, files_remove, };
+  if ((files_skip && g_hash_table_size (files_skip) > 0) || files_remove)
       {
         opts.filter = checkout_filter;
         opts.filter_user_data = &filter_data;
@@ -2828,6 +3338,35 @@ checkout_package (OstreeRepo   *repo,
                                   pkg_commit, cancellable, error);
 }
 
+/* Link the content of all packages we're about to check out into our repo in one go,
+ * if the pkgcache is a separate repo.  That's currently the case only in the
+ * --unified-core path. We probably want to migrate that over to always use a separate
+ * cache repo eventually, which would allow us to completely drop the
+ * pkgcache_repo/ostreerepo dichotomy in the core. See:
+ * https://github.com/projectatomic/rpm-ostree/pull/1055 */
+static gboolean
+link_cached_content (RpmOstreeContext *self,
+                     GHashTable       *pkg_to_ostree_commit,
+                     GCancellable     *cancellable,
+                     GError          **error)
+{
+  OstreeRepo *pkgcache_repo = get_pkgcache_repo (self);
+  if (pkgcache_repo == self->ostreerepo || g_hash_table_size (pkg_to_ostree_commit) == 0)
+    return TRUE;
+
+  auto task = rpmostreecxx::progress_begin_task("Linking cached content");
+  g_autoptr(GPtrArray) commits = g_ptr_array_new ();
+  GLNX_HASH_TABLE_FOREACH_V (pkg_to_ostree_commit, const char*, commit)
+    g_ptr_array_add (commits, (char*)commit);
+  guint n_imported = 0;
+  if (!rpmostree_pull_content_only (self->ostreerepo, pkgcache_repo, commits, &n_imported,
+                                    cancellable, error))
+    return glnx_prefix_error (error, "Linking cached content");
+  g_autofree char *msg = g_strdup_printf ("%u new objects", n_imported);
+  task->end(msg);
+  return TRUE;
+}
+
 static gboolean
 checkout_package_into_root (RpmOstreeContext *self,
                             DnfPackage   *pkg,
@@ -2841,38 +3380,16 @@ checkout_package_into_root (RpmOstreeContext *self,
                             GError      **error)
 {
   /* If called on compose-side, there may be files to remove from packages specified in the treefile. */
-  g_autoptr(GPtrArray) files_remove_regex = NULL;
-  if (self->treefile_rs)
-    {
-      auto files_remove_regex_patterns = self->treefile_rs->get_files_remove_regex(dnf_package_get_name (pkg));
-      files_remove_regex = g_ptr_array_new_full (files_remove_regex_patterns.size(), (GDestroyNotify)g_regex_unref);
-      for (auto pattern : files_remove_regex_patterns) 
-        {
-          GRegex *regex = g_regex_new (pattern.c_str(), G_REGEX_JAVASCRIPT_COMPAT, static_cast<GRegexMatchFlags>(0), NULL);
-          if (!regex)
-            return FALSE;
-          g_ptr_array_add (files_remove_regex, regex);
-        }
-    }
-  
-  OstreeRepo *pkgcache_repo = get_pkgcache_repo (self);
+  FilesRemoveMatcher *files_remove = NULL;
+  if (!get_files_remove_matcher (self, pkg, &files_remove, error))
+    return FALSE;
 
-  /* The below is currently TRUE only in the --unified-core path. We probably want to
-   * migrate that over to always use a separate cache repo eventually, which would allow us
-   * to completely drop the pkgcache_repo/ostreerepo dichotomy in the core. See:
-   * https://github.com/projectatomic/rpm-ostree/pull/1055 */
-  if (pkgcache_repo != self->ostreerepo)
-    {
-      if (!rpmostree_pull_content_only (self->ostreerepo, pkgcache_repo, pkg_commit,
-                                        cancellable, error))
-        {
-          g_prefix_error (error, "Linking cached content for %s: ", dnf_package_get_nevra (pkg));
-          return FALSE;
-        }
-    }
+  OstreeRepo *pkgcache_repo = get_pkgcache_repo (self);
 
+  /* NB: if pkgcache_repo isn't our repo, its content was linked in beforehand;
+   * see link_cached_content() */
   if (!checkout_package (pkgcache_repo, dfd, path,
-                         devino_cache, pkg_commit, files_skip, files_remove_regex, ovwmode,
+                         devino_cache, pkg_commit, files_skip, files_remove, ovwmode,
                          !self->enable_rofiles,
                          cancellable, error))
     return glnx_prefix_error (error, "Checkout %s", dnf_package_get_nevra (pkg));
@@ -3321,7 +3838,7 @@ relabel_if_necessary (RpmOstreeContext *self,
   self->async_progress.release();
 
   /* Commit */
-  if (!ostree_repo_commit_transaction (ostreerepo, NULL, cancellable, error))
+  if (!rpmostree_repo_auto_transaction_commit (&txn, NULL, cancellable, error))
     return FALSE;
 
   sd_journal_send ("MESSAGE_ID=" SD_ID128_FORMAT_STR, SD_ID128_FORMAT_VAL(RPMOSTREE_MESSAGE_SELINUX_RELABEL),
@@ -3809,6 +4326,148 @@ rpmostree_context_get_kernel_changed (RpmOstreeContext *self)
   return self->kernel_changed;
 }
 
+/* For when assembly is skipped because the tree was restored from a
+ * checkpoint; see perform_local_assembly() in the sysroot upgrader.
+ */
+void
+rpmostree_context_set_kernel_changed (RpmOstreeContext *self,
+                                      gboolean          changed)
+{
+  self->kernel_changed = changed;
+}
+
+/* Set an opaque checksum of everything that went into assembling the
+ * tmprootfs, so that callers can later find a client layered commit to reuse
+ * instead of assembling the same thing again. */
+void
+rpmostree_context_set_assembly_checksum (RpmOstreeContext *self,
+                                         const char       *checksum)
+{
+  g_free (self->assembly_checksum);
+  self->assembly_checksum = g_strdup (checksum);
+}
+
+/* We keep a copy of each ostree layer relabeled for the target policy under
+ * RPMOSTREE_RELABELED_LAYER_PREFIX; see relabel_ostree_layer(). */
+static char *
+relabeled_layer_ref (const char *ref)
+{
+  char *relabeled_ref = g_strconcat (RPMOSTREE_RELABELED_LAYER_PREFIX "/", ref, NULL);
+  /* ref may be a refspec; the remote just becomes a path component */
+  g_strdelimit (relabeled_ref, ":", '/');
+  return relabeled_ref;
+}
+
+/* Return whether @commit is the relabeled copy of @source for @sepolicy. */
+static gboolean
+relabeled_layer_is_current (GVariant       *commit,
+                            const char     *source,
+                            OstreeSePolicy *sepolicy,
+                            gboolean       *out_current,
+                            GError        **error)
+{
+  *out_current = FALSE;
+  g_autoptr(GVariant) meta = g_variant_get_child_value (commit, 0);
+  const char *commit_source = NULL;
+  if (!g_variant_lookup (meta, "rpmostree.layer-source", "&s", &commit_source) ||
+      !g_str_equal (commit_source, source))
+    return TRUE;
+  return commit_has_matching_sepolicy (commit, sepolicy, out_current, error);
+}
+
+/* The layer commits themselves are input we can't modify, and they're
+ * generally not labeled for the policy of the tree we're composing, so if
+ * we checked them out with a devino cache, the commit would end up with the
+ * wrong labels.  So like we do for the pkgcache (see relabel_in_thread_impl()),
+ * keep a relabeled copy of each layer, and check out that instead.  It's only
+ * rewritten when the layer or the policy changes.
+ */
+static gboolean
+relabel_ostree_layer (RpmOstreeContext *self,
+                      const char       *ref,
+                      const char       *rev,
+                      char            **out_relabeled_rev,
+                      GCancellable     *cancellable,
+                      GError          **error)
+{
+  OstreeRepo *repo = self->ostreerepo;
+  g_autofree char *relabeled_ref = relabeled_layer_ref (ref);
+
+  g_autofree char *relabeled_rev = NULL;
+  if (!ostree_repo_resolve_rev (repo, relabeled_ref, TRUE, &relabeled_rev, error))
+    return FALSE;
+  if (relabeled_rev)
+    {
+      g_autoptr(GVariant) commit = NULL;
+      if (!ostree_repo_load_commit (repo, relabeled_rev, &commit, NULL, error))
+        return FALSE;
+      gboolean current = FALSE;
+      if (!relabeled_layer_is_current (commit, rev, self->sepolicy, &current, error))
+        return FALSE;
+      if (current)
+        {
+          *out_relabeled_rev = util::move_nullify (relabeled_rev);
+          return TRUE; /* Note early return */
+        }
+    }
+
+  g_autofree char *msg = g_strdup_printf ("Relabeling ostree layer %s", ref);
+  auto task = rpmostreecxx::progress_begin_task(msg);
+
+  g_auto(RpmOstreeRepoAutoTransaction) txn = { 0, };
+  if (!rpmostree_repo_auto_transaction_start (&txn, repo, FALSE, cancellable, error))
+    return FALSE;
+
+  g_auto(GLnxTmpDir) relabel_tmpdir = { 0, };
+  if (!glnx_mkdtempat (ostree_repo_get_dfd (repo), "tmp/rpm-ostree-relabel.XXXXXX", 0700,
+                       &relabel_tmpdir, error))
+    return FALSE;
+
+  /* Same as for packages: check out, and commit back with the policy applied */
+  g_autoptr(OstreeRepoDevInoCache) cache = ostree_repo_devino_cache_new ();
+  if (!checkout_package (repo, relabel_tmpdir.fd, "layer", cache, rev, NULL, NULL,
+                         OSTREE_REPO_CHECKOUT_OVERWRITE_NONE, FALSE, cancellable, error))
+    return FALSE;
+
+  g_autoptr(OstreeRepoCommitModifier) modifier =
+    ostree_repo_commit_modifier_new (OSTREE_REPO_COMMIT_MODIFIER_FLAGS_CONSUME,
+                                     NULL, NULL, NULL);
+  ostree_repo_commit_modifier_set_devino_cache (modifier, cache);
+  ostree_repo_commit_modifier_set_sepolicy (modifier, self->sepolicy);
+
+  g_autoptr(OstreeMutableTree) mtree = ostree_mutable_tree_new ();
+  if (!ostree_repo_write_dfd_to_mtree (repo, relabel_tmpdir.fd, "layer", mtree,
+                                       modifier, cancellable, error))
+    return glnx_prefix_error (error, "Writing dfd");
+
+  g_autoptr(GFile) root = NULL;
+  if (!ostree_repo_write_mtree (repo, mtree, &root, cancellable, error))
+    return FALSE;
+
+  g_autoptr(GVariant) orig_commit = NULL;
+  if (!ostree_repo_load_commit (repo, rev, &orig_commit, NULL, error))
+    return FALSE;
+  g_autoptr(GVariant) orig_meta = g_variant_get_child_value (orig_commit, 0);
+  g_autoptr(GVariantDict) meta_dict = g_variant_dict_new (orig_meta);
+  g_variant_dict_insert (meta_dict, "rpmostree.sepolicy", "s",
+                         ostree_sepolicy_get_csum (self->sepolicy));
+  g_variant_dict_insert (meta_dict, "rpmostree.layer-source", "s", rev);
+
+  g_autofree char *new_rev = NULL;
+  if (!ostree_repo_write_commit (repo, NULL, "", "",
+                                 g_variant_dict_end (meta_dict),
+                                 OSTREE_REPO_FILE (root), &new_rev,
+                                 cancellable, error))
+    return FALSE;
+
+  ostree_repo_transaction_set_ref (repo, NULL, relabeled_ref, new_rev);
+  if (!rpmostree_repo_auto_transaction_commit (&txn, NULL, cancellable, error))
+    return FALSE;
+
+  *out_relabeled_rev = util::move_nullify (new_rev);
+  return TRUE;
+}
+
 static gboolean
 process_one_ostree_layer (RpmOstreeContext *self,
                           int               rootfs_dfd,
@@ -3825,12 +4484,6 @@ process_one_ostree_layer (RpmOstreeContext *self,
   if (ostree_repo_get_mode (repo) == OSTREE_REPO_MODE_BARE)
     opts.mode = OSTREE_REPO_CHECKOUT_MODE_NONE;
 
-  /* Explicitly don't provide a devino cache here.  We can't do it reliably because
-   * of SELinux.  The ostree layering infrastructure doesn't have the relabeling
-   * that we do for the pkgcache repo because we can't assume that we can mutate
-   * the input commits right now.
-   * opts.devino_to_csum_cache = self->devino_cache;
-   */
   /* Always want hardlinks */
   opts.no_copy_fallback = TRUE;
 
@@ -3838,10 +4491,46 @@ process_one_ostree_layer (RpmOstreeContext *self,
   if (!ostree_repo_resolve_rev (repo, ref, FALSE, &rev, error))
     return FALSE;
 
+  /* With SELinux, we can only provide a devino cache if the labels in the
+   * checkout are already the ones the final commit will have. */
+  if (self->sepolicy)
+    {
+      g_autofree char *relabeled_rev = NULL;
+      if (!relabel_ostree_layer (self, ref, rev, &relabeled_rev, cancellable, error))
+        return glnx_prefix_error (error, "Relabeling %s", ref);
+      g_free (rev);
+      rev = util::move_nullify (relabeled_rev);
+    }
+  opts.devino_to_csum_cache = self->devino_cache;
+
   return ostree_repo_checkout_at (repo, &opts, rootfs_dfd, ".",
                                   rev, cancellable, error);
 }
 
+/* Drop the relabeled copies of layers the treefile doesn't use anymore, so they
+ * don't keep their commits around forever.
+ */
+static gboolean
+prune_relabeled_layers (RpmOstreeContext *self,
+                        GHashTable       *in_use,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+  OstreeRepo *repo = self->ostreerepo;
+  g_autoptr(GHashTable) refs = NULL;
+  if (!ostree_repo_list_refs_ext (repo, RPMOSTREE_RELABELED_LAYER_PREFIX, &refs,
+                                  OSTREE_REPO_LIST_REFS_EXT_NONE, cancellable, error))
+    return FALSE;
+  GLNX_HASH_TABLE_FOREACH (refs, const char*, ref)
+    {
+      if (g_hash_table_contains (in_use, ref))
+        continue;
+      if (!ostree_repo_set_ref_immediate (repo, NULL, ref, NULL, cancellable, error))
+        return FALSE;
+    }
+  return TRUE;
+}
+
 static gboolean
 process_ostree_layers (RpmOstreeContext *self,
                        int               rootfs_dfd,
@@ -3857,6 +4546,17 @@ process_ostree_layers (RpmOstreeContext *self,
   if (n == 0)
     return TRUE;
 
+  if (self->sepolicy)
+    {
+      g_autoptr(GHashTable) in_use = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      for (auto ref : layers)
+        g_hash_table_add (in_use, relabeled_layer_ref (ref.c_str()));
+      for (auto ref : override_layers)
+        g_hash_table_add (in_use, relabeled_layer_ref (ref.c_str()));
+      if (!prune_relabeled_layers (self, in_use, cancellable, error))
+        return FALSE;
+    }
+
   auto progress = rpmostreecxx::progress_nitems_begin(n, "Checking out ostree layers");
   size_t i = 0;
   for (auto ref : layers)
@@ -3881,6 +4581,82 @@ process_ostree_layers (RpmOstreeContext *self,
   return TRUE;
 }
 
+/* Runs rpmostree_deployment_sanitycheck_true() in its own thread; see its use
+ * in rpmostree_context_assemble().  If started, the thread is always joined,
+ * including on early returns.
+ */
+struct SanitycheckThread {
+  int rootfs_dfd = -1;
+  GCancellable *cancellable = NULL;
+  GThread *thread = NULL;
+  gboolean success = FALSE;
+  GError *error = NULL;
+  guint64 start_time_ms = 0;
+
+  static gpointer
+  run (gpointer data)
+  {
+    auto self = static_cast<SanitycheckThread *>(data);
+    try {
+      self->success = rpmostree_deployment_sanitycheck_true (self->rootfs_dfd, self->cancellable,
+                                                             &self->error);
+    } catch (std::exception& e) {
+      self->success = glnx_throw (&self->error, "%s", e.what());
+    }
+    return NULL;
+  }
+
+  void
+  start (int dfd, GCancellable *c)
+  {
+    g_assert (!thread);
+    rootfs_dfd = dfd;
+    cancellable = c;
+    start_time_ms = g_get_monotonic_time () / 1000;
+    thread = g_thread_new ("sanitycheck", run, this);
+  }
+
+  gboolean
+  join (GError **out_error)
+  {
+    g_assert (thread);
+    g_thread_join (util::move_nullify (thread));
+    if (!success)
+      {
+        g_propagate_error (out_error, util::move_nullify (error));
+        return FALSE;
+      }
+    return TRUE;
+  }
+
+  ~SanitycheckThread ()
+  {
+    if (thread)
+      g_thread_join (thread);
+    g_clear_error (&error);
+  }
+};
+
+/* The rpmdb is written with _dbpath pointing into the new root; put back the
+ * default on the way out, whichever way that is, because libsolv relies on it
+ * as well to find the rpmdb and RPM macros are global state.
+ */
+struct DbpathRestorer {
+  bool active = true;
+
+  void
+  restore ()
+  {
+    if (active)
+      set_rpm_macro_define ("_dbpath", "/" RPMOSTREE_RPMDB_LOCATION);
+    active = false;
+  }
+
+  ~DbpathRestorer() {
+    restore ();
+  }
+};
+
 gboolean
 rpmostree_context_assemble (RpmOstreeContext      *self,
                             GCancellable          *cancellable,
@@ -4025,6 +4801,9 @@ rpmostree_context_assemble (RpmOstreeContext      *self,
   g_assert (n_rpmts_elements > 0);
   guint n_rpmts_done = 0;
 
+  if (!link_cached_content (self, pkg_to_ostree_commit, cancellable, error))
+    return FALSE;
+
   auto progress = rpmostreecxx::progress_nitems_begin(n_rpmts_elements, progress_msg);
 
   /* Okay so what's going on in Fedora with incestuous relationship
@@ -4289,11 +5068,16 @@ rpmostree_context_assemble (RpmOstreeContext      *self,
 
       /* We want this to be the first error message if something went wrong
        * with a script; see https://github.com/projectatomic/rpm-ostree/pull/888
-       * (otherwise, on a script that did `rm -rf`, we'd fail first on the renameat below)
+       * (otherwise, on a script that did `rm -rf`, we'd fail first on the renameat below).
+       * The real check (running /usr/bin/true) happens below, in parallel with
+       * writing the rpmdb; here we only do the cheap part.
        */
-      if (!skip_sanity_check &&
-          !rpmostree_deployment_sanitycheck_true (tmprootfs_dfd, cancellable, error))
-        return FALSE;
+      if (!skip_sanity_check)
+        {
+          struct stat stbuf;
+          if (!glnx_fstatat (tmprootfs_dfd, "usr/bin/true", &stbuf, AT_SYMLINK_NOFOLLOW, error))
+            return glnx_prefix_error (error, "Sanity-checking final rootfs");
+        }
 
       if (have_passwd)
         {
@@ -4303,13 +5087,6 @@ rpmostree_context_assemble (RpmOstreeContext      *self,
         // Revert filesystem changes just for scripts.
         fs_prep->undo();
     }
-  else
-    {
-      /* Also do a sanity check even if we have no layered packages */
-      if (!skip_sanity_check &&
-          !rpmostree_deployment_sanitycheck_true (tmprootfs_dfd, cancellable, error))
-        return FALSE;
-    }
 
   if (self->treefile_rs && self->treefile_rs->get_cliwrap())
     rpmostreecxx::cliwrap_write_wrappers (tmprootfs_dfd);
@@ -4326,6 +5103,14 @@ rpmostree_context_assemble (RpmOstreeContext      *self,
 
   g_clear_pointer (&ordering_ts, rpmtsFree);
 
+  /* Everything but the rpmdb is in place now, so start checking that we can
+   * run things in the new root (even if we have no layered packages); bwrap
+   * is slow enough to start that it's worth overlapping with the rpmdb.
+   */
+  SanitycheckThread sanitycheck;
+  if (!skip_sanity_check)
+    sanitycheck.start (tmprootfs_dfd, cancellable);
+
   auto task = rpmostreecxx::progress_begin_task("Writing rpmdb");
 
   if (!glnx_shutil_mkdir_p_at (tmprootfs_dfd, RPMOSTREE_RPMDB_LOCATION, 0755, cancellable, error))
@@ -4338,6 +5123,7 @@ rpmostree_context_assemble (RpmOstreeContext      *self,
    *
    * Instead, this rpmts has the dbpath as absolute.
    */
+  DbpathRestorer restore_dbpath;
   { g_autofree char *rpmdb_abspath = glnx_fdrel_abspath (tmprootfs_dfd,
                                                          RPMOSTREE_RPMDB_LOCATION);
 
@@ -4420,16 +5206,22 @@ rpmostree_context_assemble (RpmOstreeContext      *self,
 
   task->end("");
 
-  /* And finally revert the _dbpath setting because libsolv relies on it as well
-   * to find the rpmdb and RPM macros are global state. */
-  set_rpm_macro_define ("_dbpath", "/" RPMOSTREE_RPMDB_LOCATION);
+  /* libsolv needs the default _dbpath to find the rpmdb in the new root */
+  restore_dbpath.restore ();
 
   /* And now also sanity check the rpmdb */
   if (!skip_sanity_check)
     {
+      auto check_task = rpmostreecxx::progress_begin_task("Sanity-checking deployment");
       if (!rpmostree_deployment_sanitycheck_rpmdb (tmprootfs_dfd, overlays,
                                                    overrides_replace, cancellable, error))
         return FALSE;
+      if (!sanitycheck.join (error))
+        return FALSE;
+      guint64 elapsed_ms = g_get_monotonic_time () / 1000 - sanitycheck.start_time_ms;
+      sd_journal_print (LOG_INFO, "sanitycheck successful in %" G_GUINT64_FORMAT " ms", elapsed_ms);
+      g_autofree char *msg = g_strdup_printf ("%" G_GUINT64_FORMAT " ms", elapsed_ms);
+      check_task->end(msg);
     }
 
   return TRUE;
@@ -4524,6 +5316,10 @@ rpmostree_context_commit (RpmOstreeContext      *self,
           return FALSE;
         g_variant_builder_add (&metadata_builder, "{sv}", "rpmostree.rpmdb.pkglist", rpmdb);
 
+        if (self->assembly_checksum)
+          g_variant_builder_add (&metadata_builder, "{sv}", "rpmostree.assembly-sha256",
+                                 g_variant_new_string (self->assembly_checksum));
+
         /* be nice to our future selves */
         g_variant_builder_add (&metadata_builder, "{sv}",
                                "rpmostree.clientlayer_version",
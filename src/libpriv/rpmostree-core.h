@@ -47,8 +47,13 @@ G_BEGIN_DECLS
 #define RPMOSTREE_SYSIMAGE_RPMDB RPMOSTREE_SYSIMAGE_DIR "/rpm"
 #define RPMOSTREE_BASE_RPMDB RPMOSTREE_SYSIMAGE_DIR "/rpm-ostree-base-db"
 
+/* Copies of ostree layers relabeled for the policy of the tree being composed */
+#define RPMOSTREE_RELABELED_LAYER_PREFIX "rpmostree/layer"
+
 /* put it in cache dir so it gets destroyed naturally with a `cleanup -m` */
 #define RPMOSTREE_AUTOUPDATES_CACHE_FILE RPMOSTREE_CORE_CACHEDIR "cached-update.gv"
+/* Layered commit assembled ahead of time by the "prepare" automatic update policy */
+#define RPMOSTREE_PREPARED_UPDATE_FILE RPMOSTREE_CORE_CACHEDIR "prepared-update.gv"
 
 #define RPMOSTREE_STATE_DIR "/var/lib/rpm-ostree/"
 #define RPMOSTREE_HISTORY_DIR RPMOSTREE_STATE_DIR "history"
@@ -130,6 +135,7 @@ const char *rpmostree_context_get_ref (RpmOstreeContext *self);
 void rpmostree_context_set_repos (RpmOstreeContext *self,
                                   OstreeRepo       *base_repo,
                                   OstreeRepo       *pkgcache_repo);
+void rpmostree_context_set_pkgcache_shared (RpmOstreeContext *self);
 void rpmostree_context_set_devino_cache (RpmOstreeContext *self,
                                          OstreeRepoDevInoCache *devino_cache);
 void rpmostree_context_disable_rofiles (RpmOstreeContext *self);
@@ -207,6 +213,10 @@ void rpmostree_context_set_tmprootfs_dfd (RpmOstreeContext *self,
 int rpmostree_context_get_tmprootfs_dfd  (RpmOstreeContext *self);
 
 gboolean rpmostree_context_get_kernel_changed (RpmOstreeContext *self);
+void rpmostree_context_set_kernel_changed (RpmOstreeContext *self,
+                                           gboolean          changed);
+void rpmostree_context_set_assembly_checksum (RpmOstreeContext *self,
+                                              const char       *checksum);
 
 /* NB: tmprootfs_dfd is allowed to have pre-existing data */
 /* devino_cache can be NULL if no previous cache established */
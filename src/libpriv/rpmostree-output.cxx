@@ -26,6 +26,10 @@
 #include "rpmostree-util.h"
 #include "rpmostree-cxxrs.h"
 
+/* Minimum interval between two progress updates sent to the output
+ * backend; both the console and D-Bus signals are rate limited by this. */
+#define PROGRESS_UPDATE_INTERVAL_US (100 * G_TIME_SPAN_MILLISECOND)
+
 /* These are helper functions that automatically determine whether data should
  * be sent through an appropriate D-Bus signal or sent directly to the local
  * terminal. This is helpful in situations in which code may be executed both
@@ -139,15 +143,41 @@ progress_nitems_begin(guint n, const rust::Str msg) noexcept
   auto msg_c = std::string(msg);
   RpmOstreeOutputProgressBegin begin = { msg_c.c_str(), false, n };
   active_cb (RPMOSTREE_OUTPUT_PROGRESS_BEGIN, &begin, active_cb_opaque);
-  return std::make_unique<Progress>(ProgressType::N_ITEMS);
+  return std::make_unique<Progress>(ProgressType::N_ITEMS, n);
+}
+
+// Record a new value; forward it to the backend if nobody else
+// has done so during the current tick.  The final value is always sent.
+void
+Progress::update(guint n)
+{
+  this->current.store (n, std::memory_order_relaxed);
+
+  gint64 now = g_get_monotonic_time ();
+  gint64 last = this->last_emit_time.load (std::memory_order_relaxed);
+  if (n != this->total && now - last < PROGRESS_UPDATE_INTERVAL_US)
+    return;
+  if (!this->last_emit_time.compare_exchange_strong (last, now, std::memory_order_relaxed))
+    return;
+  this->flush ();
+}
+
+// Send the latest recorded value, unless it was already sent.
+void
+Progress::flush()
+{
+  guint c = this->current.load (std::memory_order_relaxed);
+  if (this->emitted.exchange (c, std::memory_order_relaxed) == c)
+    return;
+  RpmOstreeOutputProgressUpdate progress = { c };
+  active_cb (RPMOSTREE_OUTPUT_PROGRESS_UPDATE, &progress, active_cb_opaque);
 }
 
 // Update the nitems counter.
 void 
 Progress::nitems_update(guint n)
 {
-  RpmOstreeOutputProgressUpdate progress = { n };
-  active_cb (RPMOSTREE_OUTPUT_PROGRESS_UPDATE, &progress, active_cb_opaque);
+  this->update (n);
 }
 
 // Start a percentage task.
@@ -157,15 +187,14 @@ progress_percent_begin(const rust::Str msg) noexcept
   auto msg_c = std::string(msg);
   RpmOstreeOutputProgressBegin begin = { msg_c.c_str(), true, 0 };
   active_cb (RPMOSTREE_OUTPUT_PROGRESS_BEGIN, &begin, active_cb_opaque);
-  return std::make_unique<Progress>(ProgressType::PERCENT);
+  return std::make_unique<Progress>(ProgressType::PERCENT, 100);
 }
 
 // Update the percentage.
 void
 Progress::percent_update(guint n)
 {
-  RpmOstreeOutputProgressUpdate progress = { (guint)n };
-  active_cb (RPMOSTREE_OUTPUT_PROGRESS_UPDATE, &progress, active_cb_opaque);
+  this->update (n);
 }
 
 // End the current task.
@@ -173,6 +202,8 @@ void
 Progress::end(const rust::Str msg)
 {
   g_assert (!this->ended);
+  if (this->ptype != ProgressType::TASK)
+    this->flush ();
   g_autofree char *final_msg = util::ruststr_dup_c_optempty(msg);
   RpmOstreeOutputProgressEnd done = { final_msg };
   active_cb (RPMOSTREE_OUTPUT_PROGRESS_END, &done, active_cb_opaque);
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <atomic>
 #include <memory>
 #include "rust/cxx.h"
 
@@ -44,12 +45,23 @@ public:
     if (!this->ended)
       this->end("");
   }
-  Progress(ProgressType t) {
+  Progress(ProgressType t, guint total = 0) {
     ptype = t;
     ended = false;
+    this->total = total;
   }
   ProgressType ptype;
   bool ended;
+private:
+  void update(guint n);
+  void flush();
+  // Updates may come from many worker threads; they only store the
+  // new value and at most one of them per tick forwards it to the
+  // output backend.
+  guint total;
+  std::atomic<guint> current{0};
+  std::atomic<guint> emitted{0};
+  std::atomic<gint64> last_emit_time{0};
 };
 
 std::unique_ptr<Progress> progress_begin_task(rust::Str msg) noexcept;
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2021 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+/* Paths shared between the daemon and the client */
+
+#define RPMOSTREED_CONF SYSCONFDIR "/rpm-ostreed.conf"
+
+#define RPMOSTREE_RUN_DIR "/run/rpm-ostree/"
+/* Last known state of the host, for `status` without the daemon; see
+ * rpmostreed_sysroot_write_status_snapshot() */
+#define RPMOSTREE_STATUS_SNAPSHOT RPMOSTREE_RUN_DIR "status.gv"
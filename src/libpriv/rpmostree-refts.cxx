@@ -23,6 +23,8 @@
 #include <string.h>
 #include "rpmostree-refts.h"
 #include "rpmostree-rpm-util.h"
+#include "rpmostree-util.h"
+#include "rpmostree-cxxrs.h"
 
 /*
  * A wrapper for an `rpmts` that supports:
@@ -61,3 +63,79 @@ rpmostree_refts_unref (RpmOstreeRefTs *rts)
   (void)glnx_tmpdir_delete (&rts->tmpdir, NULL, NULL);
   g_free (rts);
 }
+
+namespace rpmostreecxx {
+
+// Open the rpmdb of a commit.
+std::unique_ptr<RpmTs>
+rpmts_for_commit(OstreeRepo &repo, rust::Str rev)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(RpmOstreeRefTs) refts = NULL;
+  auto rev_c = std::string(rev);
+  if (!rpmostree_get_refts_for_commit (&repo, rev_c.c_str(), &refts, NULL, &local_error))
+    util::throw_gerror(local_error);
+  return std::make_unique<RpmTs>(util::move_nullify (refts));
+}
+
+// Timestamps of the %changelog entries, newest first.
+static rust::Vec<uint64_t>
+header_changelogs (Header h)
+{
+  rust::Vec<uint64_t> ret;
+  struct rpmtd_s td;
+  if (!headerGet (h, RPMTAG_CHANGELOGTIME, &td, HEADERGET_MINMEM))
+    return ret;
+  uint32_t *t;
+  while ((t = rpmtdNextUint32 (&td)) != NULL)
+    ret.push_back(*t);
+  rpmtdFreeData (&td);
+  return ret;
+}
+
+// Absolute paths of all files owned by the package, translated to where they
+// end up in an ostree commit (e.g. /etc -> /usr/etc).
+static rust::Vec<rust::String>
+header_paths (Header h)
+{
+  rust::Vec<rust::String> ret;
+  g_auto(rpmfi) fi = rpmfiNew (NULL, h, RPMTAG_BASENAMES, RPMFI_FLAGS_ONLY_FILENAMES);
+  fi = rpmfiInit (fi, 0);
+  while (rpmfiNext (fi) >= 0)
+    {
+      const char *fn = rpmfiFN (fi);
+      g_autofree char *translated = rpmostree_translate_path_for_ostree (fn + strspn (fn, "/"));
+      if (translated)
+        {
+          g_autofree char *abspath = g_strconcat ("/", translated, NULL);
+          ret.push_back(rust::String(abspath));
+        }
+      else
+        ret.push_back(rust::String(fn));
+    }
+  return ret;
+}
+
+// List installed packages, in a single pass over the rpmdb.  Note the same
+// `name.arch` may occur more than once, e.g. for installonly packages.
+rust::Vec<PackageMeta>
+RpmTs::packages() const
+{
+  rust::Vec<PackageMeta> ret;
+  g_auto(rpmdbMatchIterator) mi = rpmtsInitIterator (ts_->ts, RPMDBI_PACKAGES, NULL, 0);
+  Header h;
+  while ((h = rpmdbNextIterator (mi)) != NULL)
+    {
+      /* e.g. gpg-pubkey has no arch */
+      const char *arch = headerGetString (h, RPMTAG_ARCH) ?: "";
+      g_autofree char *namearch = g_strconcat (headerGetString (h, RPMTAG_NAME), ".", arch, NULL);
+      PackageMeta meta;
+      meta.name = rust::String(namearch);
+      meta.changelogs = header_changelogs (h);
+      meta.paths = header_paths (h);
+      ret.push_back(std::move(meta));
+    }
+  return ret;
+}
+
+} /* namespace */
@@ -22,8 +22,12 @@
 #pragma once
 
 #include <gio/gio.h>
+#include <ostree.h>
 #include <libdnf/libdnf.h>
+#include <rpm/rpmts.h>
+#include <memory>
 #include "libglnx.h"
+#include "rust/cxx.h"
 
 G_BEGIN_DECLS
 
@@ -45,3 +49,25 @@ rpmostree_refts_unref (RpmOstreeRefTs *rts);
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(RpmOstreeRefTs, rpmostree_refts_unref);
 
 G_END_DECLS
+
+// C++ APIs here
+namespace rpmostreecxx {
+
+// Shared with Rust; see lib.rs.
+struct PackageMeta;
+
+// A read-only view of an rpmdb, e.g. the one in a commit.
+class RpmTs final {
+public:
+  RpmTs(RpmOstreeRefTs *ts) : ts_(ts) {}
+  ~RpmTs() { rpmostree_refts_unref(ts_); }
+
+  rust::Vec<PackageMeta> packages() const;
+
+private:
+  RpmOstreeRefTs *ts_;
+};
+
+std::unique_ptr<RpmTs> rpmts_for_commit(OstreeRepo &repo, rust::Str rev);
+
+} /* namespace */
@@ -1605,6 +1605,23 @@ advisory_free (gpointer p)
     dnf_advisory_free (adv);
 }
 
+/* Looking up the advisories for a package means searching through all of the
+ * updateinfo in @sack, which adds up quickly with many packages and advisories.
+ * Instead, find all the packages fixed by security advisories in a single pass,
+ * so that only those need to be looked up.  Returns a set of NEVRAs.
+ */
+static GHashTable *
+get_security_fixed_nevras (DnfSack *sack)
+{
+  g_autoptr(GHashTable) nevras = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  hy_autoquery HyQuery query = hy_query_create (sack);
+  hy_query_filter (query, HY_PKG_ADVISORY_TYPE, HY_EQ, "security");
+  g_autoptr(GPtrArray) pkgs = hy_query_run (query);
+  for (guint i = 0; i < pkgs->len; i++)
+    g_hash_table_add (nevras, g_strdup (dnf_package_get_nevra (static_cast<DnfPackage*>(pkgs->pdata[i]))));
+  return util::move_nullify (nevras);
+}
+
 /* Go through the list of @pkgs and check if there are any advisories open for them. If
  * no advisories are found, returns %NULL. Otherwise, returns a GVariant of the type
  * RPMOSTREE_UPDATE_ADVISORY_GVARIANT_FORMAT.
@@ -1617,11 +1634,18 @@ rpmostree_advisories_variant (DnfSack    *sack,
     g_hash_table_new_full (advisory_hash, advisory_equal, advisory_free,
                            (GDestroyNotify)g_ptr_array_unref);
 
+  g_autoptr(GHashTable) security_fixed = NULL;
+  if (pkgs->len > 0)
+    security_fixed = get_security_fixed_nevras (sack);
+
   /* libdnf provides pkg -> set of advisories, but we want advisory -> set of pkgs;
    * making sure we only keep the pkgs we actually care about */
   for (guint i = 0; i < pkgs->len; i++)
     {
       auto pkg = static_cast<DnfPackage *>(pkgs->pdata[i]);
+      if (!g_hash_table_contains (security_fixed, dnf_package_get_nevra (pkg)))
+        continue;
+
       g_autoptr(GPtrArray) advisories_with_pkg = dnf_package_get_advisories (pkg, HY_EQ);
       for (guint j = 0; j < advisories_with_pkg->len; j++)
         {
@@ -993,8 +993,10 @@ verify_packages_in_sack (DnfSack      *sack,
 /* Check that we can load the rpmdb. See
  * https://github.com/projectatomic/rpm-ostree/issues/1566.
  *
- * This is split out of the one above for practical reasons: the check above runs right
- * after scripts are executed to give a nicer error if the scripts did `rm -rf`.
+ * This is split out of the one above for practical reasons: it can only run once the
+ * rpmdb is written, while the check above can run in parallel with that.  Note this
+ * deliberately loads the rpmdb with libsolv, the same way later operations on the
+ * deployment will.
  */
 gboolean
 rpmostree_deployment_sanitycheck_rpmdb (int           rootfs_fd,
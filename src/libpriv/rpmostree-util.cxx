@@ -332,12 +332,15 @@ rpmostree_checksum_version (GVariant *checksum)
   return g_strdup (ret);
 }
 
+/* Gather the content objects of the tree at @iter into @files.  Packages commonly
+ * share dirtrees (e.g. for empty directories), so only walk each once. */
 static gboolean
-pull_content_only_recurse (OstreeRepo  *dest,
-                           OstreeRepo  *src,
-                           OstreeRepoCommitTraverseIter *iter,
-                           GCancellable *cancellable,
-                           GError      **error)
+collect_content_objects (OstreeRepo  *src,
+                         OstreeRepoCommitTraverseIter *iter,
+                         GHashTable  *seen_dirtrees,
+                         GHashTable  *files,
+                         GCancellable *cancellable,
+                         GError      **error)
 {
   gboolean done = FALSE;
 
@@ -359,10 +362,8 @@ pull_content_only_recurse (OstreeRepo  *dest,
             char *checksum;
 
             ostree_repo_commit_traverse_iter_get_file (iter, &name, &checksum);
-
-            if (!ostree_repo_import_object_from (dest, src, OSTREE_OBJECT_TYPE_FILE,
-                                                 checksum, cancellable, error))
-              return FALSE;
+            if (!g_hash_table_contains (files, checksum))
+              g_hash_table_add (files, g_strdup (checksum));
           }
           break;
         case OSTREE_REPO_COMMIT_ITER_RESULT_DIR:
@@ -375,6 +376,9 @@ pull_content_only_recurse (OstreeRepo  *dest,
               OstreeRepoCommitTraverseIter subiter = { 0, };
 
             ostree_repo_commit_traverse_iter_get_dir (iter, &name, &content_checksum, &meta_checksum);
+            if (g_hash_table_contains (seen_dirtrees, content_checksum))
+              break;
+            g_hash_table_add (seen_dirtrees, g_strdup (content_checksum));
 
             if (!ostree_repo_load_variant (src, OSTREE_OBJECT_TYPE_DIR_TREE,
                                            content_checksum, &dirtree,
@@ -386,7 +390,8 @@ pull_content_only_recurse (OstreeRepo  *dest,
                                                                 error))
               return FALSE;
 
-            if (!pull_content_only_recurse (dest, src, &subiter, cancellable, error))
+            if (!collect_content_objects (src, &subiter, seen_dirtrees, files,
+                                          cancellable, error))
               return FALSE;
           }
           break;
@@ -396,31 +401,241 @@ pull_content_only_recurse (OstreeRepo  *dest,
   return TRUE;
 }
 
-/* Migrate only the content (.file) objects from src+src_commit into dest.
- * Used for package layering.
+typedef struct {
+  guint n;
+  RpmOstreeParallelFunc func;
+  gpointer user_data;
+  gint next;     /* atomic; index of the next item to claim */
+  gint failed;   /* atomic */
+  GMutex lock;   /* protects error */
+  GError *error;
+} ParallelFor;
+
+static gpointer
+parallel_for_worker (gpointer data)
+{
+  auto pfor = static_cast<ParallelFor*>(data);
+
+  while (!g_atomic_int_get (&pfor->failed))
+    {
+      guint i = (guint)g_atomic_int_add (&pfor->next, 1);
+      if (i >= pfor->n)
+        break;
+
+      g_autoptr(GError) local_error = NULL;
+      if (!pfor->func (i, pfor->user_data, &local_error))
+        {
+          g_mutex_lock (&pfor->lock);
+          if (!pfor->error)
+            pfor->error = util::move_nullify (local_error);
+          g_mutex_unlock (&pfor->lock);
+          g_atomic_int_set (&pfor->failed, TRUE);
+          break;
+        }
+    }
+
+  return NULL;
+}
+
+/**
+ * rpmostree_parallel_for:
+ *
+ * Call @func for each index in [0, @n), spread over as many threads as the
+ * governor allows, including the calling one.  Items are handed out in order,
+ * and no new ones are started after one fails; the error of the first failure
+ * is returned.
+ */
+gboolean
+rpmostree_parallel_for (guint                  n,
+                        const char            *thread_name,
+                        RpmOstreeParallelFunc  func,
+                        gpointer               user_data,
+                        GError               **error)
+{
+  ParallelFor pfor = { n, func, user_data, };
+  g_mutex_init (&pfor.lock);
+
+  const guint n_workers = MIN (rpmostreecxx::governor_parallelism (), MAX (n, 1));
+  g_autoptr(GPtrArray) workers = g_ptr_array_new ();
+  for (guint i = 1; i < n_workers; i++)
+    g_ptr_array_add (workers, g_thread_new (thread_name, parallel_for_worker, &pfor));
+  /* Do our share here too */
+  parallel_for_worker (&pfor);
+  for (guint i = 0; i < workers->len; i++)
+    g_thread_join (static_cast<GThread*>(workers->pdata[i]));
+
+  g_mutex_clear (&pfor.lock);
+  if (pfor.error)
+    {
+      g_propagate_error (error, pfor.error);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+typedef struct {
+  OstreeRepo *dest;
+  OstreeRepo *src;
+  GPtrArray *objects; /* object names */
+  gboolean trusted;
+  GCancellable *cancellable;
+  gint n_imported; /* atomic */
+} ObjectImport;
+
+static gboolean
+import_one_object (guint     i,
+                   gpointer  data,
+                   GError  **error)
+{
+  auto import = static_cast<ObjectImport*>(data);
+  const char *checksum;
+  OstreeObjectType objtype;
+  ostree_object_name_deserialize (static_cast<GVariant*>(import->objects->pdata[i]),
+                                  &checksum, &objtype);
+
+  gboolean have_object = FALSE;
+  if (!ostree_repo_has_object (import->dest, objtype, checksum, &have_object,
+                               import->cancellable, error))
+    return FALSE;
+  if (have_object)
+    return TRUE;
+  if (!ostree_repo_import_object_from_with_trust (import->dest, import->src, objtype,
+                                                  checksum, import->trusted,
+                                                  import->cancellable, error))
+    return FALSE;
+  g_atomic_int_inc (&import->n_imported);
+  return TRUE;
+}
+
+/* Import the @objects missing from @dest, in parallel.  This hardlinks objects
+ * when the repo modes allow for it, and copies them otherwise. */
+static gboolean
+import_missing_objects (OstreeRepo   *dest,
+                        OstreeRepo   *src,
+                        GPtrArray    *objects,
+                        gboolean      trusted,
+                        guint        *out_n_imported,
+                        GCancellable *cancellable,
+                        GError      **error)
+{
+  ObjectImport import = { dest, src, objects, trusted, cancellable, };
+  if (!rpmostree_parallel_for (objects->len, "rpmostree-import", import_one_object,
+                               &import, error))
+    return FALSE;
+
+  if (out_n_imported)
+    *out_n_imported = import.n_imported;
+  return TRUE;
+}
+
+/* Migrate only the content (.file) objects from @src_commits in src into dest.
+ * Used for package layering.  The objects of all commits are gathered first,
+ * so that each is only looked at once, and the ones missing from @dest are
+ * then imported in parallel.
  */
 gboolean
 rpmostree_pull_content_only (OstreeRepo  *dest,
                              OstreeRepo  *src,
-                             const char  *src_commit,
+                             GPtrArray   *src_commits,
+                             guint       *out_n_imported,
                              GCancellable *cancellable,
                              GError      **error)
 {
-  g_autoptr(GVariant) commitdata = NULL;
-  ostree_cleanup_repo_commit_traverse_iter
-    OstreeRepoCommitTraverseIter iter = { 0, };
+  g_autoptr(GHashTable) seen_dirtrees = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr(GHashTable) files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-  if (!ostree_repo_load_commit (src, src_commit, &commitdata, NULL, error))
+  for (guint i = 0; i < src_commits->len; i++)
+    {
+      auto src_commit = static_cast<const char*>(src_commits->pdata[i]);
+      g_autoptr(GVariant) commitdata = NULL;
+      ostree_cleanup_repo_commit_traverse_iter
+        OstreeRepoCommitTraverseIter iter = { 0, };
+
+      if (!ostree_repo_load_commit (src, src_commit, &commitdata, NULL, error))
+        return FALSE;
+
+      if (!ostree_repo_commit_traverse_iter_init_commit (&iter, src, commitdata,
+                                                         OSTREE_REPO_COMMIT_TRAVERSE_FLAG_NONE,
+                                                         error))
+        return FALSE;
+
+      if (!collect_content_objects (src, &iter, seen_dirtrees, files, cancellable, error))
+        return glnx_prefix_error (error, "Traversing %s", src_commit);
+    }
+
+  g_autoptr(GPtrArray) objects =
+    g_ptr_array_new_full (g_hash_table_size (files), (GDestroyNotify)g_variant_unref);
+  GLNX_HASH_TABLE_FOREACH (files, const char*, checksum)
+    g_ptr_array_add (objects, g_variant_ref_sink (ostree_object_name_serialize (checksum, OSTREE_OBJECT_TYPE_FILE)));
+
+  return import_missing_objects (dest, src, objects, TRUE, out_n_imported, cancellable, error);
+}
+
+/* Copy @rev (a ref or a checksum) and everything it references from @src into
+ * @dest, like a local ostree_repo_pull() without any of the fetcher machinery.
+ * If @rev is a ref, it's set to the same commit in @dest.  Objects are only
+ * verified when @verify is set, since the local pull doesn't do so either.
+ */
+gboolean
+rpmostree_repo_transfer_commit (OstreeRepo   *src,
+                                OstreeRepo   *dest,
+                                const char   *rev,
+                                gboolean      verify,
+                                guint        *out_n_transferred,
+                                GCancellable *cancellable,
+                                GError      **error)
+{
+  g_autofree char *checksum = NULL;
+  if (!ostree_repo_resolve_rev (src, rev, FALSE, &checksum, error))
+    return FALSE;
+
+  g_autoptr(GHashTable) reachable = NULL;
+  if (!ostree_repo_traverse_commit (src, checksum, 0, &reachable, cancellable, error))
+    return FALSE;
+
+  /* The commit object goes in last, so that we never end up with a commit whose
+   * objects aren't all there. */
+  g_autoptr(GVariant) commit_name =
+    g_variant_ref_sink (ostree_object_name_serialize (checksum, OSTREE_OBJECT_TYPE_COMMIT));
+  g_autoptr(GPtrArray) objects =
+    g_ptr_array_new_full (g_hash_table_size (reachable), (GDestroyNotify)g_variant_unref);
+  GLNX_HASH_TABLE_FOREACH (reachable, GVariant*, object)
+    {
+      if (!g_variant_equal (object, commit_name))
+        g_ptr_array_add (objects, g_variant_ref (object));
+    }
+
+  g_auto(RpmOstreeRepoAutoTransaction) txn = { 0, };
+  if (!rpmostree_repo_auto_transaction_start (&txn, dest, FALSE, cancellable, error))
     return FALSE;
 
-  if (!ostree_repo_commit_traverse_iter_init_commit (&iter, src, commitdata,
-                                                     OSTREE_REPO_COMMIT_TRAVERSE_FLAG_NONE,
-                                                     error))
+  guint n_transferred = 0;
+  if (!import_missing_objects (dest, src, objects, !verify, &n_transferred,
+                               cancellable, error))
+    return FALSE;
+  g_autoptr(GPtrArray) commit_objects = g_ptr_array_new ();
+  g_ptr_array_add (commit_objects, commit_name);
+  guint n_commits_transferred = 0;
+  if (!import_missing_objects (dest, src, commit_objects, !verify, &n_commits_transferred,
+                               cancellable, error))
+    return FALSE;
+  n_transferred += n_commits_transferred;
+
+  g_autoptr(GVariant) detached = NULL;
+  if (!ostree_repo_read_commit_detached_metadata (src, checksum, &detached, cancellable, error))
+    return FALSE;
+  if (detached &&
+      !ostree_repo_write_commit_detached_metadata (dest, checksum, detached, cancellable, error))
     return FALSE;
 
-  if (!pull_content_only_recurse (dest, src, &iter, cancellable, error))
+  if (!g_str_equal (rev, checksum))
+    ostree_repo_transaction_set_ref (dest, NULL, rev, checksum);
+
+  if (!rpmostree_repo_auto_transaction_commit (&txn, NULL, cancellable, error))
     return FALSE;
 
+  if (out_n_transferred)
+    *out_n_transferred = n_transferred;
   return TRUE;
 }
 
@@ -520,6 +735,23 @@ rpmostree_deployment_get_layered_info (OstreeRepo        *repo,
   if (!ostree_repo_load_commit (repo, csum, &commit, NULL, error))
     return FALSE;
 
+  rpmostree_deployment_get_layered_info_for_commit (deployment, commit, out_is_layered,
+                                                    out_layer_version, out_base_layer,
+                                                    out_layered_pkgs, out_removed_base_pkgs,
+                                                    out_replaced_base_pkgs);
+  return TRUE;
+}
+
+void
+rpmostree_deployment_get_layered_info_for_commit (OstreeDeployment  *deployment,
+                                                  GVariant          *commit,
+                                                  gboolean          *out_is_layered,
+                                                  guint             *out_layer_version,
+                                                  char             **out_base_layer,
+                                                  char            ***out_layered_pkgs,
+                                                  GVariant         **out_removed_base_pkgs,
+                                                  GVariant         **out_replaced_base_pkgs)
+{
   auto layeredmeta = rpmostreecxx::deployment_layeredmeta_from_commit(*deployment, *commit);
 
   g_autoptr(GVariant) metadata = g_variant_get_child_value (commit, 0);
@@ -597,8 +829,6 @@ rpmostree_deployment_get_layered_info (OstreeRepo        *repo,
           g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("(vv)"), NULL, 0));
       *out_replaced_base_pkgs = util::move_nullify (replaced_base_pkgs);
     }
-
-  return TRUE;
 }
 
 /* Returns the base layer checksum if layered, NULL otherwise. */
@@ -1101,6 +1331,8 @@ rpmostree_auto_update_policy_to_str (RpmostreedAutomaticUpdatePolicy policy,
       return "check";
     case RPMOSTREED_AUTOMATIC_UPDATE_POLICY_STAGE:
       return "stage";
+    case RPMOSTREED_AUTOMATIC_UPDATE_POLICY_PREPARE:
+      return "prepare";
     default:
       return (char*)glnx_null_throw (error, "Invalid policy value %u", policy);
     }
@@ -1118,6 +1350,8 @@ rpmostree_str_to_auto_update_policy (const char *str,
     *out_policy = RPMOSTREED_AUTOMATIC_UPDATE_POLICY_CHECK;
   else if (g_str_equal (str, "stage") || g_str_equal (str, "ex-stage") /* backcompat */)
     *out_policy = RPMOSTREED_AUTOMATIC_UPDATE_POLICY_STAGE;
+  else if (g_str_equal (str, "prepare"))
+    *out_policy = RPMOSTREED_AUTOMATIC_UPDATE_POLICY_PREPARE;
   else
     return glnx_throw (error, "Invalid value for AutomaticUpdatePolicy: '%s'", str);
   return TRUE;
@@ -1179,3 +1413,19 @@ rpmostree_variant_native_to_be (GVariant **v)
 {
   rpmostree_variant_be_to_native (v);
 }
+
+/* Returns the modification time of @path as a `(tt)` variant, or `(0, 0)` if
+ * it doesn't exist. */
+GVariant *
+rpmostree_mtime_stamp (int          dfd,
+                       const char  *path,
+                       GError     **error)
+{
+  struct stat stbuf;
+  if (!glnx_fstatat_allow_noent (dfd, path, &stbuf, 0, error))
+    return NULL;
+  if (errno == ENOENT)
+    return g_variant_ref_sink (g_variant_new ("(tt)", (guint64)0, (guint64)0));
+  return g_variant_ref_sink (g_variant_new ("(tt)", (guint64)stbuf.st_mtim.tv_sec,
+                                            (guint64)stbuf.st_mtim.tv_nsec));
+}
@@ -28,6 +28,7 @@
 #include <gio/gio.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 #include <ostree.h>
 #include <libdnf/libdnf.h>
 
@@ -152,12 +153,33 @@ rpmostree_str_replace (const char  *buf,
 char *
 rpmostree_checksum_version (GVariant *checksum);
 
+typedef gboolean (*RpmOstreeParallelFunc) (guint     i,
+                                           gpointer  user_data,
+                                           GError  **error);
+
+gboolean
+rpmostree_parallel_for (guint                  n,
+                        const char            *thread_name,
+                        RpmOstreeParallelFunc  func,
+                        gpointer               user_data,
+                        GError               **error);
+
 gboolean
 rpmostree_pull_content_only (OstreeRepo  *dest,
                              OstreeRepo  *src,
-                             const char  *src_commit,
+                             GPtrArray   *src_commits,
+                             guint       *out_n_imported,
                              GCancellable *cancellable,
                              GError      **error);
+
+gboolean
+rpmostree_repo_transfer_commit (OstreeRepo   *src,
+                                OstreeRepo   *dest,
+                                const char   *rev,
+                                gboolean      verify,
+                                guint        *out_n_transferred,
+                                GCancellable *cancellable,
+                                GError      **error);
 const char *
 rpmostree_file_get_path_cached (GFile *file);
 
@@ -240,6 +262,17 @@ rpmostree_deployment_get_layered_info (OstreeRepo        *repo,
                                        GVariant         **out_replaced_base_pkgs,
                                        GError           **error);
 
+/* same as the above, for when @commit (the deployment's) is already loaded */
+void
+rpmostree_deployment_get_layered_info_for_commit (OstreeDeployment  *deployment,
+                                                  GVariant          *commit,
+                                                  gboolean          *out_is_layered,
+                                                  guint             *out_layer_version,
+                                                  char             **out_base_layer,
+                                                  char            ***out_layered_pkgs,
+                                                  GVariant         **out_removed_base_pkgs,
+                                                  GVariant         **out_replaced_base_pkgs);
+
 /* simpler version of the above */
 gboolean
 rpmostree_deployment_get_base_layer (OstreeRepo        *repo,
@@ -301,6 +334,19 @@ rpmostree_repo_auto_transaction_start (RpmOstreeRepoAutoTransaction     *autotxn
   autotxn->initialized = TRUE;
   return TRUE;
 }
+
+static inline gboolean
+rpmostree_repo_auto_transaction_commit (RpmOstreeRepoAutoTransaction *autotxn,
+                                        OstreeRepoTransactionStats   *out_stats,
+                                        GCancellable                 *cancellable,
+                                        GError                      **error)
+{
+  g_assert (autotxn->initialized);
+  if (!ostree_repo_commit_transaction (autotxn->repo, out_stats, cancellable, error))
+    return FALSE;
+  autotxn->initialized = FALSE;
+  return TRUE;
+}
 G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (RpmOstreeRepoAutoTransaction, rpmostree_repo_auto_transaction_cleanup)
 
 gboolean
@@ -332,4 +378,9 @@ rpmostree_variant_be_to_native (GVariant **v);
 void
 rpmostree_variant_native_to_be (GVariant **v);
 
+GVariant *
+rpmostree_mtime_stamp (int          dfd,
+                       const char  *path,
+                       GError     **error);
+
 G_END_DECLS
@@ -92,11 +92,17 @@ echo "ok db list --advisories"
 
 # And redo it to trigger relabeling. Also test --no-parent at the same time.
 origrev=$(ostree --repo="${repo}" rev-parse "${treeref}")
-runcompose --force-nocache --no-parent
+runcompose --force-nocache --no-parent --ex-static-delta |& tee out.txt
 newrev=$(ostree --repo="${repo}" rev-parse "${treeref}")
 assert_not_streq "${origrev}" "${newrev}"
 echo "ok rerun"
 
+# The delta is from the previous commit, even with --no-parent
+assert_file_has_content_literal out.txt "Generating static delta (1 upgraded, 0 added, 0 removed packages)"
+ostree --repo="${repo}" static-delta list > deltas.txt
+assert_file_has_content_literal deltas.txt "${origrev}-${newrev}"
+echo "ok static delta"
+
 # And check that --no-parent worked.
 if ostree rev-parse --repo "${repo}" "${newrev}"^ 2>error.txt; then
   assert_not_reached "New revision has a parent even with --no-parent?"
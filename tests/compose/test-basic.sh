@@ -80,3 +80,8 @@ rm -rf cache/workdir && mkdir cache/workdir
 runcompose --no-parent |& tee out.txt
 assert_file_has_content_literal out.txt "No apparent changes since previous commit"
 echo "ok --no-parent"
+
+# nothing going into the solve changed, so we didn't even need to solve
+assert_file_has_content_literal out.txt "(solve cached)"
+ls cache/solve-cache/*.gv
+echo "ok solve cache"
@@ -0,0 +1,31 @@
+#!/bin/bash
+set -xeuo pipefail
+
+dn=$(cd "$(dirname "$0")" && pwd)
+# shellcheck source=libcomposetest.sh
+. "${dn}/libcomposetest.sh"
+
+runcompose
+echo "ok compose"
+
+# Every path of the commit is in exactly one layer
+ostree --repo="${repo}" ls -R --nul-filenames-only "${treeref}" | \
+  tr '\0' '\n' | grep -v '^/$' | sort > commit-paths.txt
+rpm-ostree ex-container chunk-plan --repo="${repo}" "${treeref}" > plan.json
+jq -r '.layers[].paths[]' plan.json | sort > plan-paths.txt
+uniq -d plan-paths.txt > dups.txt
+assert_file_empty dups.txt
+diff -u commit-paths.txt plan-paths.txt
+assert_jq plan.json \
+  '.layers | length <= 64' \
+  '.layers[-1].name == "unpackaged"' \
+  '[.layers[] | select(.packages | any(. == "bash.x86_64")) | .paths[]] | any(. == "/usr/bin/bash")' \
+  '[.layers[] | select(.name != "unpackaged") | .paths[] | select(startswith("/usr/etc/"))] | length > 0' \
+  '[.layers[].paths[] | select(startswith("/var/"))] | length == 0'
+echo "ok chunk-plan layers are disjoint and cover the commit"
+
+rpm-ostree ex-container chunk-plan --repo="${repo}" --max-layers=1 "${treeref}" > plan1.json
+jq -r '.layers[].paths[]' plan1.json | sort > plan1-paths.txt
+diff -u commit-paths.txt plan1-paths.txt
+assert_jq plan1.json '.layers | length == 1'
+echo "ok chunk-plan single layer"
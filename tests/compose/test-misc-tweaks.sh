@@ -22,11 +22,14 @@ build_rpm barbar \
 build_rpm barbaz \
           files "/etc/sharedfile" \
           install "mkdir -p %{buildroot}/etc && echo shared file data > %{buildroot}/etc/sharedfile"
+build_rpm barquux \
+          files "/usr/share/barquux/data" \
+          install "mkdir -p %{buildroot}/usr/share/barquux && echo data > %{buildroot}/usr/share/barquux/data"
 
 echo gpgcheck=0 >> yumrepo.repo
 ln "$PWD/yumrepo.repo" config/yumrepo.repo
 # the top-level manifest doesn't have any packages, so just set it
-treefile_append "packages" $'["\'foobar >= 0.5\' quuz \'corge < 2.0\' barbar barbaz"]'
+treefile_append "packages" $'["\'foobar >= 0.5\' quuz \'corge < 2.0\' barbar barbaz barquux"]'
 
 # With docs and recommends, also test multi includes
 cat > config/documentation.yaml <<'EOF'
@@ -77,8 +80,12 @@ EOF
 chmod a+x postprocess.sh
 
 treefile_set "remove-files" '["etc/hosts"]'
+# The duplicate group name in the barquux ones means they can't be combined
+# into one regex
 treefile_set "remove-from-packages" '[["barbar", "/usr/bin/*"],
-                                      ["barbar", "/etc/sharedfile"]]'
+                                      ["barbar", "/etc/sharedfile"],
+                                      ["barquux", "/usr/(?<d>bin)/.*"],
+                                      ["barquux", "/usr/(?<d>share)/barquux/.*"]]'
 rnd=$RANDOM
 echo $rnd > config/foo.txt
 echo bar >  config/bar.txt
@@ -166,6 +173,11 @@ ostree --repo=${repo} ls ${treeref} /usr/etc > out.txt
 assert_file_has_content out.txt 'etc/sharedfile'
 echo "ok remove-from-packages"
 
+ostree --repo=${repo} ls -R ${treeref} /usr > out.txt
+assert_not_file_has_content out.txt 'bin/barquux'
+assert_not_file_has_content out.txt 'barquux/data'
+echo "ok remove-from-packages uncombinable patterns"
+
 # https://github.com/projectatomic/rpm-ostree/issues/669
 ostree --repo=${repo} ls  ${treeref} /tmp > ls.txt
 assert_file_has_content ls.txt 'l00777 0 0      0 /tmp -> sysroot/tmp'
@@ -192,6 +204,17 @@ ostree --repo=${repo} cat ${treeref} /usr/bin/ls > ls.txt
 assert_file_has_content ls.txt '^sweet new ls binary$'
 echo "ok layers"
 
+# Layers get relabeled once into the build repo, for use with the devino cache
+ostree --repo=cache/repo-build refs > refs.txt
+for x in $(seq 3); do
+  assert_file_has_content refs.txt "^rpmostree/layer/testlayer-${x}$"
+done
+assert_file_has_content refs.txt '^rpmostree/layer/testoverride-1$'
+ostree --repo=cache/repo-build show --print-metadata-key=rpmostree.layer-source \
+  rpmostree/layer/testlayer-1 > source.txt
+assert_file_has_content source.txt "$(ostree --repo=cache/repo-build rev-parse testlayer-1)"
+echo "ok layers relabeled"
+
 # Test readonly-executables
 ostree --repo=${repo} ls ${treeref} /usr/bin/bash > ls.txt
 assert_file_has_content ls.txt '^-00555 .*/usr/bin/bash$'
@@ -0,0 +1,116 @@
+#!/bin/bash
+set -xeuo pipefail
+
+dn=$(cd "$(dirname "$0")" && pwd)
+# shellcheck source=libcomposetest.sh
+. "${dn}/libcomposetest.sh"
+
+# Number of packages a compose downloaded, from its output
+n_downloaded() {
+  sed -ne 's/^Will download: \([0-9]*\) package.*/\1/p' "$1" | grep . || echo 0
+}
+
+# Two concurrent composes sharing a pkgcache
+shared=${test_tmpdir}/cache/shared-pkgcache
+locks=${shared}/extensions/rpmostree/pkgcache-locks
+mkdir -p cache/a cache/b
+runasroot sh -xec "
+rpm-ostree compose tree --unified-core --repo=${repo} --download-only \
+  --cachedir=${test_tmpdir}/cache/a --ex-shared-pkgcache=${shared} ${treefile} > a.txt &
+pid=\$!
+rpm-ostree compose tree --unified-core --repo=${repo} --download-only \
+  --cachedir=${test_tmpdir}/cache/b --ex-shared-pkgcache=${shared} ${treefile} > b.txt
+wait \$pid
+"
+ostree --repo="${shared}" refs rpmostree/pkg > refs.txt
+assert_file_has_content refs.txt 'bash/'
+# nothing was imported into the private caches
+for c in a b; do
+  if test -d cache/${c}/pkgcache-repo; then
+    assert_not_reached "private pkgcache created in cache/${c}"
+  fi
+done
+# each package was fetched exactly once between the two
+n_pkgs=$(wc -l < refs.txt)
+assert_streq "$(($(n_downloaded a.txt) + $(n_downloaded b.txt)))" "${n_pkgs}"
+# and the lock files are cleaned up
+ls "${locks}" > locks.txt
+assert_file_empty locks.txt
+echo "ok concurrent composes with shared pkgcache"
+
+# A further compose finds everything in the shared cache, so has nothing to fetch
+runasroot rpm-ostree compose tree --unified-core --repo=${repo} --download-only \
+  --cachedir=${test_tmpdir}/cache/a --ex-shared-pkgcache=${shared} ${treefile} > c.txt
+assert_not_file_has_content c.txt 'Will download'
+echo "ok shared pkgcache reused"
+
+# Drop bash from the cache, and hold its lock as if another compose were
+# fetching it: we must leave it to them, then import it ourselves once they
+# release it without having done so.
+lockfile_of() {
+  local chksum
+  chksum=$(ostree --repo="${shared}" show --print-metadata-key=rpmostree.repodata_checksum \
+    "$1" | tr -d "'")
+  echo "${locks}/${chksum}.lock"
+}
+bash_ref=rpmostree/pkg/$(grep '^bash/' refs.txt)
+bash_lock=$(lockfile_of "${bash_ref}")
+ostree --repo="${shared}" refs --delete "${bash_ref}"
+# Usage: holdlock.py N LOCKFILE...
+# The locks are released once N processes block on a lock, i.e. the
+# composes got to importing; see /proc/locks in proc(5).
+cat > holdlock.py <<'EOF'
+import fcntl, sys, time
+n_waiters = int(sys.argv[1])
+files = [open(path, 'a') for path in sys.argv[2:]]
+for f in files:
+    fcntl.lockf(f, fcntl.LOCK_EX)
+open('locked', 'w').close()
+for _ in range(3000):
+    with open('/proc/locks') as locks:
+        if sum(l.split()[1] == '->' for l in locks) >= n_waiters:
+            break
+    time.sleep(0.1)
+EOF
+runasroot sh -xec "
+rm -f locked
+python3 holdlock.py 1 ${bash_lock} &
+pid=\$!
+while ! test -f locked; do sleep 0.1; done
+rpm-ostree compose tree --unified-core --repo=${repo} --download-only \
+  --cachedir=${test_tmpdir}/cache/b --ex-shared-pkgcache=${shared} ${treefile} > d.txt
+wait \$pid
+"
+assert_file_has_content d.txt 'Skipping download of 1 package fetched concurrently'
+assert_file_has_content d.txt 'Waiting for 1 package imported concurrently'
+ostree --repo="${shared}" rev-parse "${bash_ref}"
+echo "ok shared pkgcache contended download"
+
+# Two composes waiting for the same two packages in opposite order.  Once
+# they're released, each gets the first lock it waits for; neither may then
+# wait for the other's while holding it.
+other_ref=rpmostree/pkg/$(grep -v '^bash/' refs.txt | head -1)
+other_lock=$(lockfile_of "${other_ref}")
+ostree --repo="${shared}" refs --delete "${bash_ref}" "${other_ref}"
+runasroot sh -xec "
+rm -f locked
+python3 holdlock.py 2 ${bash_lock} ${other_lock} &
+pid=\$!
+while ! test -f locked; do sleep 0.1; done
+timeout 10m rpm-ostree compose tree --unified-core --repo=${repo} --download-only \
+  --cachedir=${test_tmpdir}/cache/a --ex-shared-pkgcache=${shared} ${treefile} > e.txt &
+epid=\$!
+RPMOSTREE_DEBUG_REVERSE_CONTENDED_IMPORTS=1 \
+  timeout 10m rpm-ostree compose tree --unified-core --repo=${repo} --download-only \
+  --cachedir=${test_tmpdir}/cache/b --ex-shared-pkgcache=${shared} ${treefile} > f.txt
+wait \$epid
+wait \$pid
+"
+for f in e.txt f.txt; do
+  assert_file_has_content ${f} 'Waiting for 2 packages imported concurrently'
+done
+ostree --repo="${shared}" rev-parse "${bash_ref}"
+ostree --repo="${shared}" rev-parse "${other_ref}"
+ls "${locks}" > locks.txt
+assert_file_empty locks.txt
+echo "ok shared pkgcache contended in opposite order"
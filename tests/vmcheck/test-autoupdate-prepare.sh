@@ -0,0 +1,69 @@
+#!/bin/bash
+#
+# Copyright (C) 2021 Red Hat, Inc.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. ${commondir}/libtest.sh
+. ${commondir}/libvm.sh
+
+set -x
+
+# Prepare an OSTree repo with updates, and layer a package on top
+vm_ostreeupdate_prepare
+vm_build_rpm layered-prepare
+vm_rpmostree rebase vmcheckmote:vmcheck --install layered-prepare
+vm_reboot
+vm_start_httpd ostree_server $REMOTE_OSTREE 8888
+vm_assert_status_jq \
+    '.deployments[0]["version"] == "v1"' \
+    '.deployments[0]["packages"]|index("layered-prepare") >= 0'
+osname=$(vm_get_booted_deployment_info osname)
+
+vm_ostreeupdate_create v2
+
+vm_rpmostree cleanup -m
+vm_change_update_policy prepare
+vm_rpmostree status > status.txt
+assert_file_has_content_literal status.txt 'AutomaticUpdates: prepare; rpm-ostreed-automatic.timer: inactive'
+
+vm_rpmostree upgrade --trigger-automatic-update-policy > out.txt
+assert_file_has_content out.txt 'Update prepared.'
+# nothing is staged, but the layered commit is ready
+vm_assert_status_jq ".deployments[0][\"booted\"]" \
+                    ".deployments[0][\"staged\"]|not"
+prepared=$(vm_cmd ostree rev-parse rpmostree/prepared/${osname})
+vm_cmd test -f /var/cache/rpm-ostree/prepared-update.gv
+# doing it again is a no-op
+vm_rpmostree upgrade --trigger-automatic-update-policy
+assert_streq "$(vm_cmd ostree rev-parse rpmostree/prepared/${osname})" "${prepared}"
+echo "ok autoupdate prepare"
+
+vm_rpmostree upgrade > upgrade.txt
+assert_file_has_content_literal upgrade.txt 'note: automatic updates (prepare) are enabled'
+assert_file_has_content upgrade.txt 'Using prepared layered commit'
+vm_assert_status_jq ".deployments[0][\"staged\"]" \
+                    ".deployments[0][\"version\"] == \"v2\"" \
+                    ".deployments[0][\"checksum\"] == \"${prepared}\"" \
+                    '.deployments[0]["packages"]|index("layered-prepare") >= 0'
+# it was consumed
+vm_cmd test ! -f /var/cache/rpm-ostree/prepared-update.gv
+if vm_cmd ostree rev-parse rpmostree/prepared/${osname}; then
+  assert_not_reached "prepared ref still exists"
+fi
+echo "ok upgrade uses prepared commit"
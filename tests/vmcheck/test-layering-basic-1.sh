@@ -254,8 +254,12 @@ vm_reboot
 vm_assert_layered_pkg foo absent
 echo "ok pkg foo removed"
 
+booted_csum=$(vm_get_booted_csum)
+vm_cmd ostree refs --create=rpmostree/layer/stale ${booted_csum}
 vm_rpmostree cleanup -b
 vm_assert_status_jq '.deployments|length == 2'
+vm_cmd ostree refs rpmostree/layer > refs.txt
+assert_file_empty refs.txt
 echo "ok baseline cleanup"
 
 vm_rpmostree cleanup -r
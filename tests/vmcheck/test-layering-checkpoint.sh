@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# Copyright (C) 2021 Red Hat, Inc.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. ${commondir}/libtest.sh
+. ${commondir}/libvm.sh
+
+set -x
+
+# Regenerating the initramfs gives us a window after assembly to interrupt in
+vm_rpmostree initramfs --enable
+vm_reboot
+
+vm_build_rpm checkpointed \
+             post "echo running-checkpointed-post 1>&2"
+vm_cmd systemctl stop vmcheck-install-checkpoint || true
+vm_cmd systemctl reset-failed vmcheck-install-checkpoint || true
+cursor=$(vm_get_journal_cursor)
+vm_cmd systemd-run --unit vmcheck-install-checkpoint rpm-ostree install checkpointed
+vm_wait_content_after_cursor "${cursor}" "Checkpointed assembled tree"
+vm_cmd systemctl kill -s KILL rpm-ostreed
+vm_cmd systemctl stop vmcheck-install-checkpoint || true
+vm_cmd test -f /ostree/repo/extensions/rpmostree/private/checkpoint/state.json
+echo "ok checkpoint saved"
+
+cursor=$(vm_get_journal_cursor)
+vm_rpmostree install checkpointed > out.txt
+assert_file_has_content out.txt 'Resuming from checkpoint of assembled tree'
+vm_cmd journalctl --after-cursor "'${cursor}'" > journal.txt
+assert_not_file_has_content journal.txt 'running-checkpointed-post'
+vm_assert_status_jq '.deployments[0]["packages"]|index("checkpointed") >= 0'
+vm_cmd test ! -e /ostree/repo/extensions/rpmostree/private/checkpoint
+echo "ok resume from checkpoint"
@@ -0,0 +1,51 @@
+#!/bin/bash
+#
+# Copyright (C) 2021 Red Hat, Inc.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. ${commondir}/libtest.sh
+. ${commondir}/libvm.sh
+
+set -x
+
+vm_build_rpm reused
+vm_rpmostree install reused
+vm_reboot
+vm_assert_status_jq '.deployments[0]["packages"]|index("reused") >= 0'
+booted_csum=$(vm_get_booted_csum)
+
+# Dropping the package and asking for it again gets us the same tree
+vm_rpmostree uninstall reused
+vm_rpmostree install reused > out.txt
+assert_file_has_content out.txt 'Reusing assembled layered commit'
+vm_assert_status_jq ".deployments[0][\"checksum\"] == \"${booted_csum}\"" \
+                    '.deployments[0]["packages"]|index("reused") >= 0'
+echo "ok reuse assembled commit"
+
+# A commit assembled with different inputs isn't reused: here, the pending
+# deployment differs from the booted one only by regenerating the initramfs,
+# and comes first, but disabling that again must get us the booted commit
+vm_rpmostree cleanup -p
+vm_rpmostree initramfs --enable
+initramfs_csum=$(vm_get_pending_csum)
+assert_not_streq "${initramfs_csum}" "${booted_csum}"
+vm_rpmostree initramfs --disable > out.txt
+assert_file_has_content out.txt 'Reusing assembled layered commit'
+vm_assert_status_jq ".deployments[0][\"checksum\"] == \"${booted_csum}\""
+echo "ok assembled commit not reused with different initramfs config"
@@ -377,3 +377,37 @@ vm_rpmostree upgrade 2>err.txt
 assert_not_file_has_content err.txt 'Updates and deployments are driven by OtherTestDriver'
 vm_rpmostree cleanup -p
 echo "ok upgrade without --bypass-driver when same systemd unit"
+
+# `status` is served from the daemon's snapshot while it isn't running
+vm_rpmostree status --json > status-daemon.json
+vm_cmd test -f /run/rpm-ostree/status.gv
+vm_cmd systemctl stop rpm-ostreed
+vm_rpmostree status --json > status-snapshot.json
+if vm_cmd systemctl is-active rpm-ostreed; then
+  assert_not_reached "status activated the daemon"
+fi
+cmp status-daemon.json status-snapshot.json
+# but not once something it was derived from changed
+vm_cmd touch /etc/rpm-ostreed.conf
+vm_rpmostree status
+vm_cmd systemctl is-active rpm-ostreed
+echo "ok status from snapshot"
+
+# nor once the booted ref moved while the daemon was down, since it'd be
+# missing the new pending base
+vm_rpmostree status
+vm_cmd systemctl stop rpm-ostreed
+vm_cmd ostree commit -b vmcheck --fsync=no --tree=ref=vmcheck
+vm_rpmostree status
+vm_cmd systemctl is-active rpm-ostreed
+vm_cmd ostree reset vmcheck vmcheck^
+echo "ok status from snapshot after ref change"
+
+# Properties are loaded lazily, but ObjectManager clients must still see them
+# right after the daemon starts
+vm_cmd systemctl restart rpm-ostreed
+vm_cmd gdbus call -y -d org.projectatomic.rpmostree1 -o /org/projectatomic/rpmostree1 \
+  -m org.freedesktop.DBus.ObjectManager.GetManagedObjects > managed.txt
+assert_file_has_content managed.txt "'Deployments': <\[{.*'checksum'"
+assert_file_has_content managed.txt "'BootedDeployment': <{.*'checksum'"
+echo "ok properties in GetManagedObjects"